@@ -5,6 +5,7 @@ mkdir bin
 cd src
 
 gcc core/gfx.c \
+    core/log.c \
     core/shader.c \
     core/timer.c \
     core/math2d.c \
@@ -13,6 +14,10 @@ gcc core/gfx.c \
     core/glist.c \
     core/text_list.c \
     core/socket.c \
+    core/metrics.c \
+    core/jobs.c \
+    core/thread.c \
+    core/profiler.c \
     core/particles.c \
     player.c \
     net.c \
@@ -23,7 +28,7 @@ gcc core/gfx.c \
     powerups.c \
     main.c \
     -Icore \
-    -lglfw -lGLU -lGLEW -lGL -lm \
+    -lglfw -lGLU -lGLEW -lGL -lEGL -lm -lpthread \
     -o ../bin/spacemen
     
     #-lglfw -lGLU -lGLEW -lGL -lm -O2 \
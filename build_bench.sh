@@ -0,0 +1,37 @@
+#!/bin/sh
+# Builds the headless simulation benchmark. Run it from the repository root:
+#   ./bin/spacemen_bench                   compare against bench/baseline.txt
+#   ./bin/spacemen_bench --write-baseline  record a new baseline
+mkdir -p bin
+
+cd src
+
+gcc core/gfx.c \
+    core/log.c \
+    core/shader.c \
+    core/timer.c \
+    core/math2d.c \
+    core/window.c \
+    core/imgui.c \
+    core/glist.c \
+    core/text_list.c \
+    core/socket.c \
+    core/metrics.c \
+    core/jobs.c \
+    core/thread.c \
+    core/profiler.c \
+    core/particles.c \
+    player.c \
+    net.c \
+    settings.c \
+    projectile.c \
+    effects.c \
+    editor.c \
+    powerups.c \
+    main.c \
+    bench.c \
+    -Icore \
+    -DSPACEMEN_BENCH=1 -DBENCH_COUNT_ALLOCS=1 -DPROFILER_ENABLED=0 \
+    -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+    -lglfw -lGLU -lGLEW -lGL -lEGL -lm -lpthread -O2 \
+    -o ../bin/spacemen_bench
@@ -0,0 +1,742 @@
+#include "headers.h"
+#include <GL/glew.h>
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "main.h"
+#include "core/gfx.h"
+#include "core/window.h"
+#include "core/particles.h"
+#include "core/glist.h"
+#include "player.h"
+#include "projectile.h"
+#include "powerups.h"
+#include "effects.h"
+#include "net.h"
+
+// Headless simulation benchmark. Runs the same update functions as the
+// server tick without a window, for scripted scenarios of N AI players,
+// M projectiles and K particle spawners, and compares the results against
+// a checked-in baseline so regressions fail the run.
+//
+// With --render the same scenarios are drawn with draw_game() into an
+// offscreen GL context instead (llvmpipe on machines without a GPU), and
+// draw calls, state changes, uploaded bytes and CPU frame time are reported.
+//
+// Run from the repository root: ./bin/spacemen_bench
+
+#define BENCH_SCENARIOS_FILE "bench/scenarios.txt"
+#define BENCH_BASELINE_FILE  "bench/baseline.txt"
+#define BENCH_MAX_SCENARIOS  32
+#define BENCH_NAME_MAX       32
+#define BENCH_WARMUP_TICKS   60
+#define BENCH_SEED           1234
+#define BENCH_REPEATS        5    // best run of each scenario is kept
+#define BENCH_NET_ITERATIONS 20000
+#define BENCH_RENDER_FRAMES  300  // per scenario in --render mode, instead of its ticks
+#define BENCH_TOLERANCE      20.0 // percent slower than baseline before failing
+#define BENCH_MIN_DELTA_NS   1000 // changes smaller than this are timer noise
+
+typedef struct
+{
+    char name[BENCH_NAME_MAX+1];
+    int players;
+    int projectiles;
+    int spawners;
+    int ticks;
+} BenchScenario;
+
+typedef struct
+{
+    char name[BENCH_NAME_MAX+1];
+    double ns_per_tick;
+    double ns_p50;
+    double ns_p99;
+    double allocs_per_tick;
+    double cache_misses_per_tick; // < 0 when perf counters aren't available
+    double instructions_per_tick;
+} BenchResult;
+
+extern glist* spawner_list;
+
+// continuous effects that keep spawners busy for the whole run
+static const int spawner_effects[] = {EFFECT_JETS, EFFECT_FIRE, EFFECT_SMOKE, EFFECT_SMOKE2, EFFECT_SPARKS1, EFFECT_GUN_SMOKE1};
+
+static BenchScenario scenarios[BENCH_MAX_SCENARIOS];
+static int num_scenarios = 0;
+
+static BenchResult baseline[BENCH_MAX_SCENARIOS];
+static int num_baseline = 0;
+
+static Player initial_players[MAX_PLAYERS];
+
+// =========================
+// Allocation counting
+// =========================
+
+// Built with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc (see build_bench.sh)
+// so every allocation made by the game code goes through these.
+#if BENCH_COUNT_ALLOCS
+static uint64_t alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+static uint64_t get_alloc_count()
+{
+#if BENCH_COUNT_ALLOCS
+    return alloc_count;
+#else
+    return 0;
+#endif
+}
+
+// =========================
+// Perf counters
+// =========================
+
+typedef enum
+{
+    COUNTER_CACHE_MISSES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_MAX
+} CounterType;
+
+static int counter_fds[COUNTER_MAX] = {-1, -1};
+
+static void counters_open()
+{
+#if __linux__
+    const uint64_t configs[COUNTER_MAX] = {PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_INSTRUCTIONS};
+
+    for(int i = 0; i < COUNTER_MAX; ++i)
+    {
+        struct perf_event_attr attr = {0};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counter_fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    if(counter_fds[COUNTER_CACHE_MISSES] < 0)
+        LOGW("Perf counters unavailable (%s), cache misses won't be reported", strerror(errno));
+#endif
+}
+
+static void counters_start()
+{
+#if __linux__
+    for(int i = 0; i < COUNTER_MAX; ++i)
+    {
+        if(counter_fds[i] < 0) continue;
+        ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+// returns -1 when the counter isn't available
+static double counters_stop(CounterType type)
+{
+#if __linux__
+    int fd = counter_fds[type];
+    if(fd < 0) return -1.0;
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    uint64_t value = 0;
+    if(read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1.0;
+    return (double)value;
+#else
+    return -1.0;
+#endif
+}
+
+// =========================
+// Scenario / baseline files
+// =========================
+
+// one scenario per line: name players projectiles spawners ticks
+static bool load_scenarios(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if(!fp)
+    {
+        LOGE("Failed to open scenario file %s", path);
+        return false;
+    }
+
+    char line[256];
+    while(fgets(line, sizeof(line), fp) && num_scenarios < BENCH_MAX_SCENARIOS)
+    {
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+
+        BenchScenario* s = &scenarios[num_scenarios];
+        if(sscanf(line, "%32s %d %d %d %d", s->name, &s->players, &s->projectiles, &s->spawners, &s->ticks) == 5)
+            num_scenarios++;
+        else
+            LOGW("Skipping malformed scenario line: %s", line);
+    }
+
+    fclose(fp);
+    return num_scenarios > 0;
+}
+
+// one result per line: name p50_ns allocs_per_tick
+static void load_baseline(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if(!fp)
+    {
+        LOGW("No baseline at %s, nothing to compare against", path);
+        return;
+    }
+
+    char line[256];
+    while(fgets(line, sizeof(line), fp) && num_baseline < BENCH_MAX_SCENARIOS)
+    {
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+
+        BenchResult* b = &baseline[num_baseline];
+        if(sscanf(line, "%32s %lf %lf", b->name, &b->ns_p50, &b->allocs_per_tick) == 3)
+            num_baseline++;
+    }
+
+    fclose(fp);
+}
+
+static BenchResult* find_baseline(const char* name)
+{
+    for(int i = 0; i < num_baseline; ++i)
+    {
+        if(STR_EQUAL(baseline[i].name, name))
+            return &baseline[i];
+    }
+    return NULL;
+}
+
+static bool write_baseline(const char* path, BenchResult* results, int count)
+{
+    FILE* fp = fopen(path, "w");
+    if(!fp)
+    {
+        LOGE("Failed to write baseline %s", path);
+        return false;
+    }
+
+    fprintf(fp, "# generated by spacemen_bench --write-baseline\n");
+    fprintf(fp, "# timings are machine specific, re-record on the machine you compare on\n");
+    fprintf(fp, "# the median tick time is compared since it's less noisy than the mean\n");
+    fprintf(fp, "# name p50_ns allocs_per_tick\n");
+    for(int i = 0; i < count; ++i)
+        fprintf(fp, "%-16s %10.0f %8.3f\n", results[i].name, results[i].ns_p50, results[i].allocs_per_tick);
+
+    fclose(fp);
+    return true;
+}
+
+// =========================
+// Running
+// =========================
+
+static void reset_world()
+{
+    projectile_clear_all();
+    powerups_init();
+
+    for(int i = 0; i < spawner_list->count; ++i)
+        list_delete(spawners[i].particle_list);
+    list_clear(spawner_list);
+
+    // every scenario and repeat starts from the same player state
+    memcpy(players, initial_players, sizeof(players));
+}
+
+static void setup_scenario(BenchScenario* s)
+{
+    srand(BENCH_SEED);
+    reset_world();
+
+    num_players = RANGE(s->players, 0, MAX_PLAYERS);
+    for(int i = 0; i < num_players; ++i)
+    {
+        Player* p = &players[i];
+        p->active = true;
+        p->ai = true;
+        p->pos.x = rand() % view_width;
+        p->pos.y = rand() % view_height;
+        player_update_positions(p);
+    }
+
+    int num_effects = sizeof(spawner_effects)/sizeof(spawner_effects[0]);
+    for(int i = 0; i < MIN(s->spawners, MAX_PARTICLE_SPAWNERS); ++i)
+    {
+        int effect = effect_handles[spawner_effects[i % num_effects]];
+        particles_spawn_effect(rand() % view_width, rand() % view_height, 0, effect, NULL, 0.0, true, false);
+    }
+}
+
+// keeps the scenario's projectile count steady as old ones expire, not timed
+static void top_up_projectiles(BenchScenario* s)
+{
+    int target = MIN(s->projectiles, MAX_PROJECTILES);
+    while(plist->count < target)
+    {
+        Player* p = &players[rand() % MAX(num_players, 1)];
+        p->angle_deg = RAND_FLOAT(0.0, 360.0);
+        projectile_add(p, 0.0, 0.0);
+    }
+}
+
+static void simulate_tick(double dt)
+{
+    projectile_update(dt);
+    powerups_update(dt);
+    particles_update(dt);
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+        player_update(&players[i], dt);
+
+    projectile_handle_collisions(dt);
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void run_scenario(BenchScenario* s, BenchResult* r)
+{
+    const double dt = 1.0/TARGET_FPS;
+
+    setup_scenario(s);
+
+    for(int i = 0; i < BENCH_WARMUP_TICKS; ++i)
+    {
+        top_up_projectiles(s);
+        simulate_tick(dt);
+    }
+
+    int ticks = MAX(s->ticks, 1);
+    double* tick_ns = malloc(ticks*sizeof(double));
+
+    double total = 0.0;
+    double cache_misses = 0.0;
+    double instructions = 0.0;
+    uint64_t allocs = 0;
+
+    for(int i = 0; i < ticks; ++i)
+    {
+        top_up_projectiles(s);
+
+        uint64_t allocs0 = get_alloc_count();
+        counters_start();
+        double t0 = timer_get_time();
+
+        simulate_tick(dt);
+
+        double t1 = timer_get_time();
+        double misses = counters_stop(COUNTER_CACHE_MISSES);
+        double instr = counters_stop(COUNTER_INSTRUCTIONS);
+        allocs += get_alloc_count() - allocs0;
+
+        tick_ns[i] = (t1 - t0)*1000000000.0;
+        total += tick_ns[i];
+        cache_misses = (misses < 0.0 || cache_misses < 0.0) ? -1.0 : cache_misses + misses;
+        instructions = (instr < 0.0 || instructions < 0.0) ? -1.0 : instructions + instr;
+    }
+
+    qsort(tick_ns, ticks, sizeof(double), compare_double);
+
+    memset(r, 0, sizeof(BenchResult));
+    memcpy(r->name, s->name, sizeof(r->name));
+    r->ns_per_tick = total / ticks;
+    r->ns_p50 = tick_ns[ticks/2];
+    r->ns_p99 = tick_ns[MIN(ticks-1, (int)(ticks*0.99))];
+    r->allocs_per_tick = (double)allocs / ticks;
+    r->cache_misses_per_tick = cache_misses < 0.0 ? -1.0 : cache_misses / ticks;
+    r->instructions_per_tick = instructions < 0.0 ? -1.0 : instructions / ticks;
+
+    free(tick_ns);
+}
+
+// =========================
+// Rendering
+// =========================
+
+static uint32_t png_crc(uint32_t crc, const uint8_t* data, size_t len)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for(int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void png_write_u32(FILE* fp, uint32_t v, uint32_t* crc)
+{
+    uint8_t b[4] = {v >> 24, v >> 16, v >> 8, v};
+    fwrite(b, 1, 4, fp);
+    if(crc) *crc = png_crc(*crc, b, 4);
+}
+
+static void png_write_bytes(FILE* fp, const void* data, size_t len, uint32_t* crc)
+{
+    fwrite(data, 1, len, fp);
+    *crc = png_crc(*crc, data, len);
+}
+
+// uncompressed (stored deflate) RGBA PNG, big but dependency free
+static bool write_png(const char* path, const uint8_t* rgba, int w, int h)
+{
+    FILE* fp = fopen(path, "wb");
+    if(!fp)
+    {
+        LOGE("Failed to write %s", path);
+        return false;
+    }
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, fp);
+
+    uint32_t crc = 0;
+    uint8_t ihdr_fields[5] = {8, 6, 0, 0, 0}; // 8 bit RGBA, no interlace
+    png_write_u32(fp, 13, NULL);
+    png_write_bytes(fp, "IHDR", 4, &crc);
+    png_write_u32(fp, w, &crc);
+    png_write_u32(fp, h, &crc);
+    png_write_bytes(fp, ihdr_fields, 5, &crc);
+    png_write_u32(fp, crc, NULL);
+
+    // every row gets a filter byte of 0
+    size_t row_len = 1 + (size_t)w*4;
+    size_t raw_len = row_len*h;
+    size_t num_blocks = (raw_len + 0xFFFF - 1) / 0xFFFF;
+
+    crc = 0;
+    png_write_u32(fp, 2 + num_blocks*5 + raw_len + 4, NULL);
+    png_write_bytes(fp, "IDAT", 4, &crc);
+
+    const uint8_t zlib_header[2] = {0x78, 0x01};
+    png_write_bytes(fp, zlib_header, 2, &crc);
+
+    uint32_t adler_a = 1, adler_b = 0;
+    size_t pos = 0;
+    for(size_t i = 0; i < num_blocks; ++i)
+    {
+        uint16_t len = (uint16_t)MIN(raw_len - pos, 0xFFFF);
+        uint8_t block_header[5] = {i == num_blocks-1, len, len >> 8, ~len, (uint16_t)~len >> 8};
+        png_write_bytes(fp, block_header, 5, &crc);
+
+        for(int j = 0; j < len; ++j, ++pos)
+        {
+            size_t col = pos % row_len;
+            uint8_t b = col == 0 ? 0 : rgba[(pos/row_len)*w*4 + col-1];
+            png_write_bytes(fp, &b, 1, &crc);
+            adler_a = (adler_a + b) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    png_write_u32(fp, (adler_b << 16) | adler_a, &crc);
+    png_write_u32(fp, crc, NULL);
+
+    crc = 0;
+    png_write_u32(fp, 0, NULL);
+    png_write_bytes(fp, "IEND", 4, &crc);
+    png_write_u32(fp, crc, NULL);
+
+    fclose(fp);
+    return true;
+}
+
+// draws the scenario every tick, png_prefix writes the last frame to <prefix><name>.png
+static void run_render_scenario(BenchScenario* s, int frames, const char* png_prefix)
+{
+    const double dt = 1.0/TARGET_FPS;
+
+    setup_scenario(s);
+
+    for(int i = 0; i < BENCH_WARMUP_TICKS; ++i)
+    {
+        top_up_projectiles(s);
+        simulate_tick(dt);
+    }
+
+    frames = MAX(frames, 1);
+    double* frame_ns = malloc(frames*sizeof(double));
+    double total = 0.0;
+    GFXStats totals = {0};
+
+    for(int i = 0; i < frames; ++i)
+    {
+        top_up_projectiles(s);
+        simulate_tick(dt);
+
+        gfx_reset_stats();
+        double t0 = timer_get_time();
+
+        draw_game(false);
+        gfx_flush();
+
+        double t1 = timer_get_time();
+
+        // not timed, keeps the driver from queueing frames and stalling a later one
+        glFinish();
+
+        GFXStats stats;
+        gfx_get_stats(&stats);
+        totals.draw_calls += stats.draw_calls;
+        totals.state_changes += stats.state_changes;
+        totals.upload_bytes += stats.upload_bytes;
+
+        frame_ns[i] = (t1 - t0)*1000000000.0;
+        total += frame_ns[i];
+    }
+
+    qsort(frame_ns, frames, sizeof(double), compare_double);
+
+    printf("%-16s %3d %4d %4d %10.0f %10.0f %10.0f %8.1f %8.1f %10.1f\n",
+            s->name, s->players, s->projectiles, s->spawners,
+            total/frames, frame_ns[frames/2], frame_ns[MIN(frames-1, (int)(frames*0.99))],
+            (double)totals.draw_calls/frames, (double)totals.state_changes/frames,
+            totals.upload_bytes/1024.0/frames);
+
+    free(frame_ns);
+
+    if(png_prefix)
+    {
+        char path[256] = {0};
+        int len = snprintf(path, sizeof(path), "%s%s.png", png_prefix, s->name);
+        if(len < 0 || len >= (int)sizeof(path))
+        {
+            LOGW("PNG path too long for %s, not saving it", s->name);
+            return;
+        }
+
+        uint8_t* rgba = malloc((size_t)view_width*view_height*4);
+        window_read_pixels(rgba);
+        write_png(path, rgba, view_width, view_height);
+        free(rgba);
+    }
+}
+
+// returns true if the result regressed against the baseline
+static bool report(BenchScenario* s, BenchResult* r, double tolerance)
+{
+    char misses[32] = "n/a";
+    char instr[32] = "n/a";
+    if(r->cache_misses_per_tick >= 0.0) snprintf(misses, sizeof(misses), "%.0f", r->cache_misses_per_tick);
+    if(r->instructions_per_tick >= 0.0) snprintf(instr, sizeof(instr), "%.0f", r->instructions_per_tick);
+
+    printf("%-16s %3d %4d %4d %10.0f %10.0f %10.0f %8.3f %10s %12s",
+            r->name, s->players, s->projectiles, s->spawners,
+            r->ns_per_tick, r->ns_p50, r->ns_p99, r->allocs_per_tick, misses, instr);
+
+    BenchResult* b = find_baseline(r->name);
+    if(!b)
+    {
+        printf("   (no baseline)\n");
+        return false;
+    }
+
+    double delta = r->ns_p50 - b->ns_p50;
+    double change = 100.0*delta/b->ns_p50;
+    bool slower = change > tolerance && delta > BENCH_MIN_DELTA_NS;
+    bool more_allocs = r->allocs_per_tick > b->allocs_per_tick + 0.001;
+
+    printf(" %+7.1f%%%s%s\n", change, slower ? "  REGRESSION" : "", more_allocs ? "  ALLOCS" : "");
+    return slower || more_allocs;
+}
+
+static void print_usage()
+{
+    printf("usage: spacemen_bench [options]\n"
+           "  --scenarios <file>   scenario file (default " BENCH_SCENARIOS_FILE ")\n"
+           "  --baseline <file>    baseline file (default " BENCH_BASELINE_FILE ")\n"
+           "  --write-baseline     save the results as the new baseline\n"
+           "  --tolerance <pct>    allowed slowdown before failing (default %.0f)\n"
+           "  --only <name>        run a single scenario from the file\n"
+           "  --repeats <n>        runs per scenario, the fastest is kept (default %d)\n"
+           "  --players <n> --projectiles <m> --spawners <k> --ticks <t>\n"
+           "                       run one ad hoc scenario instead of the file\n"
+           "  --net                packet encode/decode throughput and wire size report\n"
+           "  --render             draw the scenarios offscreen and report renderer stats\n"
+           "  --frames <n>         frames per scenario with --render (default %d)\n"
+           "  --png <prefix>       with --render, save each scenario's last frame as <prefix><name>.png\n",
+           BENCH_TOLERANCE, BENCH_REPEATS, BENCH_RENDER_FRAMES);
+}
+
+int main(int argc, char* argv[])
+{
+    init_timer();
+    log_init(LOG_LEVEL_WARNING);
+
+    const char* scenarios_path = BENCH_SCENARIOS_FILE;
+    const char* baseline_path = BENCH_BASELINE_FILE;
+    const char* only = NULL;
+    bool save_baseline = false;
+    double tolerance = BENCH_TOLERANCE;
+    int repeats = BENCH_REPEATS;
+    bool render = false;
+    int render_frames = BENCH_RENDER_FRAMES;
+    const char* png_prefix = NULL;
+
+    BenchScenario adhoc = {.name = "adhoc", .players = 4, .projectiles = 64, .spawners = 16, .ticks = 600};
+    bool use_adhoc = false;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool has_value = (i+1 < argc);
+
+        if(STR_EQUAL(argv[i], "--scenarios") && has_value)       scenarios_path = argv[++i];
+        else if(STR_EQUAL(argv[i], "--baseline") && has_value)   baseline_path = argv[++i];
+        else if(STR_EQUAL(argv[i], "--write-baseline"))          save_baseline = true;
+        else if(STR_EQUAL(argv[i], "--tolerance") && has_value)  tolerance = atof(argv[++i]);
+        else if(STR_EQUAL(argv[i], "--only") && has_value)       only = argv[++i];
+        else if(STR_EQUAL(argv[i], "--repeats") && has_value)    repeats = atoi(argv[++i]);
+        else if(STR_EQUAL(argv[i], "--players") && has_value)    { adhoc.players = atoi(argv[++i]); use_adhoc = true; }
+        else if(STR_EQUAL(argv[i], "--projectiles") && has_value){ adhoc.projectiles = atoi(argv[++i]); use_adhoc = true; }
+        else if(STR_EQUAL(argv[i], "--spawners") && has_value)   { adhoc.spawners = atoi(argv[++i]); use_adhoc = true; }
+        else if(STR_EQUAL(argv[i], "--ticks") && has_value)      { adhoc.ticks = atoi(argv[++i]); use_adhoc = true; }
+        else if(STR_EQUAL(argv[i], "--render"))                  render = true;
+        else if(STR_EQUAL(argv[i], "--frames") && has_value)     render_frames = atoi(argv[++i]);
+        else if(STR_EQUAL(argv[i], "--png") && has_value)        png_prefix = argv[++i];
+        else if(STR_EQUAL(argv[i], "--net"))
+        {
+            net_bench_packing(BENCH_NET_ITERATIONS);
+            return 0;
+        }
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+
+    repeats = MAX(repeats, 1);
+
+    if(use_adhoc)
+    {
+        scenarios[0] = adhoc;
+        num_scenarios = 1;
+    }
+    else if(!load_scenarios(scenarios_path))
+    {
+        return 1;
+    }
+
+    if(render)
+    {
+        // the full client setup, only the window is swapped for an FBO
+        role = ROLE_LOCAL;
+        render_offscreen = true;
+        init();
+        memcpy(initial_players, players, sizeof(players));
+
+        printf("%-16s %3s %4s %4s %10s %10s %10s %8s %8s %10s\n",
+                "scenario", "N", "M", "K", "ns/frame", "p50", "p99", "draws", "changes", "KB upload");
+
+        for(int i = 0; i < num_scenarios; ++i)
+        {
+            if(only && !STR_EQUAL(scenarios[i].name, only))
+                continue;
+            run_render_scenario(&scenarios[i], render_frames, png_prefix);
+        }
+
+        deinit();
+        return 0;
+    }
+
+    if(!save_baseline)
+        load_baseline(baseline_path);
+
+    // same headless setup as a dedicated server
+    role = ROLE_SERVER;
+    init_server();
+    effects_load_all();
+    memcpy(initial_players, players, sizeof(players));
+
+    counters_open();
+
+#if !BENCH_COUNT_ALLOCS
+    LOGW("Allocation counting disabled, build with build_bench.sh to enable it");
+#endif
+
+    printf("%-16s %3s %4s %4s %10s %10s %10s %8s %10s %12s\n",
+            "scenario", "N", "M", "K", "ns/tick", "p50", "p99", "allocs", "llc-miss", "instructions");
+
+    BenchResult results[BENCH_MAX_SCENARIOS];
+    int num_results = 0;
+    int regressions = 0;
+
+    for(int i = 0; i < num_scenarios; ++i)
+    {
+        BenchScenario* s = &scenarios[i];
+        if(only && !STR_EQUAL(s->name, only))
+            continue;
+
+        // keep the fastest repeat, anything slower is interference from the rest of the system
+        BenchResult* r = &results[num_results++];
+        for(int j = 0; j < repeats; ++j)
+        {
+            BenchResult run;
+            run_scenario(s, &run);
+            if(j == 0 || run.ns_p50 < r->ns_p50)
+                memcpy(r, &run, sizeof(BenchResult));
+        }
+
+        if(report(s, r, tolerance))
+            regressions++;
+    }
+
+    if(save_baseline)
+    {
+        if(!write_baseline(baseline_path, results, num_results))
+            return 1;
+        printf("Wrote baseline to %s\n", baseline_path);
+        return 0;
+    }
+
+    if(regressions > 0)
+    {
+        printf("%d scenario(s) regressed against %s\n", regressions, baseline_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Relaxed atomics for counters, acquire/release for handing data between threads
+
+#if _WIN32
+#include <intrin.h> // the Interlocked intrinsics, without pulling in windows.h
+#define ATOMIC_ADD64(p,n)        _InterlockedExchangeAdd64((volatile __int64*)(p), (__int64)(n))
+#define ATOMIC_LOAD64(p)         (uint64_t)_InterlockedCompareExchange64((volatile __int64*)(p), 0, 0)
+#define ATOMIC_STORE64(p,v)      _InterlockedExchange64((volatile __int64*)(p), (__int64)(v))
+#define ATOMIC_CAS64(p,e,d)      (_InterlockedCompareExchange64((volatile __int64*)(p), (__int64)(d), (__int64)(e)) == (__int64)(e))
+#define ATOMIC_LOAD64_ACQ(p)     ATOMIC_LOAD64(p)
+#define ATOMIC_STORE64_REL(p,v)  ATOMIC_STORE64(p,v)
+#define ATOMIC_ADD64_REL(p,n)    ATOMIC_ADD64(p,n)
+#else
+#define ATOMIC_ADD64(p,n)        __atomic_fetch_add((p), (uint64_t)(n), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD64(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ATOMIC_STORE64(p,v)      __atomic_store_n((p), (uint64_t)(v), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD64_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE64_REL(p,v)  __atomic_store_n((p), (uint64_t)(v), __ATOMIC_RELEASE)
+#define ATOMIC_ADD64_REL(p,n)    __atomic_fetch_add((p), (uint64_t)(n), __ATOMIC_RELEASE)
+static inline int atomic_cas64(volatile uint64_t* p, uint64_t expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+#define ATOMIC_CAS64(p,e,d)      atomic_cas64((volatile uint64_t*)(p), (e), (d))
+#endif
@@ -1,4 +1,10 @@
 #include "headers.h"
+#include <stddef.h>
+#include <sys/stat.h>
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 #include <GL/glew.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -8,10 +14,51 @@
 #include "shader.h"
 #include "window.h"
 #include "log.h"
+#include "profiler.h"
+#include "jobs.h"
 #include "gfx.h"
 
-#define MAX_LINES 100
 #define SPRITE_BATCH_MAX_SPRITES 4096
+#define SHAPE_BATCH_MAX_VERTICES 32768 // per primitive type
+#define CIRCLE_SEGMENTS          16
+
+#define RENDER_QUEUE_MAX_COMMANDS 8192
+#define RENDER_MAX_RUNS           1024 // shape runs per primitive type and text runs per flush
+
+#define MAX_ATLASES    4
+#define ATLAS_MIN_SIZE 256
+#define ATLAS_MAX_SIZE 4096
+#define ATLAS_EXTRUDE  1 // edge texels repeated around each sheet so linear filtering can't pull in a neighbour
+
+#define MAX_IMAGE_PREFETCHES 32
+
+#define COOKED_IMAGE_MAGIC   "SMCI"
+#define COOKED_IMAGE_VERSION 1
+#define COOKED_IMAGE_EXT     ".cooked"
+
+#define STREAM_SEGMENTS 3 // fenced ring segments, one frame may fill several; reuse waits for the GPU to finish with it
+
+#define GL_STATE_TEXTURE_UNITS 16
+#define FRAME_UNIFORMS_BINDING 0
+
+// must match sprite_batch.vert.glsl
+#define SPRITE_FLAG_TEX_UNIT_MASK  0x0F
+#define SPRITE_FLAG_IGNORE_LIGHT   (1 << 4)
+#define SPRITE_FLAG_BLEND_ADDITIVE (1 << 5)
+#define SPRITE_FLAG_MASK_COLOR     (1 << 6)
+
+#define UNORM8(f)  ((uint8_t)(RANGE((f),0.0,1.0)*255.0f + 0.5f))
+#define UNORM16(f) ((uint16_t)(RANGE((f),0.0,1.0)*65535.0f + 0.5f))
+
+// draws are ordered by layer, then by submission order (a queue index or a render_seq)
+#define RENDER_KEY(layer, index)  (((uint64_t)(layer) << 32) | (uint32_t)(index))
+#define RENDER_KEY_INDEX(key)     ((int)((key) & 0xFFFFFFFF))
+#define RENDER_KEY_LAYER(key)     ((int)((key) >> 32))
+
+#define TEXT_BATCH_MAX_GLYPHS 4096 // a drop shadow counts as a glyph
+#define TEXT_MAX_LEN          256
+#define TEXT_CACHE_SLOTS      128  // must be a power of two
+#define TEXT_CACHE_MAX_LEN    64   // longer strings are laid out every call
 
 #define PRINT_LOAD_LOGS 1
 
@@ -33,79 +80,262 @@ typedef struct
 
 typedef struct
 {
-    Vector4f world1;
-    Vector4f world2;
-    Vector4f world3;
-    Vector4f world4;
-    Rect rect;
-    Vector3f color;
-    float opacity;
-    GLuint tex_unit;
-    GLuint ignore_light;
-    GLuint blending_mode;
-    GLuint mask_color;
+    Vector2f position;
+    Vector2f tex_coord;
+    Vector4f color;
+} FontVertex;
+
+// glyph quad relative to the string's top left
+typedef struct
+{
+    float x0,y0,x1,y1;
+    CharBox tex_coords;
+} GlyphQuad;
+
+typedef struct
+{
+    bool used;
+    float scale;
+    char str[TEXT_CACHE_MAX_LEN+1];
+    Vector2f size;
+    int num_glyphs;
+    GlyphQuad glyphs[TEXT_CACHE_MAX_LEN];
+} TextLayout;
+
+// per instance data, the model transform is built in sprite_batch.vert.glsl
+typedef struct
+{
+    Vector2f pos;
+    Vector2f size;      // scaled width and height in pixels
+    float rotation;     // radians
+    uint8_t color[4];   // rgb and opacity
+    uint16_t rect[4];   // normalized uv x,y,w,h
+    uint32_t flags;     // tex unit and SPRITE_FLAG_*
 } Sprite;
 
 typedef struct
 {
-    bool in_world;
-    bool ignore_light;
-    int image_indices[16];
-    int num_image_indices;
+    int img_index;
+    int w,h;
+    int x,y;
+    int atlas;
+} AtlasEntry;
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime;
+    int32_t requested_element_width;
+    int32_t requested_element_height;
+    int32_t w,h,n;
+    int32_t element_width, element_height;
+    int32_t elements_per_row, elements_per_col;
+    int32_t element_count;
+    uint8_t flip;
+    uint8_t pad[7];
+    // followed by visible_rects, sprite_visible_rects, sprite_rects,
+    // avg_color (element_count each) and w*h RGBA texels
+} CookedImageHeader;
+
+// debug timings of one load, summed into the totals on the main thread
+typedef struct
+{
+    double vr_time;
+    double other_time;
+} ImageLoadTimes;
+
+// an image decoded (or mapped) and analyzed but not yet uploaded
+typedef struct
+{
+    GFXImage img;
+    ImageLoadTimes times;
+    unsigned char* texels;
+    void* mapping; // cooked sidecar the texels point into
+    size_t mapping_size;
+} ImageLoad;
+
+typedef struct
+{
+    char path[256];
+    bool flip;
+    int element_width;
+    int element_height;
+    bool pending;
+    bool ok;
+    ImageLoad load;
+    JobCounter done;
+} ImagePrefetch;
+
+typedef struct
+{
+    GLuint texture;
+    int size;
+} Atlas;
+
+typedef struct
+{
+    GLuint textures[16];
+    int num_textures;
     int num_sprites;
-    Sprite sprites[SPRITE_BATCH_MAX_SPRITES];
+    Sprite* sprites; // points into sprite_stream
+    GLintptr offset;
 } SpriteBatch;
 
+typedef struct
+{
+    GLuint vbo;
+    GLsizeiptr segment_size;
+    GLintptr head;
+    int segment;
+    bool persistent;
+    uint8_t* mapped;
+    bool range_mapped; // stream_begin() mapped a range that stream_end() has to unmap
+    GLsync fences[STREAM_SEGMENTS];
+} StreamBuffer;
+
+typedef struct
+{
+    GLuint texture;
+    uint32_t seq; // render_seq when queued
+    Sprite sprite;
+} RenderCommand;
+
+// what gfx last set, so binds that wouldn't change anything are skipped
+typedef struct
+{
+    GLuint program;
+    GLuint vao;
+    int active_unit;
+    GLuint textures[GL_STATE_TEXTURE_UNITS];
+    GLenum blend_src;
+    GLenum blend_dst;
+} GLState;
+
+// must match the FrameUniforms block in the shaders (std140, row major)
+typedef struct
+{
+    Matrix view;
+    Matrix projection;
+    float ambient_color[4];
+} FrameUniforms;
+
+typedef struct
+{
+    Vector2f pos;
+    uint8_t color[4]; // rgb and opacity
+} ShapeVertex;
+
+typedef enum
+{
+    SHAPE_TRIANGLES,
+    SHAPE_LINES,
+    SHAPE_TYPE_MAX,
+} ShapeType;
+
+// primitives submitted back to back on one layer, nothing else was drawn
+// on that layer in between, so the run is drawn with a single call
+typedef struct
+{
+    uint64_t key;      // RENDER_KEY(layer, render_seq of the first primitive)
+    uint32_t last_seq; // render_seq of the newest primitive
+    int start;         // in vertices[]
+    GLint first;       // in shape_stream after upload
+    GLsizei count;
+} ShapeRun;
+
+typedef struct
+{
+    ShapeVertex vertices[SHAPE_BATCH_MAX_VERTICES];
+    int num_vertices;
+
+    ShapeRun runs[RENDER_MAX_RUNS];
+    int num_runs;
+    int next_run;
+} ShapeBatch;
+
+// glyphs submitted back to back on one layer, like ShapeRun
+typedef struct
+{
+    uint64_t key;
+    uint32_t last_seq;
+    int start;         // in text_vertices[], in glyphs
+    GLint base_vertex; // in font_stream after upload
+    int num_glyphs;
+} TextRun;
+
 
 // static vars
 // --------------------------------------------------------
-static GLuint quad_vao, quad_vbo;
-static GLuint circle_vao, circle_vbo;
-static GLuint rect_vao, rect_vbo;
-static GLuint font_vao, font_vbo;
-static GLuint line_vao,line_vbo;
-static GLuint batch_vao, batch_quad_vbo, batch_instance_vbo;
+static GLuint font_vao, font_ibo;
+static GLuint shape_vao;
+static GLuint batch_vao, batch_quad_vbo;
+
+static StreamBuffer sprite_stream;
+static StreamBuffer font_stream;
+static StreamBuffer shape_stream;
 
 static Matrix proj_matrix;
 
+static GLState gl_state;
+static GFXStats gfx_stats;
+static GLuint frame_ubo;
+static FrameUniforms frame_uniforms; // contents of frame_ubo
+
 static GLint loc_sprite_batch_image[16];
-static GLint loc_sprite_batch_ambient_color;
-static GLint loc_sprite_batch_ignore_light;
-static GLint loc_sprite_batch_mask_color;
-static GLint loc_sprite_batch_view;
-static GLint loc_sprite_batch_proj;
-
-static GLint loc_shape_color;
-static GLint loc_shape_opacity;
-static GLint loc_shape_model;
-static GLint loc_shape_view;
-static GLint loc_shape_proj;
-
-static GLint loc_line_opacity;
-static GLint loc_line_view;
-static GLint loc_line_proj;
 
 static GLint loc_font_image;
-static GLint loc_font_fg_color;
-static GLint loc_font_tex;
 static GLint loc_font_px_range;
-static GLint loc_font_opacity;
-static GLint loc_font_model;
-static GLint loc_font_view;
-static GLint loc_font_proj;
-
-static LinePoint line_points[2*MAX_LINES];
-static int num_line_points = 0;
 
 static FontChar font_chars[255];
 
+// debug load timings, only touched on the main thread
 static double vr_time = 0;
 static double img_time = 0;
 static double other_time = 0;
 
+static JobCounter font_layout_done = {0};
+static bool font_layout_pending = false;
+
+static ImagePrefetch image_prefetches[MAX_IMAGE_PREFETCHES];
+static int image_prefetch_total = 0;
+static int image_prefetch_loaded = 0;
+static gfx_load_progress_cb load_progress_cb = NULL;
+
 
 static SpriteBatch sprite_batch = {0};
 
+// sprites and filled rects are queued here and drawn as instanced batches by gfx_flush()
+static RenderCommand render_queue[RENDER_QUEUE_MAX_COMMANDS];
+static uint64_t render_keys[RENDER_QUEUE_MAX_COMMANDS];
+static int render_queue_count = 0;
+static bool render_queue_sorted = true;
+static uint8_t render_layer = 0;
+
+// submission order across sprites, shapes and text, restarts every flush
+static uint32_t render_seq = 0;
+static uint32_t layer_last_seq[256]; // newest submission on each layer
+
+static int white_image = -1;
+
+// circles, outlines and lines, drawn in submission order with the sprites and text of their layer
+static ShapeBatch shape_batches[SHAPE_TYPE_MAX];
+static Vector2f unit_circle[CIRCLE_SEGMENTS+1];
+
+static Atlas atlases[MAX_ATLASES];
+static int num_atlases = 0;
+
+// glyphs are appended here and drawn in submission order with the sprites and shapes of their layer
+static FontVertex text_vertices[4*TEXT_BATCH_MAX_GLYPHS];
+static int text_num_glyphs = 0;
+static TextRun text_runs[RENDER_MAX_RUNS];
+static int text_num_runs = 0;
+static int text_next_run = 0;
+
+static TextLayout text_cache[TEXT_CACHE_SLOTS];
+static GlyphQuad text_scratch[TEXT_MAX_LEN];
+
 // global vars
 // --------------------------------------------------------
 GFXImage gfx_images[MAX_GFX_IMAGES] = {0};
@@ -120,14 +350,44 @@ const uint32_t ambient_light = 0xFFFFFFFF;
 // static function prototypes
 // --------------------------------------------------------
 static int assign_image(GFXImageData image, bool linear_filter, int element_width, int element_height, bool raw);
+static void image_analyze(GFXImageData* image, int element_width, int element_height, bool raw, GFXImage* img, ImageLoadTimes* times);
+static int image_store(GFXImage* img, unsigned char* texels, bool linear_filter);
+static bool image_prepare(const char* image_path, bool flip, int element_width, int element_height, ImageLoad* load);
+static void image_release(ImageLoad* load);
+static ImagePrefetch* image_prefetch_find(const char* image_path, bool flip, int element_width, int element_height);
+static void image_prefetch_job(void* arg);
+static bool image_read_cooked(const char* cooked_path, CookedImageHeader* key, ImageLoad* load);
+static void image_unmap_file(void* data, size_t size);
+static void image_write_cooked(const char* cooked_path, CookedImageHeader* h, GFXImage* img, unsigned char* texels);
+static bool image_source_stat(const char* path, uint64_t* size, int64_t* mtime);
 static void init_sprite_batch();
+static bool sprite_batch_begin();
+static void sprite_batch_draw();
+static bool shape_batch_upload();
+static void shape_run_draw(ShapeType type, ShapeRun* run);
+static void stream_init(StreamBuffer* sb, GLsizeiptr segment_size);
+static void* stream_begin(StreamBuffer* sb, GLsizeiptr max_bytes, GLsizeiptr stride, GLintptr* offset);
+static void stream_end(StreamBuffer* sb, GLsizeiptr used_bytes);
+static bool text_upload();
+static void text_run_draw(TextRun* run);
+static uint64_t overlays_next_key();
+static void overlays_draw_before(uint64_t end_key);
+static void render_queue_reset();
 static void print_sprite(Sprite* sprite);
 static int image_find_first_visible_rowcol(int side, int img_w, int img_h, int img_n, unsigned char* data);
-static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned char* img_data, Rect* ret);
+static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned char* img_data, Rect* ret, double* time);
 static void load_font();
+static void font_layout_job(void* arg);
 static void blend_mode_normal();
 static void blend_mode_both();
 static void blend_mode_additive();
+static void gl_use_program(GLuint program);
+static void gl_bind_vao(GLuint vao);
+static void gl_bind_texture(int unit, GLuint texture);
+static void gl_delete_texture(GLuint* texture);
+static void gl_blend_func(GLenum src, GLenum dst);
+static void frame_uniforms_bind(GLuint program);
+static void frame_uniforms_update();
 
 // global functions
 // --------------------------------------------------------
@@ -136,134 +396,86 @@ void gfx_init(int width, int height)
 {
     LOGI("GL version: %s",glGetString(GL_VERSION));
 
-    glGenVertexArrays(1, &quad_vao);
-    glBindVertexArray(quad_vao);
+    memset(&gl_state, 0, sizeof(GLState));
 
-    // quad
-    Vertex quad[] =
+    // unit circle, the last point closes the outline
+    for(int i = 0; i <= CIRCLE_SEGMENTS; ++i)
     {
-        {{-0.5, -0.5},{0.0,0.0}},
-        {{-0.5, +0.5},{0.0,1.0}},
-        {{+0.5, -0.5},{1.0,0.0}},
-        {{+0.5, +0.5},{1.0,1.0}},
-    };
-
-    glGenBuffers(1, &quad_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(Vertex), (void*)0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(Vertex), (const GLvoid*)8);
-
-    Vector2f rect[] =
-    {
-        {-0.5, -0.5},
-        {-0.5, +0.5},
-        {+0.5, +0.5},
-        {+0.5, -0.5},
-        {-0.5, -0.5},
-    };
-
-    // rect (used for drawing empty rectangles
-    glGenVertexArrays(1, &rect_vao);
-    glBindVertexArray(rect_vao);
-
-    glGenBuffers(1, &rect_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(rect), rect, GL_STATIC_DRAW);
+        double a = 2.0*PI*(i % CIRCLE_SEGMENTS)/CIRCLE_SEGMENTS;
+        unit_circle[i].x = 0.5*cos(a);
+        unit_circle[i].y = 0.5*sin(a);
+    }
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(Vector2f), (void*)0);
-    
-    glGenVertexArrays(1, &circle_vao);
-    glBindVertexArray(circle_vao);
+    // font glyph stream
+    glGenVertexArrays(1, &font_vao);
+    gl_bind_vao(font_vao);
 
-    // #define NUMBER_OF_VERTICES 16
-    // float radius = 0.5;
-    // for(double i = 0; i < 2 * M_PI; i += 2 * M_PI / NUMBER_OF_VERTICES)
-    // {
-    //     printf("%f, %f\n", cos(i)*radius, sin(i)*radius);
-    // }
+    stream_init(&font_stream, sizeof(text_vertices));
+    glBindBuffer(GL_ARRAY_BUFFER, font_stream.vbo);
 
-    Vector2f circle[] =
-    {
-        {0.500000, 0.000000},
-        {0.461940, 0.191342},
-        {0.353553, 0.353553},
-        {0.191342, 0.461940},
-        {0.000000, 0.500000},
-        {-0.191342, 0.461940},
-        {-0.353553, 0.353553},
-        {-0.461940, 0.191342},
-        {-0.500000, 0.000000},
-        {-0.461940, -0.191342},
-        {-0.353553, -0.353553},
-        {-0.191342, -0.461940},
-        {-0.000000, -0.500000},
-        {0.191342, -0.461940},
-        {0.353553, -0.353553},
-        {0.461940, -0.191342},
-        {0.500000, 0.000000},
-    };
+    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(FontVertex), (void*)0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(FontVertex), (const GLvoid*)8);
+    glVertexAttribPointer(2, 4, GL_FLOAT, false, sizeof(FontVertex), (const GLvoid*)16);
+    for(int i = 0; i <= 2; ++i)
+        glEnableVertexAttribArray(i);
 
-    glGenBuffers(1, &circle_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, circle_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(circle), circle, GL_STATIC_DRAW);
+    // two triangles per glyph, same winding as the old triangle strip
+    uint16_t* font_indices = malloc(6*TEXT_BATCH_MAX_GLYPHS*sizeof(uint16_t));
+    for(int i = 0; i < TEXT_BATCH_MAX_GLYPHS; ++i)
+    {
+        uint16_t v = (uint16_t)(4*i);
+        uint16_t* idx = &font_indices[6*i];
+        idx[0] = v+0; idx[1] = v+1; idx[2] = v+2;
+        idx[3] = v+2; idx[4] = v+1; idx[5] = v+3;
+    }
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(Vector2f), (void*)0);
+    glGenBuffers(1, &font_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, font_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6*TEXT_BATCH_MAX_GLYPHS*sizeof(uint16_t), font_indices, GL_STATIC_DRAW);
+    free(font_indices);
 
-    // font char
-    glGenVertexArrays(1, &font_vao);
-    glBindVertexArray(font_vao);
+    // shapes, every primitive type is uploaded into one stream per flush
+    glGenVertexArrays(1, &shape_vao);
+    gl_bind_vao(shape_vao);
 
-    glGenBuffers(1, &font_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, font_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    stream_init(&shape_stream, SHAPE_TYPE_MAX*SHAPE_BATCH_MAX_VERTICES*sizeof(ShapeVertex));
+    glBindBuffer(GL_ARRAY_BUFFER, shape_stream.vbo);
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(Vertex), (void*)0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(Vertex), (const GLvoid*)8);
+    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(ShapeVertex), (void*)offsetof(ShapeVertex,pos));
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, true, sizeof(ShapeVertex), (const GLvoid*)offsetof(ShapeVertex,color));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
 
-    // line
-    glGenVertexArrays(1, &line_vao);
-    glBindVertexArray(line_vao);
+    for(int i = 0; i < SHAPE_TYPE_MAX; ++i)
+        shape_batches[i].num_vertices = 0;
 
-    glGenBuffers(1, &line_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, line_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(line_points), 0, GL_STATIC_DRAW);
+    // per frame uniforms, shared by every program
+    glGenBuffers(1, &frame_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frame_ubo);
+    memset(&frame_uniforms, 0, sizeof(FrameUniforms));
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(LinePoint), (void*)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(LinePoint), (const GLvoid*)8);
+    frame_uniforms_bind(program_sprite_batch);
+    frame_uniforms_bind(program_shape);
+    frame_uniforms_bind(program_font);
 
-    // shader locations
+    // samplers never change units, so they are set once
+    gl_use_program(program_sprite_batch);
     char lookup_str[16+1] = {0};
     for(int i = 0; i < 16; ++i)
     {
         snprintf(lookup_str,16,"images[%d]",i);
         loc_sprite_batch_image[i]         = glGetUniformLocation(program_sprite_batch, lookup_str);
+        glUniform1i(loc_sprite_batch_image[i], i);
     }
 
-    loc_sprite_batch_ambient_color = glGetUniformLocation(program_sprite_batch, "ambient_color");
-    loc_sprite_batch_ignore_light   = glGetUniformLocation(program_sprite_batch, "ignore_light");
-    loc_sprite_batch_mask_color   = glGetUniformLocation(program_sprite_batch, "mask_color");
-    loc_sprite_batch_view    = glGetUniformLocation(program_sprite_batch, "view");
-    loc_sprite_batch_proj    = glGetUniformLocation(program_sprite_batch, "projection");
-
-    loc_shape_color      = glGetUniformLocation(program_shape, "color");
-    loc_shape_opacity    = glGetUniformLocation(program_shape, "opacity");
-    loc_shape_model      = glGetUniformLocation(program_shape, "model");
-    loc_shape_view       = glGetUniformLocation(program_shape, "view");
-    loc_shape_proj       = glGetUniformLocation(program_shape, "projection");
-
-    loc_line_view        = glGetUniformLocation(program_line, "view");
-    loc_line_proj        = glGetUniformLocation(program_line, "projection");
-    loc_line_opacity     = glGetUniformLocation(program_line, "opacity");
-
+    gl_use_program(program_font);
     loc_font_image    = glGetUniformLocation(program_font, "image");
-    loc_font_fg_color = glGetUniformLocation(program_font, "fg_color");
     loc_font_px_range = glGetUniformLocation(program_font, "px_range");
-    loc_font_tex      = glGetUniformLocation(program_font, "tex");
-    loc_font_model    = glGetUniformLocation(program_font, "model");
-    loc_font_view     = glGetUniformLocation(program_font, "view");
-    loc_font_proj     = glGetUniformLocation(program_font, "projection");
+    glUniform1i(loc_font_image, 0);
+    glUniform1f(loc_font_px_range,4.0);
 
     ortho(&proj_matrix,0.0,(float)width,(float)height,0.0, 0.0, 1000.0);
 
@@ -271,7 +483,7 @@ void gfx_init(int width, int height)
     // print_matrix(&proj_matrix);
 
     glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    blend_mode_normal();
 
     glEnable(GL_LINE_SMOOTH);
     glLineWidth(5.0);
@@ -280,10 +492,18 @@ void gfx_init(int width, int height)
 
     load_font();
     init_sprite_batch();
+
+    LOGI("Stream buffers: %s", sprite_stream.persistent ? "persistent mapped" : "orphaned");
+
+    // filled rects are drawn as tinted sprites of this so they batch with everything else
+    static unsigned char white_pixel[4] = {0xFF,0xFF,0xFF,0xFF};
+    white_image = gfx_raw_image_create(white_pixel, 1, 1, false);
 }
 
 void gfx_clear_buffer(uint8_t r, uint8_t g, uint8_t b)
 {
+    gfx_flush();
+
     glClearColor(r/255.0, g/255.0,b/255.0,0.0);
     glClear(GL_COLOR_BUFFER_BIT);
 }
@@ -303,7 +523,8 @@ bool gfx_load_image_data(const char* image_path, GFXImageData* image, bool flip)
 {
     // LOGI("Loading image: %s",image_path);
 
-    stbi_set_flip_vertically_on_load(flip);
+    // per thread so prefetch jobs don't race on it
+    stbi_set_flip_vertically_on_load_thread(flip);
     image->data = stbi_load(image_path,&image->w,&image->h,&image->n,4);
 
     if(image->data != NULL)
@@ -323,22 +544,104 @@ bool gfx_load_image_data(const char* image_path, GFXImageData* image, bool flip)
 
 int gfx_load_image(const char* image_path, bool flip, bool linear_filter, int element_width, int element_height)
 {
-    GFXImageData image = {0};
-
     Timer _timer = {0};
     timer_begin(&_timer);   //img_time
-    bool load = gfx_load_image_data(image_path, &image, flip);
+
+    ImageLoad load = {0};
+    bool ok;
+
+    ImagePrefetch* pf = image_prefetch_find(image_path, flip, element_width, element_height);
+    if(pf)
+    {
+        jobs_wait(&pf->done);
+        ok = pf->ok;
+        load = pf->load;
+        pf->pending = false;
+    }
+    else
+    {
+        ok = image_prepare(image_path, flip, element_width, element_height, &load);
+    }
+
     img_time += timer_get_elapsed(&_timer);
+    vr_time += load.times.vr_time;
+    other_time += load.times.other_time;
+
+    if(!ok) return -1;
+
+    load.img.linear_filter = linear_filter;
+    int index = image_store(&load.img, load.texels, linear_filter);
+    image_release(&load);
+
+    if(pf)
+    {
+        image_prefetch_loaded++;
+        if(load_progress_cb)
+            load_progress_cb(image_prefetch_loaded, image_prefetch_total, image_path);
+    }
+
+    return index;
+}
 
-    if(!load) return -1;
+void gfx_image_prefetch(const char* image_path, bool flip, int element_width, int element_height)
+{
+    for(int i = 0; i < MAX_IMAGE_PREFETCHES; ++i)
+    {
+        ImagePrefetch* pf = &image_prefetches[i];
+        if(pf->pending) continue;
+
+        memset(pf, 0, sizeof(ImagePrefetch));
+        strncpy(pf->path, image_path, sizeof(pf->path)-1);
+        pf->flip = flip;
+        pf->element_width = element_width;
+        pf->element_height = element_height;
+        pf->pending = true;
+        image_prefetch_total++;
+
+        jobs_add(image_prefetch_job, pf, &pf->done);
+        return;
+    }
+
+    // gfx_load_image() will just decode it on the spot
+    LOGW("No free prefetch slots for %s", image_path);
+}
+
+void gfx_font_prefetch()
+{
+    if(font_layout_pending)
+        return;
+    font_layout_pending = true;
+    jobs_add(font_layout_job, NULL, &font_layout_done);
+}
 
-    return assign_image(image, linear_filter, element_width, element_height, false);
+void gfx_set_load_progress_cb(gfx_load_progress_cb cb)
+{
+    load_progress_cb = cb;
 }
 
 void gfx_raw_image_update(int img_index, unsigned char* data, int width, int height)
 {
     GFXImage* img = &gfx_images[img_index];
 
+    if(img->atlas >= 0)
+    {
+        // the atlas slot was sized for the old pixels, give it its own texture back
+        GLuint texture;
+        glGenTextures(1, &texture);
+        gl_bind_texture(0, texture);
+        GLint filter = img->linear_filter ? GL_LINEAR : GL_NEAREST;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        img->texture = texture;
+        img->atlas = -1;
+
+        Rect full = {0.5, 0.5, 1.0, 1.0};
+        img->sprite_rects[0] = full;
+        img->sprite_visible_rects[0] = full;
+    }
+
     img->w = width;
     img->h = height;
     img->elements_per_row = 1;
@@ -350,10 +653,9 @@ void gfx_raw_image_update(int img_index, unsigned char* data, int width, int hei
     img->visible_rects[0].w = width;
     img->visible_rects[0].h = height;
 
-    int texture = img->texture;
-    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_bind_texture(0, img->texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gfx_stats.upload_bytes += (uint64_t)width*height*4;
 }
 
 int gfx_raw_image_create(unsigned char* data, int width, int height, bool linear_filter)
@@ -526,30 +828,62 @@ int gfx_raw_image_create(unsigned char* data, int width, int height, bool linear
 
 
 
-bool gfx_sprite_batch_begin(bool in_world)
+void gfx_set_render_layer(uint8_t layer)
 {
-    sprite_batch.in_world = in_world;
-    sprite_batch.num_sprites = 0;
-    sprite_batch.num_image_indices = 0;
+    render_layer = layer;
+}
+
+static bool render_queue_add(int img_index, Rect* sr, float x, float y, float w, float h, float rotation, uint32_t color, float opacity, bool mask_color, bool ignore_light, bool blend_additive)
+{
+    if(render_queue_count >= RENDER_QUEUE_MAX_COMMANDS)
+        gfx_flush();
+
+    int index = render_queue_count++;
+    RenderCommand* cmd = &render_queue[index];
+    cmd->texture = gfx_images[img_index].texture;
+    cmd->seq = render_seq++;
+    layer_last_seq[render_layer] = cmd->seq;
+
+    Sprite* sprite = &cmd->sprite;
+
+    sprite->pos.x = x;
+    sprite->pos.y = y;
+    sprite->size.x = w;
+    sprite->size.y = h;
+    sprite->rotation = RAD(rotation);
+
+    sprite->color[0] = (color >> 16) & 0xFF;
+    sprite->color[1] = (color >>  8) & 0xFF;
+    sprite->color[2] = (color >>  0) & 0xFF;
+    sprite->color[3] = UNORM8(opacity);
+
+    sprite->rect[0] = UNORM16(sr->x-sr->w/2.0);
+    sprite->rect[1] = UNORM16(sr->y-sr->h/2.0);
+    sprite->rect[2] = UNORM16(sr->w);
+    sprite->rect[3] = UNORM16(sr->h);
+
+    // tex unit is assigned when the batch is built
+    sprite->flags = 0;
+    if(ignore_light)   sprite->flags |= SPRITE_FLAG_IGNORE_LIGHT;
+    if(blend_additive) sprite->flags |= SPRITE_FLAG_BLEND_ADDITIVE;
+    if(mask_color)     sprite->flags |= SPRITE_FLAG_MASK_COLOR;
+
+    uint64_t key = RENDER_KEY(render_layer, index);
+    if(index > 0 && key < render_keys[index-1])
+        render_queue_sorted = false;
+    render_keys[index] = key;
 
     return true;
 }
 
-bool gfx_sprite_batch_add(int img_index, int sprite_index, float x, float y, uint32_t color, bool mask_color, float scale, float rotation, float opacity, bool full_image, bool ignore_light, bool blend_additive) 
+bool gfx_sprite_batch_add(int img_index, int sprite_index, float x, float y, uint32_t color, bool mask_color, float scale, float rotation, float opacity, bool full_image, bool ignore_light, bool blend_additive)
 {
-
     if(img_index < 0 || img_index >= MAX_GFX_IMAGES)
     {
         LOGE("%s: Invalid image index!", __func__);
         return false;
     }
 
-    if(sprite_batch.num_sprites >= SPRITE_BATCH_MAX_SPRITES)
-    {
-        LOGW("Too many sprites in batch. Can't add any more.");
-        return false;
-    }
-
     GFXImage* img = &gfx_images[img_index];
 
     if(sprite_index >= img->element_count)
@@ -558,339 +892,830 @@ bool gfx_sprite_batch_add(int img_index, int sprite_index, float x, float y, uin
         return false;
     }
 
-    Sprite* sprite = &sprite_batch.sprites[sprite_batch.num_sprites++];
-
-    float r,g,b;
-    gfx_color2floats(color,&r, &g, &b);
-    sprite->color.x = r;
-    sprite->color.y = g;
-    sprite->color.z = b;
-    sprite->opacity = opacity;
-
-    // get model matrix
-    Vector3f pos = {x,y,0.0};
-    Vector3f rot = {0.0,0.0,360.0-rotation};
-    Vector3f sca = {1.0,1.0,1.0};
+    float w,h;
+    Rect* sr = NULL;
 
     if(full_image)
     {
-        // Vector3f sca = {scale*img->element_width,scale*img->element_height,1.0};
-        sca.x = scale*img->element_width;
-        sca.y = scale*img->element_height;
+        w = scale*img->element_width;
+        h = scale*img->element_height;
+        sr = &img->sprite_rects[sprite_index];
     }
     else
     {
-        // Vector3f sca = {scale*vw,scale*vh,1.0};
-        float vw = img->visible_rects[sprite_index].w;
-        float vh = img->visible_rects[sprite_index].h;
-        sca.x = scale*vw;
-        sca.y = scale*vh;
+        w = scale*img->visible_rects[sprite_index].w;
+        h = scale*img->visible_rects[sprite_index].h;
+        sr = &img->sprite_visible_rects[sprite_index];
     }
 
-    Matrix m;
-    get_model_transform(&pos,&rot,&sca,&m);
+    return render_queue_add(img_index, sr, x, y, w, h, 360.0-rotation, color, opacity, mask_color, ignore_light, blend_additive);
+}
 
-    sprite->world1.x = m.m[0][0]; sprite->world1.y = m.m[1][0]; sprite->world1.z = m.m[2][0]; sprite->world1.w = m.m[3][0];
-    sprite->world2.x = m.m[0][1]; sprite->world2.y = m.m[1][1]; sprite->world2.z = m.m[2][1]; sprite->world2.w = m.m[3][1];
-    sprite->world3.x = m.m[0][2]; sprite->world3.y = m.m[1][2]; sprite->world3.z = m.m[2][2]; sprite->world3.w = m.m[3][2];
-    sprite->world4.x = m.m[0][3]; sprite->world4.y = m.m[1][3]; sprite->world4.z = m.m[2][3]; sprite->world4.w = m.m[3][3];
+static int compare_render_keys(const void* a, const void* b)
+{
+    uint64_t ka = *(const uint64_t*)a;
+    uint64_t kb = *(const uint64_t*)b;
+    return (ka > kb) - (ka < kb);
+}
 
-    // sprite rect
-    Rect* sr = NULL;
-    if(full_image)
-        sr = &img->sprite_rects[sprite_index];
-    else
-        sr = &img->sprite_visible_rects[sprite_index];
+static void render_queue_flush()
+{
+    bool have_shapes = shape_batch_upload();
+    bool have_text = text_upload();
+
+    if(render_queue_count == 0 && !have_shapes && !have_text)
+    {
+        render_queue_reset();
+        return;
+    }
 
-    sprite->rect.x = sr->x-sr->w/2.0;
-    sprite->rect.y = sr->y-sr->h/2.0;
-    sprite->rect.w = sr->w;
-    sprite->rect.h = sr->h;
+    PROFILE_BEGIN("render_queue_flush");
 
-    // if(img_index == 1)
-    // {
-    //     print_sprite(sprite);
-    //     // print_rect(&sprite->rect);
-    //     // print_rect(&img->sprite_visible_rects[sprite_index]);
-    // }
+    if(!render_queue_sorted)
+        qsort(render_keys, render_queue_count, sizeof(uint64_t), compare_render_keys);
+
+    if(!sprite_batch_begin())
+    {
+        overlays_draw_before(UINT64_MAX);
+        render_queue_reset();
+        PROFILE_END();
+        return;
+    }
+
+    // a failed map drops the remaining sprites, there is no batch left to draw
+    bool batch_failed = false;
 
-    // check sprite batch indices
-    bool is_index_in_batch = false;
-    for(int i = 0; i < sprite_batch.num_image_indices; ++i)
+    for(int i = 0; i < render_queue_count; ++i)
     {
-        if(sprite_batch.image_indices[i] == img_index)
+        RenderCommand* cmd = &render_queue[RENDER_KEY_INDEX(render_keys[i])];
+
+        // shapes and text submitted before this sprite go under it
+        uint64_t key = RENDER_KEY(RENDER_KEY_LAYER(render_keys[i]), cmd->seq);
+        if(overlays_next_key() < key)
         {
+            sprite_batch_draw();
+            overlays_draw_before(key);
+            if(!sprite_batch_begin())
+            {
+                batch_failed = true;
+                break;
+            }
+        }
 
-            sprite->tex_unit = (GLuint)i;
-            is_index_in_batch = true;
+        int tex_unit = -1;
+        for(int j = 0; j < sprite_batch.num_textures; ++j)
+        {
+            if(sprite_batch.textures[j] == cmd->texture)
+            {
+                tex_unit = j;
+                break;
+            }
         }
 
-    }
+        // out of instances or texture units, draw what we have and start over
+        if(sprite_batch.num_sprites >= SPRITE_BATCH_MAX_SPRITES || (tex_unit < 0 && sprite_batch.num_textures >= 16))
+        {
+            sprite_batch_draw();
+            if(!sprite_batch_begin())
+            {
+                batch_failed = true;
+                break;
+            }
+            tex_unit = -1;
+        }
 
-    if(sprite_batch.num_image_indices < 16)
-    {
-        if(!is_index_in_batch)
+        if(tex_unit < 0)
         {
-            sprite_batch.image_indices[sprite_batch.num_image_indices] = img_index;
-            sprite->tex_unit = (GLuint)sprite_batch.num_image_indices;
-            sprite_batch.num_image_indices++;
+            tex_unit = sprite_batch.num_textures++;
+            sprite_batch.textures[tex_unit] = cmd->texture;
         }
+
+        Sprite* sprite = &sprite_batch.sprites[sprite_batch.num_sprites++];
+        memcpy(sprite, &cmd->sprite, sizeof(Sprite));
+        sprite->flags |= (uint32_t)tex_unit;
     }
-    else
+
+    if(!batch_failed)
+        sprite_batch_draw();
+    overlays_draw_before(UINT64_MAX);
+
+    render_queue_reset();
+
+    PROFILE_END();
+}
+
+// the next queued draw starts a new frame's worth of submissions
+static void render_queue_reset()
+{
+    render_queue_count = 0;
+    render_queue_sorted = true;
+    render_seq = 0;
+
+    for(int t = 0; t < SHAPE_TYPE_MAX; ++t)
     {
-        LOGW("Sprite Batch Image Indices are full!");
+        shape_batches[t].num_runs = 0;
+        shape_batches[t].next_run = 0;
     }
+    text_num_runs = 0;
+    text_next_run = 0;
+}
 
-    sprite->ignore_light = ignore_light ? 1 : 0;
-    sprite->blending_mode = blend_additive ? 1 : 0;
-    sprite->mask_color = mask_color ? 1 : 0;
+// key of the earliest shape or text run not drawn yet
+static uint64_t overlays_next_key()
+{
+    uint64_t key = UINT64_MAX;
+    for(int t = 0; t < SHAPE_TYPE_MAX; ++t)
+    {
+        ShapeBatch* batch = &shape_batches[t];
+        if(batch->next_run < batch->num_runs)
+            key = MIN(key, batch->runs[batch->next_run].key);
+    }
+    if(text_next_run < text_num_runs)
+        key = MIN(key, text_runs[text_next_run].key);
+    return key;
+}
 
-    return true;
+// shape and text runs ordered before end_key, earliest first
+static void overlays_draw_before(uint64_t end_key)
+{
+    for(;;)
+    {
+        uint64_t key = end_key;
+        int type = -1;
+        for(int t = 0; t < SHAPE_TYPE_MAX; ++t)
+        {
+            ShapeBatch* batch = &shape_batches[t];
+            if(batch->next_run < batch->num_runs && batch->runs[batch->next_run].key < key)
+            {
+                key = batch->runs[batch->next_run].key;
+                type = t;
+            }
+        }
+
+        if(text_next_run < text_num_runs && text_runs[text_next_run].key < key)
+        {
+            text_run_draw(&text_runs[text_next_run++]);
+            continue;
+        }
+
+        if(type < 0)
+            break;
+
+        ShapeBatch* batch = &shape_batches[type];
+        shape_run_draw(type, &batch->runs[batch->next_run++]);
+    }
+}
+
+void gfx_flush()
+{
+    frame_uniforms_update();
+    render_queue_flush();
 }
 
-void gfx_sprite_batch_draw()
+static bool sprite_batch_begin()
 {
+    sprite_batch.num_sprites = 0;
+    sprite_batch.num_textures = 0;
+    sprite_batch.sprites = stream_begin(&sprite_stream, SPRITE_BATCH_MAX_SPRITES*sizeof(Sprite), sizeof(Sprite), &sprite_batch.offset);
+    return sprite_batch.sprites != NULL;
+}
+
+static void sprite_batch_set_instance_attribs(GLintptr base)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, sprite_stream.vbo);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,pos)));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,size)));
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,rotation)));
+    glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,color)));
+    glVertexAttribPointer(6, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,rect)));
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(Sprite),(const GLvoid*)(base+offsetof(Sprite,flags)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void sprite_batch_draw()
+{
+    stream_end(&sprite_stream, sprite_batch.num_sprites*sizeof(Sprite));
+
     if(sprite_batch.num_sprites == 0)
         return;
 
-    glUseProgram(program_sprite_batch);
+    gl_use_program(program_sprite_batch);
 
-    Vector3f color;
-    gfx_color2floats(ambient_light,&color.x,&color.y,&color.z);
+    for(int i = 0; i < sprite_batch.num_textures; ++i)
+        gl_bind_texture(i, sprite_batch.textures[i]);
 
-    glUniform3f(loc_sprite_batch_ambient_color,color.x,color.y,color.z);
+    blend_mode_both();
 
-    glUniformMatrix4fv(loc_sprite_batch_view,1,GL_TRUE,&IDENTITY_MATRIX.m[0][0]);
+    gl_bind_vao(batch_vao);
 
-    glUniformMatrix4fv(loc_sprite_batch_proj,1,GL_TRUE,&proj_matrix.m[0][0]);
+    sprite_batch_set_instance_attribs(sprite_batch.offset);
 
-    int texture_units[] = {
-        GL_TEXTURE0,GL_TEXTURE1,GL_TEXTURE2, GL_TEXTURE3,GL_TEXTURE4,GL_TEXTURE5, GL_TEXTURE6,GL_TEXTURE7,GL_TEXTURE8,
-        GL_TEXTURE9,GL_TEXTURE10,GL_TEXTURE11, GL_TEXTURE12,GL_TEXTURE13,GL_TEXTURE14, GL_TEXTURE15
-    };
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP,0,4,sprite_batch.num_sprites);
+    gfx_stats.draw_calls++;
+
+    sprite_batch.num_sprites = 0;
+    sprite_batch.num_textures = 0;
+}
+
+// Shape batches
+// --------------------------------------------------------
+// Circles, outlines and lines collect per primitive type. Primitives added
+// back to back on a layer share a run, anything else submitted on that
+// layer in between starts a new one. A flush uploads each type's runs into
+// shape_stream ordered by layer, then draws every run between the sprites
+// and text submitted around it, one draw call per run.
 
-    for(int i = 0; i < sprite_batch.num_image_indices; ++i)
+static int compare_shape_runs(const void* a, const void* b)
+{
+    uint64_t ka = ((const ShapeRun*)a)->key;
+    uint64_t kb = ((const ShapeRun*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static bool shape_batch_upload()
+{
+    int total = 0;
+    for(int t = 0; t < SHAPE_TYPE_MAX; ++t)
     {
-        glActiveTexture(texture_units[i]);
-        glBindTexture(GL_TEXTURE_2D, gfx_images[sprite_batch.image_indices[i]].texture);
-        glUniform1i(loc_sprite_batch_image[i], i);
+        shape_batches[t].next_run = 0;
+        total += shape_batches[t].num_vertices;
     }
 
-    blend_mode_both();
+    if(total == 0)
+        return false;
 
-    glBindVertexArray(batch_vao);
+    GLintptr offset = 0;
+    ShapeVertex* dst = stream_begin(&shape_stream, total*sizeof(ShapeVertex), sizeof(ShapeVertex), &offset);
 
-    glBindBuffer(GL_ARRAY_BUFFER, batch_instance_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sprite_batch.num_sprites*sizeof(Sprite), &sprite_batch.sprites, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLint first = offset/sizeof(ShapeVertex);
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
-    glEnableVertexAttribArray(6);
-    glEnableVertexAttribArray(7);
-    glEnableVertexAttribArray(8);
-    glEnableVertexAttribArray(9);
-    glEnableVertexAttribArray(10);
-    glEnableVertexAttribArray(11);
-    glEnableVertexAttribArray(12);
+    for(int t = 0; t < SHAPE_TYPE_MAX; ++t)
+    {
+        ShapeBatch* batch = &shape_batches[t];
+        batch->num_vertices = 0;
 
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP,0,4,sprite_batch.num_sprites);
+        if(!dst)
+        {
+            batch->num_runs = 0;
+            continue;
+        }
+
+        // runs open in submission order, only a lower layer drawn later puts them out of order
+        for(int r = 1; r < batch->num_runs; ++r)
+        {
+            if(batch->runs[r].key < batch->runs[r-1].key)
+            {
+                qsort(batch->runs, batch->num_runs, sizeof(ShapeRun), compare_shape_runs);
+                break;
+            }
+        }
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
-    glDisableVertexAttribArray(5);
-    glDisableVertexAttribArray(6);
-    glDisableVertexAttribArray(7);
-    glDisableVertexAttribArray(8);
-    glDisableVertexAttribArray(9);
-    glDisableVertexAttribArray(10);
-    glDisableVertexAttribArray(11);
-    glDisableVertexAttribArray(12);
+        for(int r = 0; r < batch->num_runs; ++r)
+        {
+            ShapeRun* run = &batch->runs[r];
+            memcpy(dst, &batch->vertices[run->start], run->count*sizeof(ShapeVertex));
+            run->first = first;
+            dst += run->count;
+            first += run->count;
+        }
+    }
+
+    stream_end(&shape_stream, dst ? total*sizeof(ShapeVertex) : 0);
+    return dst != NULL;
+}
 
+static void shape_run_draw(ShapeType type, ShapeRun* run)
+{
+    gl_use_program(program_shape);
+    gl_bind_vao(shape_vao);
     blend_mode_normal();
 
-    glBindVertexArray(0);
-    glUseProgram(0);
+    glDrawArrays(type == SHAPE_TRIANGLES ? GL_TRIANGLES : GL_LINES, run->first, run->count);
+    gfx_stats.draw_calls++;
+}
+
+// Streaming buffers
+// --------------------------------------------------------
+// The buffer is split into STREAM_SEGMENTS segments that are written in turn.
+// With ARB_buffer_storage it is persistently mapped and a fence is placed
+// when the write head leaves a segment, so the CPU only waits if it laps
+// the GPU. Without it, ranges are mapped unsynchronized and the storage is
+// orphaned each time the head wraps back to the first segment.
+
+static void stream_init(StreamBuffer* sb, GLsizeiptr segment_size)
+{
+    memset(sb, 0, sizeof(StreamBuffer));
+    sb->segment_size = segment_size;
+    sb->persistent = GLEW_ARB_buffer_storage ? true : false;
+
+    GLsizeiptr size = STREAM_SEGMENTS*segment_size;
+
+    glGenBuffers(1, &sb->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+
+    if(sb->persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        sb->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        if(!sb->mapped)
+        {
+            LOGW("Failed to persistently map stream buffer, falling back to orphaning");
+            glDeleteBuffers(1, &sb->vbo);
+            glGenBuffers(1, &sb->vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+            sb->persistent = false;
+        }
+    }
+
+    if(!sb->persistent)
+    {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+}
+
+static void stream_wait(GLsync fence)
+{
+    PROFILE_BEGIN("stream_wait");
+    for(;;)
+    {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        if(result != GL_TIMEOUT_EXPIRED)
+            break;
+    }
+    glDeleteSync(fence);
+    PROFILE_END();
+}
+
+// returns a write pointer for up to max_bytes, offset is a multiple of stride
+static void* stream_begin(StreamBuffer* sb, GLsizeiptr max_bytes, GLsizeiptr stride, GLintptr* offset)
+{
+    GLintptr pos = ((sb->head + stride - 1) / stride) * stride;
+    GLintptr segment_end = (sb->segment+1)*sb->segment_size;
+
+    if(pos + max_bytes > segment_end)
+    {
+        if(sb->persistent)
+            sb->fences[sb->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        sb->segment = (sb->segment+1) % STREAM_SEGMENTS;
+        pos = ((sb->segment*sb->segment_size + stride - 1) / stride) * stride;
+
+        if(sb->fences[sb->segment])
+        {
+            stream_wait(sb->fences[sb->segment]);
+            sb->fences[sb->segment] = 0;
+        }
+
+        if(!sb->persistent && sb->segment == 0)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+            glBufferData(GL_ARRAY_BUFFER, STREAM_SEGMENTS*sb->segment_size, NULL, GL_STREAM_DRAW);
+        }
+    }
+
+    sb->head = pos;
+    *offset = pos;
+
+    if(sb->persistent)
+        return sb->mapped + pos;
 
+    glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+    void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, pos, max_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    sb->range_mapped = (ptr != NULL);
+    return ptr;
+}
+
+static void stream_end(StreamBuffer* sb, GLsizeiptr used_bytes)
+{
+    sb->head += used_bytes;
+    gfx_stats.upload_bytes += used_bytes;
+
+    if(sb->range_mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        sb->range_mapped = false;
+    }
 }
 
 static void blend_mode_normal()
 {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 static void blend_mode_both()
 {
     // uses a technique in shader to achieve either normal or additive blending
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    gl_blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 static void blend_mode_additive()
 {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    gl_blend_func(GL_SRC_ALPHA, GL_ONE);
+}
+
+// GL state cache
+// --------------------------------------------------------
+// All binds in gfx go through these. Nothing is unbound after drawing, the
+// next draw just changes what differs. Vertex attrib enables live in the
+// VAOs and are set once when each VAO is built.
+
+static void gl_use_program(GLuint program)
+{
+    if(gl_state.program == program)
+        return;
+    glUseProgram(program);
+    gl_state.program = program;
+    gfx_stats.state_changes++;
+}
+
+static void gl_bind_vao(GLuint vao)
+{
+    if(gl_state.vao == vao)
+        return;
+    glBindVertexArray(vao);
+    gl_state.vao = vao;
+    gfx_stats.state_changes++;
+}
+
+// also leaves unit active, so texture uploads can follow
+static void gl_bind_texture(int unit, GLuint texture)
+{
+    if(gl_state.active_unit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        gl_state.active_unit = unit;
+        gfx_stats.state_changes++;
+    }
+
+    if(gl_state.textures[unit] == texture)
+        return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_state.textures[unit] = texture;
+    gfx_stats.state_changes++;
+}
+
+static void gl_delete_texture(GLuint* texture)
+{
+    // GL unbinds a deleted texture and may hand its name out again
+    for(int i = 0; i < GL_STATE_TEXTURE_UNITS; ++i)
+    {
+        if(gl_state.textures[i] == *texture)
+            gl_state.textures[i] = 0;
+    }
+    glDeleteTextures(1, texture);
+}
+
+static void gl_blend_func(GLenum src, GLenum dst)
+{
+    if(gl_state.blend_src == src && gl_state.blend_dst == dst)
+        return;
+    glBlendFunc(src, dst);
+    gl_state.blend_src = src;
+    gl_state.blend_dst = dst;
+    gfx_stats.state_changes++;
+}
+
+static void frame_uniforms_bind(GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, "FrameUniforms");
+    if(index == GL_INVALID_INDEX)
+    {
+        LOGW("Program %u has no FrameUniforms block", program);
+        return;
+    }
+    glUniformBlockBinding(program, index, FRAME_UNIFORMS_BINDING);
+}
+
+// uploads only when something changed, normally that's never after the first frame
+static void frame_uniforms_update()
+{
+    FrameUniforms u = {0};
+    memcpy(&u.view, &IDENTITY_MATRIX, sizeof(Matrix));
+    memcpy(&u.projection, &proj_matrix, sizeof(Matrix));
+    gfx_color2floats(ambient_light, &u.ambient_color[0], &u.ambient_color[1], &u.ambient_color[2]);
+    u.ambient_color[3] = 1.0;
+
+    if(memcmp(&u, &frame_uniforms, sizeof(FrameUniforms)) == 0)
+        return;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &u);
+    gfx_stats.upload_bytes += sizeof(FrameUniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    memcpy(&frame_uniforms, &u, sizeof(FrameUniforms));
 }
 
 bool gfx_draw_image(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world)
 {
-    gfx_sprite_batch_begin(in_world);
-    bool result = gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,false,false);
-    gfx_sprite_batch_draw();
-    return result;
+    return gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,false,false);
 }
 
 bool gfx_draw_image_color_mask(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world)
 {
-    gfx_sprite_batch_begin(in_world);
-    bool result = gfx_sprite_batch_add(img_index,sprite_index, x, y, color, true, scale, rotation, opacity, full_image,false,false);
-    gfx_sprite_batch_draw();
-    return result;
+    return gfx_sprite_batch_add(img_index,sprite_index, x, y, color, true, scale, rotation, opacity, full_image,false,false);
 }
 
 bool gfx_draw_image_ignore_light(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world)
 {
-    gfx_sprite_batch_begin(in_world);
-    bool result = gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,true,false);
-    gfx_sprite_batch_draw();
-    return result;
+    return gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,true,false);
 }
 
 bool gfx_draw_particle(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world, bool blend_additive)
 {
-    gfx_sprite_batch_begin(in_world);
-    bool result = gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,false,blend_additive);
-    gfx_sprite_batch_draw();
-    return result;
+    return gfx_sprite_batch_add(img_index,sprite_index, x, y, color, false, scale, rotation, opacity, full_image,false,blend_additive);
 }
 
-GFXImage* gfx_get_image_data(int img_index)
+// Atlases
+// --------------------------------------------------------
+// Every loaded sheet is read back and shelf packed into one or a few
+// atlases per filter mode. Images keep their own element layout, only the
+// normalized sprite rects are remapped and the texture is swapped for the
+// atlas, so sprites from different sheets share a texture unit. Images
+// loaded after gfx_atlas_build() keep their own texture.
+
+static int compare_atlas_entries(const void* a, const void* b)
 {
-    if(img_index < 0 || img_index >= MAX_GFX_IMAGES)
-    {
-        LOGE("%s: Invalid image index!", __func__);
-        return NULL;
-    }
-    return &gfx_images[img_index];
+    const AtlasEntry* ea = (const AtlasEntry*)a;
+    const AtlasEntry* eb = (const AtlasEntry*)b;
+    if(ea->h != eb->h)
+        return eb->h - ea->h;
+    return eb->w - ea->w;
 }
 
-void gfx_clear_lines()
+// shelf packs entries that haven't been placed yet, returns the number placed
+static int atlas_pack(AtlasEntry* entries, int count, int size, bool commit)
 {
-    num_line_points = 0;
+    int x = 0, y = 0, shelf_h = 0;
+    int placed = 0;
+
+    for(int i = 0; i < count; ++i)
+    {
+        AtlasEntry* e = &entries[i];
+        if(e->atlas >= 0)
+            continue;
+
+        int w = e->w + 2*ATLAS_EXTRUDE;
+        int h = e->h + 2*ATLAS_EXTRUDE;
+
+        if(x + w > size)
+        {
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+
+        if(w > size || y + h > size)
+            continue;
+
+        if(commit)
+        {
+            e->x = x;
+            e->y = y;
+        }
+
+        x += w;
+        shelf_h = MAX(shelf_h, h);
+        placed++;
+    }
+
+    return placed;
 }
 
-void gfx_add_line(float x0, float y0, float x1, float y1, uint32_t color)
+static void atlas_assign(AtlasEntry* entries, int count, int size, bool linear_filter)
 {
-    if(num_line_points >= 2*MAX_LINES-1)
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_bind_texture(0, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    // clear so the space left at the edges is transparent
+    unsigned char* zero = calloc(size*size, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, zero);
+    free(zero);
+
+    GLint filter = linear_filter ? GL_LINEAR : GL_NEAREST;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    for(int i = 0; i < count; ++i)
     {
-        LOGW("Too many lines, can't add any more!");
-        return;
-    }
+        AtlasEntry* e = &entries[i];
+        if(e->atlas >= 0 || e->x < 0)
+            continue;
 
-    uint8_t r = color >> 16;
-    uint8_t g = color >> 8;
-    uint8_t b = color >> 0;
+        e->atlas = num_atlases;
 
-    float rf = (float)r/255.0;
-    float gf = (float)g/255.0;
-    float bf = (float)b/255.0;
+        GFXImage* img = &gfx_images[e->img_index];
 
-    LinePoint points[2] = {
-        {{x0,y0},{rf,gf,bf}},
-        {{x1,y1},{rf,gf,bf}}
-    };
+        unsigned char* pixels = malloc(img->w*img->h*4);
+        gl_bind_texture(0, img->texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
-    memcpy(&line_points[num_line_points],points,sizeof(points));
-    num_line_points += 2;
+        // copy into a block ATLAS_EXTRUDE texels bigger on every side, clamping to the edges
+        int bw = img->w + 2*ATLAS_EXTRUDE;
+        int bh = img->h + 2*ATLAS_EXTRUDE;
+        uint32_t* src = (uint32_t*)pixels;
+        uint32_t* block = malloc(bw*bh*4);
+        for(int y = 0; y < bh; ++y)
+        {
+            int sy = RANGE(y - ATLAS_EXTRUDE, 0, img->h-1);
+            for(int x = 0; x < bw; ++x)
+            {
+                int sx = RANGE(x - ATLAS_EXTRUDE, 0, img->w-1);
+                block[y*bw + x] = src[sy*img->w + sx];
+            }
+        }
+
+        gl_bind_texture(0, texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, e->x, e->y, bw, bh, GL_RGBA, GL_UNSIGNED_BYTE, block);
+        free(block);
+        free(pixels);
+
+        gl_delete_texture(&img->texture);
+
+        float sx = (float)img->w / size;
+        float sy = (float)img->h / size;
+        float ox = (float)(e->x + ATLAS_EXTRUDE) / size;
+        float oy = (float)(e->y + ATLAS_EXTRUDE) / size;
+
+        for(int j = 0; j < img->element_count; ++j)
+        {
+            Rect* rects[2] = {&img->sprite_rects[j], &img->sprite_visible_rects[j]};
+            for(int k = 0; k < 2; ++k)
+            {
+                Rect* r = rects[k];
+                r->x = ox + r->x*sx;
+                r->y = oy + r->y*sy;
+                r->w *= sx;
+                r->h *= sy;
+            }
+        }
+
+        img->texture = texture;
+        img->atlas = num_atlases;
+    }
+
+    atlases[num_atlases].texture = texture;
+    atlases[num_atlases].size = size;
+    num_atlases++;
 }
 
-void gfx_draw_lines()
+void gfx_atlas_build()
 {
-    // Matrix* view = get_camera_transform();
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    max_size = MIN(max_size, ATLAS_MAX_SIZE);
 
-    glUseProgram(program_line);
+    AtlasEntry entries[MAX_GFX_IMAGES];
 
-    glUniformMatrix4fv(loc_line_view,1,GL_TRUE,&IDENTITY_MATRIX.m[0][0]);
-    glUniformMatrix4fv(loc_line_proj,1,GL_TRUE,&proj_matrix.m[0][0]);
+    for(int f = 0; f < 2; ++f)
+    {
+        bool linear_filter = (f == 1);
+        int count = 0;
 
-    glUniform1f(loc_line_opacity,1.0);
+        for(int i = 0; i < MAX_GFX_IMAGES; ++i)
+        {
+            GFXImage* img = &gfx_images[i];
+            if(img->texture == -1 || img->atlas >= 0 || img->linear_filter != linear_filter)
+                continue;
+
+            // text has its own program and texture coords
+            if(i == font_image)
+                continue;
+
+            AtlasEntry* e = &entries[count++];
+            e->img_index = i;
+            e->w = img->w;
+            e->h = img->h;
+            e->x = -1;
+            e->y = -1;
+            e->atlas = -1;
+        }
 
-    glBindBuffer(GL_ARRAY_BUFFER, line_vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, num_line_points*sizeof(LinePoint), line_points);
+        if(count < 2)
+            continue;
 
-    glBindVertexArray(line_vao);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+        qsort(entries, count, sizeof(AtlasEntry), compare_atlas_entries);
 
-    glDrawArrays(GL_LINES,0,num_line_points);//,GL_UNSIGNED_INT,0);
+        int remaining = count;
+        while(remaining > 0 && num_atlases < MAX_ATLASES)
+        {
+            // smallest power of two that fits everything left, or the largest allowed
+            int size = ATLAS_MIN_SIZE;
+            while(size < max_size && atlas_pack(entries, count, size, false) < remaining)
+                size *= 2;
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+            int placed = atlas_pack(entries, count, size, true);
+            if(placed == 0)
+                break;
 
-    glUseProgram(0);
+            atlas_assign(entries, count, size, linear_filter);
+            remaining -= placed;
 
+            LOGI("Atlas %d: %dx%d, %d images (%s)", num_atlases-1, size, size, placed, linear_filter ? "linear" : "nearest");
+        }
+
+        if(remaining > 0)
+            LOGW("%d images didn't fit in an atlas and keep their own texture", remaining);
+    }
 }
 
-void gfx_draw_rect(Rect* r, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world)
+
+GFXImage* gfx_get_image_data(int img_index)
 {
-    gfx_draw_rect_xywh(r->x, r->y, r->w, r->h, color, rotation, scale, opacity, filled, in_world);
+    if(img_index < 0 || img_index >= MAX_GFX_IMAGES)
+    {
+        LOGE("%s: Invalid image index!", __func__);
+        return NULL;
+    }
+    return &gfx_images[img_index];
 }
 
-void gfx_draw_rect_xywh(float x, float y, float w, float h, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world)
+static ShapeVertex* shape_batch_add(ShapeType type, int num_vertices, uint32_t color, float opacity)
 {
-    glUseProgram(program_shape);
+    ShapeBatch* batch = &shape_batches[type];
 
-    Matrix model = {0};
+    if(batch->num_vertices + num_vertices > SHAPE_BATCH_MAX_VERTICES)
+        gfx_flush();
 
-    Vector3f pos = {x,y,0.0};
-    Vector3f rot = {0.0,0.0,rotation};
-    Vector3f sca = {scale*w,-scale*h,1.0};
+    ShapeRun* run = batch->num_runs > 0 ? &batch->runs[batch->num_runs-1] : NULL;
+    if(!run || RENDER_KEY_LAYER(run->key) != render_layer || run->last_seq != layer_last_seq[render_layer])
+    {
+        if(batch->num_runs >= RENDER_MAX_RUNS)
+            gfx_flush();
 
-    get_model_transform(&pos,&rot,&sca,&model);
+        run = &batch->runs[batch->num_runs++];
+        run->key = RENDER_KEY(render_layer, render_seq);
+        run->start = batch->num_vertices;
+        run->count = 0;
+    }
+    run->count += num_vertices;
+    run->last_seq = render_seq++;
+    layer_last_seq[render_layer] = run->last_seq;
 
-    uint8_t r = color >> 16;
-    uint8_t g = color >> 8;
-    uint8_t b = color >> 0;
+    ShapeVertex* v = &batch->vertices[batch->num_vertices];
 
-    glUniform3f(loc_shape_color,r/255.0,g/255.0,b/255.0);
-    glUniform1f(loc_shape_opacity,opacity);
+    uint8_t c[4] = {(color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, UNORM8(opacity)};
+    for(int i = 0; i < num_vertices; ++i)
+        memcpy(v[i].color, c, sizeof(c));
 
-    glUniformMatrix4fv(loc_shape_model,1,GL_TRUE,&model.m[0][0]);
+    batch->num_vertices += num_vertices;
+    return v;
+}
 
-    glUniformMatrix4fv(loc_shape_view,1,GL_TRUE,&IDENTITY_MATRIX.m[0][0]);
+void gfx_add_line(float x0, float y0, float x1, float y1, uint32_t color)
+{
+    ShapeVertex* v = shape_batch_add(SHAPE_LINES, 2, color, 1.0);
+    v[0].pos.x = x0; v[0].pos.y = y0;
+    v[1].pos.x = x1; v[1].pos.y = y1;
+}
 
-    glUniformMatrix4fv(loc_shape_proj,1,GL_TRUE,&proj_matrix.m[0][0]);
+void gfx_draw_rect(Rect* r, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world)
+{
+    gfx_draw_rect_xywh(r->x, r->y, r->w, r->h, color, rotation, scale, opacity, filled, in_world);
+}
 
-    if(filled)
+void gfx_draw_rect_xywh(float x, float y, float w, float h, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world)
+{
+    if(filled && white_image >= 0)
     {
-        //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        glBindVertexArray(quad_vao);
-        glEnableVertexAttribArray(0);
-        glDrawArrays(GL_TRIANGLE_STRIP,0,4);
-        glDisableVertexAttribArray(0);
+        Rect* sr = &gfx_images[white_image].sprite_rects[0];
+        render_queue_add(white_image, sr, x, y, scale*w, scale*h, rotation, color, opacity, false, true, false);
+        return;
     }
-    else
+
+    // same scale, rotate, translate as sprite_batch.vert.glsl
+    float hw = scale*w/2.0;
+    float hh = scale*h/2.0;
+    float c = cosf(RAD(rotation));
+    float s = sinf(RAD(rotation));
+
+    Vector2f corners[4] = {{-hw,-hh},{-hw,+hh},{+hw,+hh},{+hw,-hh}};
+    for(int i = 0; i < 4; ++i)
+    {
+        Vector2f p = corners[i];
+        corners[i].x = x + c*p.x - s*p.y;
+        corners[i].y = y + s*p.x + c*p.y;
+    }
+
+    if(filled)
     {
-        //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        glBindVertexArray(rect_vao);
-        glEnableVertexAttribArray(0);
-        glDrawArrays(GL_LINE_STRIP,0,5);
-        glDisableVertexAttribArray(0);
+        ShapeVertex* v = shape_batch_add(SHAPE_TRIANGLES, 6, color, opacity);
+        v[0].pos = corners[0]; v[1].pos = corners[1]; v[2].pos = corners[2];
+        v[3].pos = corners[2]; v[4].pos = corners[3]; v[5].pos = corners[0];
+        return;
     }
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D,0);
-    glUseProgram(0);
+    ShapeVertex* v = shape_batch_add(SHAPE_LINES, 8, color, opacity);
+    for(int i = 0; i < 4; ++i)
+    {
+        v[2*i+0].pos = corners[i];
+        v[2*i+1].pos = corners[(i+1) % 4];
+    }
 }
 
 void gfx_draw_rect_tl(Rect* r, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world)
@@ -908,172 +1733,261 @@ void gfx_draw_rect_xywh_tl(float x, float y, float w, float h, uint32_t color, f
 
 void gfx_draw_circle(float x, float y, float radius, uint32_t color, float opacity, bool filled, bool in_world)
 {
-    glUseProgram(program_shape);
+    float d = 2.0*radius;
 
-    Matrix model = {0};
+    if(filled)
+    {
+        ShapeVertex* v = shape_batch_add(SHAPE_TRIANGLES, 3*CIRCLE_SEGMENTS, color, opacity);
+        for(int i = 0; i < CIRCLE_SEGMENTS; ++i)
+        {
+            v[3*i+0].pos.x = x;
+            v[3*i+0].pos.y = y;
+            v[3*i+1].pos.x = x + d*unit_circle[i].x;
+            v[3*i+1].pos.y = y + d*unit_circle[i].y;
+            v[3*i+2].pos.x = x + d*unit_circle[i+1].x;
+            v[3*i+2].pos.y = y + d*unit_circle[i+1].y;
+        }
+        return;
+    }
 
-    Vector3f pos = {x,y,0.0};
-    Vector3f rot = {0.0,0.0,0.0};
-    Vector3f sca = {radius*2.0,-radius*2.0,1.0};
+    ShapeVertex* v = shape_batch_add(SHAPE_LINES, 2*CIRCLE_SEGMENTS, color, opacity);
+    for(int i = 0; i < CIRCLE_SEGMENTS; ++i)
+    {
+        v[2*i+0].pos.x = x + d*unit_circle[i].x;
+        v[2*i+0].pos.y = y + d*unit_circle[i].y;
+        v[2*i+1].pos.x = x + d*unit_circle[i+1].x;
+        v[2*i+1].pos.y = y + d*unit_circle[i+1].y;
+    }
+}
 
-    get_model_transform(&pos,&rot,&sca,&model);
+static int text_layout(const char* str, float scale, GlyphQuad* glyphs, int max_glyphs, Vector2f* size)
+{
+    float fontsize = 64.0 * scale;
 
-    uint8_t r = color >> 16;
-    uint8_t g = color >> 8;
-    uint8_t b = color >> 0;
+    float x_pos = 0.0;
+    float y_pos = fontsize;
+    float longest_width = 0.0;
 
-    glUniform3f(loc_shape_color,r/255.0,g/255.0,b/255.0);
-    glUniform1f(loc_shape_opacity,opacity);
+    int num_lines = 1;
+    int num_glyphs = 0;
 
-    glUniformMatrix4fv(loc_shape_model,1,GL_TRUE,&model.m[0][0]);
+    for(const char* c = str; *c != '\0'; ++c)
+    {
+        if(*c == '\n')
+        {
+            y_pos += fontsize;
+            if(x_pos > longest_width)
+                longest_width = x_pos;
 
-    glUniformMatrix4fv(loc_shape_view,1,GL_TRUE,&IDENTITY_MATRIX.m[0][0]);
+            x_pos = 0.0;
+            num_lines++;
+            continue;
+        }
 
-    glUniformMatrix4fv(loc_shape_proj,1,GL_TRUE,&proj_matrix.m[0][0]);
+        FontChar* fc = &font_chars[*c];
 
-    if(filled)
-    {
-        //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        glBindVertexArray(circle_vao);
-        glEnableVertexAttribArray(0);
-        glDrawArrays(GL_TRIANGLE_FAN,0,16);
-        glDisableVertexAttribArray(0);
-    }
-    else
-    {
-        //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        glBindVertexArray(circle_vao);
-        glEnableVertexAttribArray(0);
-        glDrawArrays(GL_LINE_STRIP,0,17);
-        glDisableVertexAttribArray(0);
+        // whitespace has an empty plane box, only advance
+        if(fc->plane_box.l != fc->plane_box.r && num_glyphs < max_glyphs)
+        {
+            GlyphQuad* g = &glyphs[num_glyphs++];
+            g->x0 = x_pos + fontsize*fc->plane_box.l;
+            g->y0 = y_pos - fontsize*fc->plane_box.t;
+            g->x1 = x_pos + fontsize*fc->plane_box.r;
+            g->y1 = y_pos - fontsize*fc->plane_box.b;
+            g->tex_coords = fc->tex_coords;
+        }
+
+        x_pos += (fontsize*fc->advance);
     }
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    if(x_pos > longest_width)
+        longest_width = x_pos;
 
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D,0);
-    glUseProgram(0);
+    size->x = longest_width;
+    size->y = fontsize*num_lines;
+    return num_glyphs;
 }
 
-static Vector2f gfx_draw_string_internal(float x, float y, uint32_t color, uint32_t background_color, float scale, float rotation, float opacity, bool in_world, bool drop_shadow, char* str)
+// returns the glyph quads for str, from the cache when it was laid out recently
+static GlyphQuad* text_get_layout(const char* str, float scale, int* num_glyphs, Vector2f* size)
 {
-    glUseProgram(program_font);
+    size_t len = strlen(str);
+    if(len > TEXT_CACHE_MAX_LEN)
+    {
+        *num_glyphs = text_layout(str, scale, text_scratch, TEXT_MAX_LEN, size);
+        return text_scratch;
+    }
 
-    GFXImage* img = &gfx_images[font_image];
+    // FNV-1a over the string and the scale
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; ++i)
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, img->texture);
-    glUniform1i(loc_font_image, 0);
+    uint32_t scale_bits;
+    memcpy(&scale_bits, &scale, sizeof(scale_bits));
+    hash = (hash ^ scale_bits) * 16777619u;
 
-    glBindVertexArray(font_vao);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    TextLayout* t = &text_cache[hash & (TEXT_CACHE_SLOTS-1)];
+
+    if(!t->used || t->scale != scale || strcmp(t->str, str) != 0)
+    {
+        t->used = true;
+        t->scale = scale;
+        memcpy(t->str, str, len+1);
+        t->num_glyphs = text_layout(str, scale, t->glyphs, TEXT_CACHE_MAX_LEN, &t->size);
+    }
 
-    uint8_t br = background_color >> 16;
-    uint8_t bg = background_color >> 8;
-    uint8_t bb = background_color >> 0;
+    *num_glyphs = t->num_glyphs;
+    *size = t->size;
+    return t->glyphs;
+}
 
-    uint8_t r = color >> 16;
-    uint8_t g = color >> 8;
-    uint8_t b = color >> 0;
+static void text_batch_add(GlyphQuad* g, float x, float y, float cos_r, float sin_r, Vector4f* color)
+{
+    if(text_num_glyphs >= TEXT_BATCH_MAX_GLYPHS)
+        gfx_flush();
 
-    glUniform1f(loc_font_px_range,4.0);
+    TextRun* run = text_num_runs > 0 ? &text_runs[text_num_runs-1] : NULL;
+    if(!run || RENDER_KEY_LAYER(run->key) != render_layer || run->last_seq != layer_last_seq[render_layer])
+    {
+        if(text_num_runs >= RENDER_MAX_RUNS)
+            gfx_flush();
 
-    char* c = str;
+        run = &text_runs[text_num_runs++];
+        run->key = RENDER_KEY(render_layer, render_seq);
+        run->start = text_num_glyphs;
+        run->num_glyphs = 0;
+    }
+    run->num_glyphs++;
+    run->last_seq = render_seq++;
+    layer_last_seq[render_layer] = run->last_seq;
+
+    Vector2f corners[4] = {
+        {x + g->x0, y + g->y0},
+        {x + g->x0, y + g->y1},
+        {x + g->x1, y + g->y0},
+        {x + g->x1, y + g->y1},
+    };
 
-    float fontsize = 64.0 * scale;
+    Vector2f tex[4] = {
+        {g->tex_coords.l, g->tex_coords.t},
+        {g->tex_coords.l, g->tex_coords.b},
+        {g->tex_coords.r, g->tex_coords.t},
+        {g->tex_coords.r, g->tex_coords.b},
+    };
 
-    float x_pos = x;
-    float y_pos = y+fontsize;
-    float longest_width = 0.0;
+    FontVertex* v = &text_vertices[4*text_num_glyphs];
+    for(int i = 0; i < 4; ++i)
+    {
+        v[i].position.x = cos_r*corners[i].x - sin_r*corners[i].y;
+        v[i].position.y = sin_r*corners[i].x + cos_r*corners[i].y;
+        v[i].tex_coord = tex[i];
+        v[i].color = *color;
+    }
 
-    int num_lines = 1;
+    text_num_glyphs++;
+}
 
-    for(;;)
+static Vector2f gfx_draw_string_internal(float x, float y, uint32_t color, uint32_t background_color, float scale, float rotation, float opacity, bool in_world, bool drop_shadow, char* str)
+{
+    int num_glyphs = 0;
+    Vector2f size = {0};
+    GlyphQuad* glyphs = text_get_layout(str, scale, &num_glyphs, &size);
+
+    // rotation is about the origin like the old per glyph model transform
+    float cos_r = 1.0;
+    float sin_r = 0.0;
+    if(rotation != 0.0)
     {
-        if(*c == '\0')
-            break;
+        cos_r = cosf(RAD(rotation));
+        sin_r = sinf(RAD(rotation));
+    }
 
-        if(*c == '\n')
-        {
-            y_pos += fontsize;
-            if((x_pos-x) > longest_width)
-                longest_width = (x_pos-x);
+    Vector4f fg = {0.0,0.0,0.0,opacity};
+    gfx_color2floats(color, &fg.x, &fg.y, &fg.z);
 
-            x_pos = x;
-            num_lines++;
-            c++;
-            continue;
-        }
+    Vector4f shadow = {1.0,1.0,1.0,opacity};
 
-        FontChar* fc = &font_chars[*c];
+    for(int i = 0; i < num_glyphs; ++i)
+    {
+        if(drop_shadow)
+        {
+            // the shadow offset is applied after rotation
+            GlyphQuad g = glyphs[i];
+            float dx = -4.0*scale;
+            float dy = 4.0*scale;
+            float ux = cos_r*dx + sin_r*dy;
+            float uy = -sin_r*dx + cos_r*dy;
+            g.x0 += ux; g.x1 += ux;
+            g.y0 += uy; g.y1 += uy;
+            text_batch_add(&g, x, y, cos_r, sin_r, &shadow);
+        }
 
-        float x0 = x_pos + fontsize*fc->plane_box.l;
-        float y0 = y_pos - fontsize*fc->plane_box.t;
-        float x1 = x_pos + fontsize*fc->plane_box.r;
-        float y1 = y_pos - fontsize*fc->plane_box.b;
+        text_batch_add(&glyphs[i], x, y, cos_r, sin_r, &fg);
+    }
 
-        /*
-        printf("====== %c ========\n",*c);
-        printf("x0: %f, y0: %f, x1: %f, y1: %f\n",x0,y0,x1,y1);
-        printf("w: %f, h: %f\n",w,h);
-        printf("advance: %f, advance px: %f\n",fc->advance, fontsize*fc->advance);
-        printf("==================\n");
-        */
+    return size;
+}
 
-        Vertex fontchar[] =
-        {
-            {{x0, y0},{fc->tex_coords.l,fc->tex_coords.t}},
-            {{x0, y1},{fc->tex_coords.l,fc->tex_coords.b}},
-            {{x1, y0},{fc->tex_coords.r,fc->tex_coords.t}},
-            {{x1, y1},{fc->tex_coords.r,fc->tex_coords.b}},
-        };
-        
-        glBindBuffer(GL_ARRAY_BUFFER, font_vbo);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(fontchar), fontchar);
+static int compare_text_runs(const void* a, const void* b)
+{
+    uint64_t ka = ((const TextRun*)a)->key;
+    uint64_t kb = ((const TextRun*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
 
-        Matrix model = {0};
+// copies the queued glyph runs into font_stream ordered by layer, like shape_batch_upload()
+static bool text_upload()
+{
+    text_next_run = 0;
 
-        Vector3f pos = {0.0,0.0,0.0};
-        Vector3f rot = {0.0,0.0,rotation};
-        Vector3f sca = {1.0,1.0,1.0};
-        get_model_transform(&pos,&rot,&sca,&model);
+    int n = text_num_glyphs;
+    text_num_glyphs = 0;
 
-        glUniformMatrix4fv(loc_font_view,1,GL_TRUE,&IDENTITY_MATRIX.m[0][0]);
+    if(n == 0)
+        return false;
 
-        glUniformMatrix4fv(loc_font_proj,1,GL_TRUE,&proj_matrix.m[0][0]);
+    GLsizeiptr bytes = 4*n*sizeof(FontVertex);
+    GLintptr offset = 0;
+    FontVertex* dst = stream_begin(&font_stream, bytes, sizeof(FontVertex), &offset);
+    if(!dst)
+    {
+        text_num_runs = 0;
+        return false;
+    }
 
-        if(drop_shadow)
+    for(int r = 1; r < text_num_runs; ++r)
+    {
+        if(text_runs[r].key < text_runs[r-1].key)
         {
-            Matrix model_shadow = {0};
-            Vector3f pos_shadow = {-4.0*scale,4.0*scale,0.0};
-            get_model_transform(&pos_shadow,&rot,&sca,&model_shadow);
-
-            glUniformMatrix4fv(loc_font_model,1,GL_TRUE,&model_shadow.m[0][0]);
-            // glUniform4f(loc_font_fg_color,0.0,0.0,0.0,opacity);
-            glUniform4f(loc_font_fg_color,1.0,1.0,1.0,opacity);
-            glDrawArrays(GL_TRIANGLE_STRIP,0,4);
+            qsort(text_runs, text_num_runs, sizeof(TextRun), compare_text_runs);
+            break;
         }
-
-        glUniformMatrix4fv(loc_font_model,1,GL_TRUE,&model.m[0][0]);
-        glUniform4f(loc_font_fg_color,r/255.0,g/255.0,b/255.0,opacity);
-        glDrawArrays(GL_TRIANGLE_STRIP,0,4);
-
-        c++;
-        x_pos += (fontsize*fc->advance);
     }
 
-    if((x_pos-x) > longest_width)
-        longest_width = (x_pos-x);
+    GLint base_vertex = (GLint)(offset/sizeof(FontVertex));
+    for(int r = 0; r < text_num_runs; ++r)
+    {
+        TextRun* run = &text_runs[r];
+        memcpy(dst, &text_vertices[4*run->start], 4*run->num_glyphs*sizeof(FontVertex));
+        run->base_vertex = base_vertex;
+        dst += 4*run->num_glyphs;
+        base_vertex += 4*run->num_glyphs;
+    }
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    stream_end(&font_stream, bytes);
+    return true;
+}
 
-    glBindTexture(GL_TEXTURE_2D,0);
-    glUseProgram(0);
+static void text_run_draw(TextRun* run)
+{
+    gl_use_program(program_font);
+    gl_bind_texture(0, gfx_images[font_image].texture);
+    gl_bind_vao(font_vao);
+    blend_mode_normal();
 
-    Vector2f ret = {longest_width, fontsize*num_lines};
-    return ret;
+    glDrawElementsBaseVertex(GL_TRIANGLES, 6*run->num_glyphs, GL_UNSIGNED_SHORT, 0, run->base_vertex);
+    gfx_stats.draw_calls++;
 }
 
 Vector2f gfx_draw_string_with_background(float x, float y, uint32_t color, uint32_t background_color, float scale, float rotation, float opacity, bool in_world, bool drop_shadow, char* fmt, ...)
@@ -1113,39 +2027,10 @@ Vector2f gfx_string_get_size(float scale, char* fmt, ...)
     vsprintf(str,fmt, args);
     va_end(args);
 
-    float x_pos = 0.0;
-    float fontsize = 64.0 * scale;
-    int num_lines = 1;
-    float longest_width = 0.0;
-
-    char* c = str;
-
-    for(;;)
-    {
-        if(*c == '\0')
-            break;
-
-        if(*c == '\n')
-        {
-            num_lines++;
-            if(x_pos > longest_width)
-                longest_width = x_pos;
-            x_pos = 0.0;
-            c++;
-            continue;
-        }
-
-        FontChar* fc = &font_chars[*c];
-
-        x_pos += (fontsize*fc->advance);
-        c++;
-    }
-
-    if(x_pos > longest_width)
-        longest_width = x_pos;
-
-    Vector2f ret = {longest_width, fontsize*num_lines};
-    return ret;
+    int num_glyphs = 0;
+    Vector2f size = {0};
+    text_get_layout(str, scale, &num_glyphs, &size);
+    return size;
 }
 
 Vector2f gfx_string_get_size_array(float scale, float* size_arr, int len, int* ret_len, char* fmt, ...)
@@ -1229,6 +2114,16 @@ void gfx_print_times()
     printf("Other time:        %.4f\n", other_time);
 }
 
+void gfx_get_stats(GFXStats* stats)
+{
+    memcpy(stats, &gfx_stats, sizeof(GFXStats));
+}
+
+void gfx_reset_stats()
+{
+    memset(&gfx_stats, 0, sizeof(GFXStats));
+}
+
 uint32_t gfx_blend_colors(uint32_t color1, uint32_t color2, float factor)
 {
     Vector3f c1,c2;
@@ -1268,72 +2163,72 @@ void gfx_color_gradient(uint32_t colors[], int num_colors, int steps, uint32_t*
 // static functions
 // --------------------------------------------------------
 
-static int assign_image(GFXImageData image, bool linear_filter, int element_width, int element_height, bool raw)
+static void image_analyze(GFXImageData* image, int element_width, int element_height, bool raw, GFXImage* img, ImageLoadTimes* times)
 {
 
     Timer _timer = {0};
     timer_begin(&_timer);   //img_time
 
-    GFXImage img = {0};
-    img.w = image.w;
-    img.h = image.h;
-    img.n = image.n;
+    img->w = image->w;
+    img->h = image->h;
+    img->n = image->n;
+    img->atlas = -1;
 
     if(element_width <= 0 || element_height <= 0)
     {
-        img.elements_per_row = 1;
-        img.elements_per_col = 1;
-        img.element_width = img.w;
-        img.element_height = img.h;
+        img->elements_per_row = 1;
+        img->elements_per_col = 1;
+        img->element_width = img->w;
+        img->element_height = img->h;
     }
     else
     {
-        img.elements_per_row = (img.w / element_width);
-        img.elements_per_col = (img.h / element_height);
-        img.element_width = element_width;
-        img.element_height = element_height;
+        img->elements_per_row = (img->w / element_width);
+        img->elements_per_col = (img->h / element_height);
+        img->element_width = element_width;
+        img->element_height = element_height;
     }
-    img.element_count = img.elements_per_row * img.elements_per_col;
+    img->element_count = img->elements_per_row * img->elements_per_col;
 
 #if PRINT_LOAD_LOGS
-    LOGI("  Element Count: %d (%d x %d)", img.element_count, img.elements_per_row, img.elements_per_col);
+    LOGI("  Element Count: %d (%d x %d)", img->element_count, img->elements_per_row, img->elements_per_col);
 #endif
 
-    img.visible_rects = malloc(img.element_count * sizeof(Rect));
-    img.sprite_visible_rects = malloc(img.element_count * sizeof(Rect));
-    img.sprite_rects = malloc(img.element_count * sizeof(Rect));
-    img.avg_color = malloc(img.element_count * sizeof(uint32_t));
+    img->visible_rects = malloc(img->element_count * sizeof(Rect));
+    img->sprite_visible_rects = malloc(img->element_count * sizeof(Rect));
+    img->sprite_rects = malloc(img->element_count * sizeof(Rect));
+    img->avg_color = malloc(img->element_count * sizeof(uint32_t));
 
-    int num_cols = img.elements_per_row;
-    int num_rows = img.elements_per_col;
+    int num_cols = img->elements_per_row;
+    int num_rows = img->elements_per_col;
 
-    int num_pixels = img.element_width*img.element_height;
-    size_t temp_size = num_pixels*img.n*sizeof(unsigned char);
+    int num_pixels = img->element_width*img->element_height;
+    size_t temp_size = num_pixels*img->n*sizeof(unsigned char);
     unsigned char* temp_data = malloc(temp_size);
 
-    other_time += timer_get_elapsed(&_timer);
+    times->other_time += timer_get_elapsed(&_timer);
 
-    for(int i = 0; i < img.element_count; ++i)
+    for(int i = 0; i < img->element_count; ++i)
     {
         timer_begin(&_timer);   //other_time
 
-        int start_x = (i % num_cols) * img.element_width;
-        int start_y = (i / num_cols) * img.element_height;
+        int start_x = (i % num_cols) * img->element_width;
+        int start_y = (i / num_cols) * img->element_height;
         // printf("start_x,y: %d, %d\n", start_x, start_y);
 
-        if(image.data != NULL)
+        if(image->data != NULL)
         {
 
             float avg_r=0.0,avg_g=0.0,avg_b=0.0;
-            for(int y = 0; y < img.element_height; ++y)
+            for(int y = 0; y < img->element_height; ++y)
             {
-                for(int x = 0; x < img.element_width; ++x)
+                for(int x = 0; x < img->element_width; ++x)
                 {
-                    int index = ((start_y+y)*image.w + (start_x+x)) * img.n;
-                    int sub_index = (y*img.element_width + x) * img.n;
-                    for(int _n = 0; _n < img.n; ++_n)
+                    int index = ((start_y+y)*image->w + (start_x+x)) * img->n;
+                    int sub_index = (y*img->element_width + x) * img->n;
+                    for(int _n = 0; _n < img->n; ++_n)
                     {
-                        temp_data[sub_index+_n] = image.data[index+_n];
+                        temp_data[sub_index+_n] = image->data[index+_n];
                     }
                     avg_r += (temp_data[sub_index+0]*(float)temp_data[sub_index+3]/255.0);
                     avg_g += (temp_data[sub_index+1]*(float)temp_data[sub_index+3]/255.0);
@@ -1345,54 +2240,153 @@ static int assign_image(GFXImageData image, bool linear_filter, int element_widt
             avg_g /= (float)num_pixels;
             avg_b /= (float)num_pixels;
 
-            img.avg_color[i] = COLOR((uint8_t)avg_r,(uint8_t)avg_g,(uint8_t)avg_b);
+            img->avg_color[i] = COLOR((uint8_t)avg_r,(uint8_t)avg_g,(uint8_t)avg_b);
 
         }
 
-        other_time += timer_get_elapsed(&_timer);
+        times->other_time += timer_get_elapsed(&_timer);
 
         if(raw)
         {
-            img.visible_rects[i].x = img.w/2.0;
-            img.visible_rects[i].y = img.h/2.0;
-            img.visible_rects[i].w = img.w;
-            img.visible_rects[i].h = img.h;
-
-            img.sprite_visible_rects[i].x = 0.5;
-            img.sprite_visible_rects[i].y = 0.5;
-            img.sprite_visible_rects[i].w = 1.0;
-            img.sprite_visible_rects[i].h = 1.0;
-
-            img.sprite_rects[i].x = 0.5;
-            img.sprite_rects[i].y = 0.5;
-            img.sprite_rects[i].w = 1.0;
-            img.sprite_rects[i].h = 1.0;
+            img->visible_rects[i].x = img->w/2.0;
+            img->visible_rects[i].y = img->h/2.0;
+            img->visible_rects[i].w = img->w;
+            img->visible_rects[i].h = img->h;
+
+            img->sprite_visible_rects[i].x = 0.5;
+            img->sprite_visible_rects[i].y = 0.5;
+            img->sprite_visible_rects[i].w = 1.0;
+            img->sprite_visible_rects[i].h = 1.0;
+
+            img->sprite_rects[i].x = 0.5;
+            img->sprite_rects[i].y = 0.5;
+            img->sprite_rects[i].w = 1.0;
+            img->sprite_rects[i].h = 1.0;
         }
         else
         {
-            image_get_visible_rect(img.element_width, img.element_height, img.n, temp_data, &img.visible_rects[i]);
-            Rect* vr = &img.visible_rects[i];
-            img.sprite_visible_rects[i].x = (float)(start_x+vr->x) / img.w;
-            img.sprite_visible_rects[i].y = (float)(start_y+vr->y) / img.h;
-            img.sprite_visible_rects[i].w = vr->w / img.w;
-            img.sprite_visible_rects[i].h = vr->h / img.h;
+            image_get_visible_rect(img->element_width, img->element_height, img->n, temp_data, &img->visible_rects[i], &times->vr_time);
+            Rect* vr = &img->visible_rects[i];
+            img->sprite_visible_rects[i].x = (float)(start_x+vr->x) / img->w;
+            img->sprite_visible_rects[i].y = (float)(start_y+vr->y) / img->h;
+            img->sprite_visible_rects[i].w = vr->w / img->w;
+            img->sprite_visible_rects[i].h = vr->h / img->h;
 
             // printf("element: %d\n", i);
-            // print_rect(&img.sprite_visible_rects[i]);
+            // print_rect(&img->sprite_visible_rects[i]);
 
-            img.sprite_rects[i].x = (float)(start_x+img.element_width/2.0) / img.w;
-            img.sprite_rects[i].y = (float)(start_y+img.element_height/2.0) / img.h;
-            img.sprite_rects[i].w = (float)img.element_width / img.w;
-            img.sprite_rects[i].h = (float)img.element_height / img.h;
+            img->sprite_rects[i].x = (float)(start_x+img->element_width/2.0) / img->w;
+            img->sprite_rects[i].y = (float)(start_y+img->element_height/2.0) / img->h;
+            img->sprite_rects[i].w = (float)img->element_width / img->w;
+            img->sprite_rects[i].h = (float)img->element_height / img->h;
         }
 
 
     }//element_count
 
+    free(temp_data);
+}
+
+static int assign_image(GFXImageData image, bool linear_filter, int element_width, int element_height, bool raw)
+{
+    GFXImage img = {0};
+    ImageLoadTimes times = {0};
+    image_analyze(&image, element_width, element_height, raw, &img, &times);
+    img.linear_filter = linear_filter;
+    vr_time += times.vr_time;
+    other_time += times.other_time;
 
+    Timer _timer = {0};
     timer_begin(&_timer);   //other_time
 
-    //assign image
+    int index = image_store(&img, image.data, linear_filter);
+
+    if(!raw)
+    {
+        if(image.data != NULL) free(image.data);
+    }
+
+    other_time += timer_get_elapsed(&_timer);
+
+    return index;
+}
+
+static bool image_prepare(const char* image_path, bool flip, int element_width, int element_height, ImageLoad* load)
+{
+    char cooked_path[256] = {0};
+    snprintf(cooked_path, sizeof(cooked_path), "%s" COOKED_IMAGE_EXT, image_path);
+
+    CookedImageHeader key = {0};
+    memcpy(key.magic, COOKED_IMAGE_MAGIC, 4);
+    key.version = COOKED_IMAGE_VERSION;
+    key.flip = flip ? 1 : 0;
+    key.requested_element_width = element_width;
+    key.requested_element_height = element_height;
+    bool have_source = image_source_stat(image_path, &key.source_size, &key.source_mtime);
+
+    // a sidecar is only trusted when it can be checked against its source
+    if(have_source && image_read_cooked(cooked_path, &key, load))
+    {
+#if PRINT_LOAD_LOGS
+        LOGI("Loaded cooked image: %s", cooked_path);
+#endif
+        return true;
+    }
+
+    GFXImageData image = {0};
+    if(!gfx_load_image_data(image_path, &image, flip))
+        return false;
+
+    image_analyze(&image, element_width, element_height, false, &load->img, &load->times);
+
+    if(have_source)
+    {
+        key.w = load->img.w;
+        key.h = load->img.h;
+        key.n = load->img.n;
+        key.element_width = load->img.element_width;
+        key.element_height = load->img.element_height;
+        key.elements_per_row = load->img.elements_per_row;
+        key.elements_per_col = load->img.elements_per_col;
+        key.element_count = load->img.element_count;
+        image_write_cooked(cooked_path, &key, &load->img, image.data);
+    }
+
+    load->texels = image.data;
+    return true;
+}
+
+static void image_release(ImageLoad* load)
+{
+    if(load->mapping)
+        image_unmap_file(load->mapping, load->mapping_size);
+    else if(load->texels)
+        free(load->texels);
+
+    memset(load, 0, sizeof(ImageLoad));
+}
+
+static void image_prefetch_job(void* arg)
+{
+    ImagePrefetch* pf = (ImagePrefetch*)arg;
+    pf->ok = image_prepare(pf->path, pf->flip, pf->element_width, pf->element_height, &pf->load);
+}
+
+static ImagePrefetch* image_prefetch_find(const char* image_path, bool flip, int element_width, int element_height)
+{
+    for(int i = 0; i < MAX_IMAGE_PREFETCHES; ++i)
+    {
+        ImagePrefetch* pf = &image_prefetches[i];
+        if(!pf->pending) continue;
+        if(pf->flip != flip || pf->element_width != element_width || pf->element_height != element_height) continue;
+        if(strcmp(pf->path, image_path) != 0) continue;
+        return pf;
+    }
+    return NULL;
+}
+
+static int image_store(GFXImage* img, unsigned char* texels, bool linear_filter)
+{
     for(int i = 0; i < MAX_GFX_IMAGES; ++i)
     {
         if(gfx_images[i].texture == -1)
@@ -1401,7 +2395,7 @@ static int assign_image(GFXImageData image, bool linear_filter, int element_widt
             LOGI("  Index: %d", i);
 #endif
             GFXImage* p = &gfx_images[i];
-            memcpy(p, &img, sizeof(GFXImage));
+            memcpy(p, img, sizeof(GFXImage));
 
             glGenTextures(1, &p->texture);
             if(p->texture == -1)
@@ -1410,8 +2404,9 @@ static int assign_image(GFXImageData image, bool linear_filter, int element_widt
             }
             else
             {
-                glBindTexture(GL_TEXTURE_2D, p->texture);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.w, image.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+                gl_bind_texture(0, p->texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->w, img->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+                gfx_stats.upload_bytes += (uint64_t)img->w*img->h*4;
 
                 if(linear_filter)
                 {
@@ -1426,49 +2421,183 @@ static int assign_image(GFXImageData image, bool linear_filter, int element_widt
 
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-                glBindTexture(GL_TEXTURE_2D, 0);
             }
 
+            return i;
+        }
+    }
+
+    LOGW("No free image slots");
+    free(img->visible_rects);
+    free(img->sprite_visible_rects);
+    free(img->sprite_rects);
+    free(img->avg_color);
+    return -1;
+}
 
-            // DEBUG
-            // if(p->texture == 17)
-            // {
-            //     for(int idx = 0; idx < img.element_count; ++idx)
-            //     {
-            //         printf("%d) ", idx);
-            //         print_rect(&p->visible_rects[idx]);
-            //     }
-            // }
+// Cooked images
+// --------------------------------------------------------
+// The first load of a PNG writes <path>.cooked next to it, holding the
+// element grid, visible rects, average colors and decoded texels. Later
+// loads map the sidecar instead of decoding and scanning pixels. The
+// sidecar is rebuilt when the source's size or modification time changes.
 
+static bool image_source_stat(const char* path, uint64_t* size, int64_t* mtime)
+{
+    struct stat st;
+    if(stat(path, &st) != 0)
+        return false;
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
 
-            if(temp_data != NULL) free(temp_data);
-            if(!raw)
-            {
-                if(image.data != NULL) free(image.data);
-            }
+static void* image_map_file(const char* path, size_t* size)
+{
+#if _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
 
-            other_time += timer_get_elapsed(&_timer);
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
 
-            return i;
-            // return p->texture;
-        }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(mapping == NULL)
+        return NULL;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *size = (size_t)file_size.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
     }
 
-    if(temp_data != NULL) free(temp_data);
-    if(!raw)
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+static void image_unmap_file(void* data, size_t size)
+{
+#if _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static size_t cooked_image_size(CookedImageHeader* h)
+{
+    return sizeof(CookedImageHeader) + h->element_count*(3*sizeof(Rect) + sizeof(uint32_t)) + (size_t)h->w*h->h*4;
+}
+
+static bool image_read_cooked(const char* cooked_path, CookedImageHeader* key, ImageLoad* load)
+{
+    size_t size = 0;
+    uint8_t* data = image_map_file(cooked_path, &size);
+    if(!data)
+        return false;
+
+    CookedImageHeader* h = (CookedImageHeader*)data;
+
+    bool valid = size >= sizeof(CookedImageHeader)
+        && memcmp(h->magic, COOKED_IMAGE_MAGIC, 4) == 0
+        && h->version == COOKED_IMAGE_VERSION
+        && h->flip == key->flip
+        && h->requested_element_width == key->requested_element_width
+        && h->requested_element_height == key->requested_element_height
+        && h->source_size == key->source_size && h->source_mtime == key->source_mtime
+        && size == cooked_image_size(h);
+
+    if(!valid)
     {
-        if(image.data != NULL) free(image.data);
+        image_unmap_file(data, size);
+        return false;
     }
 
-    return -1;
+    GFXImage img = {0};
+    img.w = h->w;
+    img.h = h->h;
+    img.n = h->n;
+    img.atlas = -1;
+    img.element_count = h->element_count;
+    img.elements_per_row = h->elements_per_row;
+    img.elements_per_col = h->elements_per_col;
+    img.element_width = h->element_width;
+    img.element_height = h->element_height;
+
+    size_t rects_size = img.element_count*sizeof(Rect);
+    uint8_t* p = data + sizeof(CookedImageHeader);
+
+    img.visible_rects = malloc(rects_size);
+    memcpy(img.visible_rects, p, rects_size); p += rects_size;
+    img.sprite_visible_rects = malloc(rects_size);
+    memcpy(img.sprite_visible_rects, p, rects_size); p += rects_size;
+    img.sprite_rects = malloc(rects_size);
+    memcpy(img.sprite_rects, p, rects_size); p += rects_size;
+    img.avg_color = malloc(img.element_count*sizeof(uint32_t));
+    memcpy(img.avg_color, p, img.element_count*sizeof(uint32_t)); p += img.element_count*sizeof(uint32_t);
+
+    // texels go straight from the mapping to the driver, image_release() unmaps
+    load->img = img;
+    load->texels = p;
+    load->mapping = data;
+    load->mapping_size = size;
+    return true;
+}
+
+static void image_write_cooked(const char* cooked_path, CookedImageHeader* h, GFXImage* img, unsigned char* texels)
+{
+    char temp_path[256] = {0};
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cooked_path);
+
+    FILE* fp = fopen(temp_path, "wb");
+    if(!fp)
+    {
+        LOGW("Failed to write cooked image %s", cooked_path);
+        return;
+    }
+
+    size_t rects_size = img->element_count*sizeof(Rect);
+
+    fwrite(h, sizeof(CookedImageHeader), 1, fp);
+    fwrite(img->visible_rects, 1, rects_size, fp);
+    fwrite(img->sprite_visible_rects, 1, rects_size, fp);
+    fwrite(img->sprite_rects, 1, rects_size, fp);
+    fwrite(img->avg_color, sizeof(uint32_t), img->element_count, fp);
+    fwrite(texels, 4, (size_t)img->w*img->h, fp);
+    fclose(fp);
+
+    remove(cooked_path);
+    if(rename(temp_path, cooked_path) != 0)
+    {
+        LOGW("Failed to write cooked image %s", cooked_path);
+        remove(temp_path);
+    }
 }
 
 static void init_sprite_batch()
 {
     // VAO
     glGenVertexArrays(1, &batch_vao);
-    glBindVertexArray(batch_vao);
+    gl_bind_vao(batch_vao);
 
     Vertex batch_quad[] =
     {
@@ -1491,51 +2620,27 @@ static void init_sprite_batch()
     // Instance VBO
     // printf("Size of sprite: %d\n",sizeof(Sprite));
 
-    glGenBuffers(1, &batch_instance_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, batch_instance_vbo);
-    glBufferData(GL_ARRAY_BUFFER, SPRITE_BATCH_MAX_SPRITES*sizeof(Sprite), NULL, GL_STREAM_DRAW);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(0)); // model[0]
-    glVertexAttribDivisor(2, 1);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(16)); // model[1]
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(32)); // model[2]
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(48)); // model[3]
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(64)); // sprite rect
-    glVertexAttribDivisor(6, 1);
-    glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(80)); // color
-    glVertexAttribDivisor(7, 1);
-    glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(Sprite),(const GLvoid*)(92)); // opacity
-    glVertexAttribDivisor(8, 1);
-    glVertexAttribIPointer(9, 1, GL_UNSIGNED_INT, sizeof(Sprite),(const GLvoid*)(96)); // tex unit
-    glVertexAttribDivisor(9, 1);
-    glVertexAttribIPointer(10, 1, GL_UNSIGNED_INT, sizeof(Sprite),(const GLvoid*)(100)); // ignore light
-    glVertexAttribDivisor(10, 1);
-    glVertexAttribIPointer(11, 1, GL_UNSIGNED_INT, sizeof(Sprite),(const GLvoid*)(104)); // blending mode
-    glVertexAttribDivisor(11, 1);
-    glVertexAttribIPointer(12, 1, GL_UNSIGNED_INT, sizeof(Sprite),(const GLvoid*)(108)); // mask_color
-    glVertexAttribDivisor(12, 1);
+    stream_init(&sprite_stream, 4*SPRITE_BATCH_MAX_SPRITES*sizeof(Sprite));
+    sprite_batch_set_instance_attribs(0);
+    for(int i = 2; i <= 7; ++i)
+        glVertexAttribDivisor(i, 1);
+    for(int i = 0; i <= 7; ++i)
+        glEnableVertexAttribArray(i);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 }
 
 static void print_sprite(Sprite* sprite)
 {
     printf("============\n");
     printf("Sprite:\n");
-    printf("  World:\n");
-    printf("  [ %f %f %f %f ]\n", sprite->world1.x,sprite->world1.y, sprite->world1.z, sprite->world1.w);
-    printf("  [ %f %f %f %f ]\n", sprite->world2.x,sprite->world2.y, sprite->world2.z, sprite->world2.w);
-    printf("  [ %f %f %f %f ]\n", sprite->world3.x,sprite->world3.y, sprite->world3.z, sprite->world3.w);
-    printf("  [ %f %f %f %f ]\n", sprite->world4.x,sprite->world4.y, sprite->world4.z, sprite->world4.w);
-    printf("  Rect:");
-    printf("  [ %f %f %f %f ]\n", sprite->rect.x,sprite->rect.y, sprite->rect.w, sprite->rect.h);
-    printf("  Color:");
-    printf("  [ %08X ]\n", sprite->color);
-    printf("  Opacity:");
-    printf("  [ %f ]\n", sprite->opacity);
+    printf("  Pos:      [ %f %f ]\n", sprite->pos.x, sprite->pos.y);
+    printf("  Size:     [ %f %f ]\n", sprite->size.x, sprite->size.y);
+    printf("  Rotation: [ %f ]\n", DEG(sprite->rotation));
+    printf("  Rect:     [ %u %u %u %u ]\n", sprite->rect[0], sprite->rect[1], sprite->rect[2], sprite->rect[3]);
+    printf("  Color:    [ %02X%02X%02X ]\n", sprite->color[0], sprite->color[1], sprite->color[2]);
+    printf("  Opacity:  [ %f ]\n", sprite->color[3]/255.0);
+    printf("  Flags:    [ %08X ]\n", sprite->flags);
 }
 
 // get first row or col that's not empty
@@ -1634,7 +2739,7 @@ static int image_find_first_visible_rowcol(int side, int img_w, int img_h, int i
     return -1;
 }
 
-static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned char* img_data, Rect* ret)
+static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned char* img_data, Rect* ret, double* time)
 {
     Timer _timer = {0};
     timer_begin(&_timer);
@@ -1649,7 +2754,7 @@ static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned cha
         ret->h = 0;
         ret->x = img_w/2.0;
         ret->y = img_h/2.0;
-        vr_time += timer_get_elapsed(&_timer);
+        *time += timer_get_elapsed(&_timer);
         // printf("vr time: %.4f\n", vr_time);
         return;
     }
@@ -1676,15 +2781,27 @@ static void image_get_visible_rect(int img_w, int img_h, int img_n, unsigned cha
     ret->x = (float)left + ret->w/2.0;
     ret->y = (float)top + ret->h/2.0;
 
-    vr_time += timer_get_elapsed(&_timer);
+    *time += timer_get_elapsed(&_timer);
     // printf("vr time: %.4f\n", vr_time);
 }
 
 static void load_font()
 {
+    if(!font_layout_pending)
+        gfx_font_prefetch();
+
     font_image = gfx_load_image("src/core/fonts/atlas.png", false, true, 0, 0);
     LOGI("Font image index: %d",font_image);
 
+    jobs_wait(&font_layout_done);
+    font_layout_pending = false;
+}
+
+// parses the glyph layout into font_chars, nothing reads them until load_font() waits on it
+static void font_layout_job(void* arg)
+{
+    (void)arg;
+
     FILE* fp = fopen("src/core/fonts/atlas_layout.csv","r");
 
     if(!fp)
@@ -35,6 +35,9 @@ typedef struct
     unsigned char* data;
 } GFXImageData;
 
+// called on the main thread as each prefetched image finishes uploading
+typedef void (*gfx_load_progress_cb)(int loaded, int total, const char* path);
+
 typedef struct
 {
     uint32_t texture;
@@ -50,8 +53,19 @@ typedef struct
     Rect* sprite_rects;
 
     uint32_t* avg_color;
+
+    bool linear_filter;
+    int atlas; // -1 when the image has its own texture
 } GFXImage;
 
+// GL work issued since the last gfx_reset_stats()
+typedef struct
+{
+    int draw_calls;
+    int state_changes;     // binds and blend changes the state cache let through
+    uint64_t upload_bytes; // vertex streams, uniform and texture uploads
+} GFXStats;
+
 typedef struct
 {
     int curr_frame;
@@ -82,6 +96,13 @@ void gfx_clear_buffer(uint8_t r, uint8_t g, uint8_t b);
 void gfx_image_init();
 bool gfx_load_image_data(const char* image_path, GFXImageData* image, bool flip);
 int gfx_load_image(const char* image_path, bool flip, bool linear_filter, int element_width, int element_height);
+
+// decodes an image on the job threads, a later gfx_load_image() with the same
+// path, flip and element size waits for it and only does the GL upload
+void gfx_image_prefetch(const char* image_path, bool flip, int element_width, int element_height);
+// parses the font layout on the job threads, gfx_init() waits for it
+void gfx_font_prefetch();
+void gfx_set_load_progress_cb(gfx_load_progress_cb cb);
 int gfx_raw_image_create(unsigned char* data, int width, int height, bool linear_filter);
 void gfx_raw_image_update(int img_index, unsigned char* data, int width, int height);
 
@@ -90,16 +111,18 @@ bool gfx_draw_image_color_mask(int img_index, int sprite_index, float x, float y
 bool gfx_draw_image_ignore_light(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world);
 bool gfx_draw_particle(int img_index, int sprite_index, float x, float y, uint32_t color, float scale, float rotation, float opacity, bool full_image, bool in_world, bool blend_additive);
 GFXImage* gfx_get_image_data(int img_index);
+void gfx_atlas_build(); // call once every image is loaded, later images keep their own texture
 
-// Image Batch Drawing
-bool gfx_sprite_batch_begin(bool in_world);
+// Render Queue
+// Images, particles and filled rects are queued and drawn as instanced batches.
+// Layers draw in ascending order, draws within a layer keep their submission order,
+// whether they are sprites, shapes or text.
+void gfx_set_render_layer(uint8_t layer);
 bool gfx_sprite_batch_add(int img_index, int sprite_index, float x, float y, uint32_t color, bool mask_color, float scale, float rotation, float opacity, bool full_image, bool ignore_light, bool blend_additive) ;
-void gfx_sprite_batch_draw();
+void gfx_flush(); // draws queued sprites and shapes then queued text, immediate draws call it to keep ordering
 
 // Lines
-void gfx_clear_lines();
 void gfx_add_line(float x0, float y0, float x1, float y1, uint32_t color);
-void gfx_draw_lines();
 
 // Shapes
 void gfx_draw_rect(Rect* r, uint32_t color, float rotation, float scale, float opacity, bool filled, bool in_world);
@@ -120,5 +143,7 @@ void gfx_anim_update(GFXAnimation* anim, double delta_t);
 // Misc
 void gfx_color2floats(uint32_t color, float* r, float* g, float* b);
 void gfx_print_times();
+void gfx_get_stats(GFXStats* stats);
+void gfx_reset_stats();
 uint32_t gfx_blend_colors(uint32_t color1, uint32_t color2, float factor);
 void gfx_color_gradient(uint32_t colors[], int num_colors, int steps, uint32_t* ret_colors);
@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "log.h"
 #include "io.h"
+#include "jobs.h"
 #include "imgui.h"
 #include <math.h>
 
@@ -139,6 +140,13 @@ static ImGuiTheme stored_theme;
 static ImGuiContext* ctx;
 static bool theme_initialized = false;
 
+// a theme read ahead on the job threads by imgui_theme_prefetch()
+static ImGuiTheme theme_prefetch;
+static char theme_prefetch_name[32] = {0};
+static bool theme_prefetch_pending = false;
+static bool theme_prefetch_ok = false;
+static JobCounter theme_prefetch_done = {0};
+
 static inline bool is_mouse_inside(int x, int y, int width, int height);
 static inline bool is_highlighted(uint32_t hash);
 static inline bool is_active(uint32_t hash);
@@ -292,20 +300,58 @@ void imgui_set_slider_width(int width)
     theme.slider_width = width;
 }
 
-bool imgui_load_theme(char* file_name)
+static bool read_theme(const char* file_name, ImGuiTheme* out)
 {
     char file_path[64]= {0};
     snprintf(file_path,63,"src/themes/%s",file_name);
     FILE* fp = fopen(file_path,"rb");
-    if(fp)
+    if(!fp)
+        return false;
+
+    size_t n = fread(out,sizeof(ImGuiTheme),1,fp);
+    fclose(fp);
+    return (n > 0);
+}
+
+static void theme_prefetch_job(void* arg)
+{
+    (void)arg;
+    theme_prefetch_ok = read_theme(theme_prefetch_name, &theme_prefetch);
+}
+
+void imgui_theme_prefetch(char* file_name)
+{
+    if(theme_prefetch_pending)
+        return;
+
+    strncpy(theme_prefetch_name, file_name, sizeof(theme_prefetch_name)-1);
+    theme_prefetch_pending = true;
+    jobs_add(theme_prefetch_job, NULL, &theme_prefetch_done);
+}
+
+bool imgui_load_theme(char* file_name)
+{
+    ImGuiTheme loaded;
+    bool success;
+
+    if(theme_prefetch_pending && strcmp(file_name, theme_prefetch_name) == 0)
     {
-        size_t n = fread(&theme,sizeof(ImGuiTheme),1,fp);
-        fclose(fp);
-        bool success = (n > 0);
-        theme_initialized = success;
-        return success;
+        jobs_wait(&theme_prefetch_done);
+        theme_prefetch_pending = false;
+        memcpy(&loaded, &theme_prefetch, sizeof(ImGuiTheme));
+        success = theme_prefetch_ok;
     }
-    return false;
+    else
+    {
+        success = read_theme(file_name, &loaded);
+    }
+
+    if(!success)
+        return false;
+
+    memcpy(&theme, &loaded, sizeof(ImGuiTheme));
+    theme_initialized = true;
+    return true;
 }
 
 void imgui_text(char* text, ...)
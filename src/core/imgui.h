@@ -32,6 +32,8 @@ Vector2f imgui_draw_demo(int x, int y); // for showcasing widgets
 // theme
 void imgui_theme_editor(); // for editing theme properties
 void imgui_theme_selector();
+// reads the theme file on the job threads, a later imgui_load_theme() of it waits instead of reading
+void imgui_theme_prefetch(char* file_name);
 bool imgui_load_theme(char* file_name);
 
 void imgui_store_theme();
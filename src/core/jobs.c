@@ -0,0 +1,170 @@
+#include "headers.h"
+
+#include "atomics.h"
+#include "log.h"
+#include "thread.h"
+#include "jobs.h"
+
+// A fixed pool of worker threads pulling from one mutex guarded FIFO.
+// Meant for coarse work like decoding files at startup, not per frame tasks.
+
+typedef struct
+{
+    job_func func;
+    void* arg;
+    JobCounter* counter;
+} Job;
+
+static Job queue[JOBS_MAX_QUEUED];
+static int queue_head = 0;
+static int queue_count = 0;
+
+static volatile bool running = false;
+static int num_workers = 0;
+
+static Thread workers[JOBS_MAX_THREADS];
+static Mutex queue_lock;
+static Cond queue_cond;
+
+static bool queue_pop(Job* job)
+{
+    if(queue_count == 0)
+        return false;
+
+    *job = queue[queue_head];
+    queue_head = (queue_head+1) % JOBS_MAX_QUEUED;
+    queue_count--;
+    return true;
+}
+
+static void job_run(Job* job)
+{
+    job->func(job->arg);
+    if(job->counter)
+        ATOMIC_ADD64_REL(&job->counter->remaining, -1); // publishes the job's results to jobs_wait()
+}
+
+static void worker_main(void* arg)
+{
+    (void)arg;
+    for(;;)
+    {
+        Job job;
+
+        mutex_lock(&queue_lock);
+        while(running && queue_count == 0)
+            cond_wait(&queue_cond, &queue_lock);
+        bool have_job = queue_pop(&job);
+        mutex_unlock(&queue_lock);
+
+        if(!have_job)
+            break; // shutting down with an empty queue
+
+        job_run(&job);
+    }
+}
+
+static int get_num_cores()
+{
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+bool jobs_init(int num_threads)
+{
+    if(running)
+        return true;
+
+    if(num_threads <= 0)
+        num_threads = get_num_cores() - 1;
+    num_threads = RANGE(num_threads, 0, JOBS_MAX_THREADS);
+
+    mutex_init(&queue_lock);
+    cond_init(&queue_cond);
+
+    queue_head = 0;
+    queue_count = 0;
+    running = true;
+    num_workers = 0;
+
+    for(int i = 0; i < num_threads; ++i)
+    {
+        if(!thread_start(&workers[i], worker_main, NULL))
+            break;
+        num_workers++;
+    }
+
+    LOGI("Job threads: %d", num_workers);
+    return true;
+}
+
+void jobs_deinit()
+{
+    if(!running)
+        return;
+
+    mutex_lock(&queue_lock);
+    running = false;
+    cond_broadcast(&queue_cond);
+    mutex_unlock(&queue_lock);
+
+    // workers drain whatever is still queued before exiting
+    for(int i = 0; i < num_workers; ++i)
+        thread_join(&workers[i]);
+    num_workers = 0;
+
+    cond_deinit(&queue_cond);
+    mutex_deinit(&queue_lock);
+}
+
+void jobs_add(job_func func, void* arg, JobCounter* counter)
+{
+    Job job = {func, arg, counter};
+
+    if(counter)
+        ATOMIC_ADD64(&counter->remaining, 1);
+
+    if(running && num_workers > 0)
+    {
+        mutex_lock(&queue_lock);
+        if(queue_count < JOBS_MAX_QUEUED)
+        {
+            queue[(queue_head+queue_count) % JOBS_MAX_QUEUED] = job;
+            queue_count++;
+            cond_signal(&queue_cond);
+            mutex_unlock(&queue_lock);
+            return;
+        }
+        mutex_unlock(&queue_lock);
+    }
+
+    job_run(&job);
+}
+
+void jobs_wait(JobCounter* counter)
+{
+    while(ATOMIC_LOAD64_ACQ(&counter->remaining) > 0)
+    {
+        Job job;
+        bool have_job = false;
+
+        // without jobs_init() every job ran inline, there is no queue or lock
+        if(running)
+        {
+            mutex_lock(&queue_lock);
+            have_job = queue_pop(&job);
+            mutex_unlock(&queue_lock);
+        }
+
+        if(have_job)
+            job_run(&job);
+        else
+            timer_delay_us(100);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JOBS_MAX_THREADS 8
+#define JOBS_MAX_QUEUED  256
+
+typedef void (*job_func)(void* arg);
+
+// number of outstanding jobs, zero when everything added against it is done
+typedef struct
+{
+    uint64_t remaining;
+} JobCounter;
+
+// num_threads <= 0 picks one less than the number of cores
+bool jobs_init(int num_threads);
+void jobs_deinit();
+
+// without worker threads (or with a full queue) the job runs inline
+void jobs_add(job_func func, void* arg, JobCounter* counter);
+
+// runs queued jobs on the calling thread until the counter reaches zero
+void jobs_wait(JobCounter* counter);
@@ -0,0 +1,269 @@
+#include "headers.h"
+
+#include "atomics.h"
+#include "thread.h"
+#include "log.h"
+
+// Producers format their message into a slot of a bounded lock-free MPSC
+// ring (Vyukov style sequence numbers) and return immediately. A background
+// thread drains the ring to stdout or to a binary log file. When the ring is
+// full the message is dropped and counted rather than blocking the caller.
+
+#define LOG_BINARY_MAGIC   "SMLG"
+#define LOG_BINARY_VERSION 1
+
+typedef struct
+{
+    uint64_t seq;
+    double time;
+    const char* file;
+    int line;
+    uint8_t level;
+    char msg[LOG_MSG_MAX];
+} LogRecord;
+
+int log_level = LOG_LEVEL_VERBOSE;
+
+static LogRecord ring[LOG_RING_SLOTS];
+static uint64_t ring_head = 0; // next slot producers claim
+static uint64_t ring_tail = 0; // next slot the drain thread reads
+static uint64_t ring_dropped = 0;
+
+static volatile bool running = false;
+static Timer log_timer = {0};
+static FILE* binary_file = NULL;
+
+static Thread log_thread;
+
+static const char level_letters[] = "VNIWE";
+
+#if !defined(WIN32)
+static const char* level_colors[] = {LOG_COLOR_V, LOG_COLOR_N, LOG_COLOR_I, LOG_COLOR_W, LOG_COLOR_E};
+#endif
+
+static void log_output(LogRecord* r)
+{
+    if(binary_file)
+    {
+        uint8_t file_len = (uint8_t)MIN(strlen(r->file), 255);
+        uint16_t msg_len = (uint16_t)strlen(r->msg);
+        uint16_t line = (uint16_t)r->line;
+
+        fwrite(&r->time, sizeof(double), 1, binary_file);
+        fwrite(&r->level, sizeof(uint8_t), 1, binary_file);
+        fwrite(&line, sizeof(uint16_t), 1, binary_file);
+        fwrite(&file_len, sizeof(uint8_t), 1, binary_file);
+        fwrite(&msg_len, sizeof(uint16_t), 1, binary_file);
+        fwrite(r->file, 1, file_len, binary_file);
+        fwrite(r->msg, 1, msg_len, binary_file);
+        return;
+    }
+
+#if defined(WIN32)
+    printf("%c [%-10.10s:%4d %7.2f ]: %s\n", level_letters[r->level], r->file, r->line, r->time, r->msg);
+#else
+    const char* color = level_colors[r->level];
+    printf("%s%c" LOG_RESET_COLOR " [" LOG_COLOR(LOG_COLOR_BLUE) "%-10.10s:%4d " LOG_RESET_COLOR "%7.2f ]: %s%s" LOG_RESET_COLOR "\n",
+            color, level_letters[r->level], r->file, r->line, r->time, color, r->msg);
+#endif
+}
+
+static bool log_drain()
+{
+    bool drained = false;
+
+    for(;;)
+    {
+        LogRecord* r = &ring[ring_tail & (LOG_RING_SLOTS-1)];
+        uint64_t seq = ATOMIC_LOAD64_ACQ(&r->seq);
+        if(seq != ring_tail+1)
+            break;
+
+        log_output(r);
+        ATOMIC_STORE64_REL(&r->seq, ring_tail + LOG_RING_SLOTS);
+        ATOMIC_STORE64(&ring_tail, ring_tail+1); // log_flush() polls it from other threads
+        drained = true;
+    }
+
+    uint64_t dropped = ATOMIC_LOAD64(&ring_dropped);
+    if(dropped > 0)
+    {
+        ATOMIC_ADD64(&ring_dropped, -dropped);
+        LogRecord r = {.time = timer_get_elapsed(&log_timer), .file = "log.c", .line = __LINE__, .level = LOG_LEVEL_WARNING};
+        snprintf(r.msg, LOG_MSG_MAX, "Log ring full, dropped %llu messages", (unsigned long long)dropped);
+        log_output(&r);
+    }
+
+    if(drained)
+        fflush(binary_file ? binary_file : stdout);
+
+    return drained;
+}
+
+static void log_thread_main(void* arg)
+{
+    (void)arg;
+    while(running)
+    {
+        if(!log_drain())
+            timer_delay_us(1000);
+    }
+
+    log_drain();
+}
+
+void log_init(int level)
+{
+    timer_begin(&log_timer);
+    log_level = level;
+
+    if(running)
+        return;
+
+    for(int i = 0; i < LOG_RING_SLOTS; ++i)
+        ring[i].seq = i;
+    ring_head = 0;
+    ring_tail = 0;
+
+    running = true;
+
+    if(!thread_start(&log_thread, log_thread_main, NULL))
+        running = false;
+
+    if(running)
+        atexit(log_deinit);
+}
+
+void log_deinit()
+{
+    if(!running)
+        return;
+
+    running = false;
+
+    thread_join(&log_thread);
+
+    if(binary_file)
+    {
+        fclose(binary_file);
+        binary_file = NULL;
+    }
+}
+
+void log_set_level(int level)
+{
+    log_level = RANGE(level, LOG_LEVEL_VERBOSE, LOG_LEVEL_NONE);
+}
+
+int log_get_level()
+{
+    return log_level;
+}
+
+// only call before log_init() or from the thread that owns shutdown
+bool log_set_binary_file(const char* path)
+{
+    FILE* fp = fopen(path, "wb");
+    if(!fp)
+    {
+        LOGW("Failed to open binary log %s", path);
+        return false;
+    }
+
+    uint32_t version = LOG_BINARY_VERSION;
+    fwrite(LOG_BINARY_MAGIC, 1, 4, fp);
+    fwrite(&version, sizeof(uint32_t), 1, fp);
+
+    log_flush();
+    binary_file = fp;
+    return true;
+}
+
+void log_flush()
+{
+    if(!running)
+        return;
+
+    while(ATOMIC_LOAD64(&ring_tail) != ATOMIC_LOAD64(&ring_head))
+        timer_delay_us(100);
+}
+
+void log_write(LogSite* site, int level, const char* file, int line, const char* fmt, ...)
+{
+    double now = timer_get_elapsed(&log_timer);
+
+    // rate limit per call site, races between threads only make the limit approximate
+    int suppressed = 0;
+    if(now - site->window_start >= 1.0)
+    {
+        suppressed = site->suppressed;
+        site->window_start = now;
+        site->count = 0;
+        site->suppressed = 0;
+    }
+
+    if(site->count >= LOG_RATE_LIMIT)
+    {
+        site->suppressed++;
+        return;
+    }
+    site->count++;
+
+    LogRecord local = {0};
+    LogRecord* r = &local;
+    uint64_t pos = 0;
+
+    if(running)
+    {
+        for(;;)
+        {
+            pos = ATOMIC_LOAD64(&ring_head);
+            r = &ring[pos & (LOG_RING_SLOTS-1)];
+            uint64_t seq = ATOMIC_LOAD64_ACQ(&r->seq);
+
+            if(seq == pos)
+            {
+                if(ATOMIC_CAS64(&ring_head, pos, pos+1))
+                    break;
+            }
+            else if(seq < pos)
+            {
+                // full, don't stall the caller
+                ATOMIC_ADD64(&ring_dropped, 1);
+                return;
+            }
+        }
+    }
+
+    r->time = now;
+    r->file = file;
+    r->line = line;
+    r->level = (uint8_t)RANGE(level, LOG_LEVEL_VERBOSE, LOG_LEVEL_ERROR);
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(r->msg, LOG_MSG_MAX, fmt, args);
+    va_end(args);
+
+    if(suppressed > 0 && len >= 0 && len < LOG_MSG_MAX)
+        snprintf(r->msg+len, LOG_MSG_MAX-len, " (%d similar suppressed)", suppressed);
+
+    if(running)
+        ATOMIC_STORE64_REL(&r->seq, pos+1);
+    else
+        log_output(r);
+}
+
+void print_hex(uint8_t* data, int data_len)
+{
+    char data_str[1024] = {0};
+    char byte[4] = {0};
+
+    for(int i = 0; i < data_len && 3*i+3 < 1024; ++i)
+    {
+        sprintf(byte,"%02X ",data[i]);
+        memcpy(data_str+(3*i), byte,3);
+    }
+
+    LOGI("%s",data_str);
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "math2d.h"
 #include "timer.h"
@@ -28,55 +29,49 @@
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
+#define LOG_MSG_MAX     256  // longer messages are truncated
+#define LOG_RING_SLOTS  1024 // must be a power of two
+#define LOG_RATE_LIMIT  10   // messages per call site per second
 
-#if defined(WIN32)
-
-#define LOG_FMT_START(letter)   #letter " [" "%-10.10s:%4d " "%7.2f ]: "
-#define LOG_FMT_END()           "\n"
-#define LOG_FMT(letter, format) LOG_FMT_START(letter) format LOG_FMT_END()
-
-#else
-
-#define LOG_FMT_START(letter)     LOG_COLOR_ ## letter #letter LOG_RESET_COLOR " [" LOG_COLOR(LOG_COLOR_BLUE) "%-10.10s:%4d " LOG_RESET_COLOR "%7.2f ]: " LOG_COLOR_ ## letter
-#define LOG_FMT_END()           LOG_RESET_COLOR "\n"
-#define LOG_FMT(letter, format) LOG_FMT_START(letter) format LOG_FMT_END()
-
-#endif
-
-
-static Timer log_timer = {0};
-static void log_init(int log_level)
-{
-    timer_begin(&log_timer);
-}
-
-static void print_log(char* fmt, ...)
+typedef enum
 {
-    va_list args;
-    va_start(args, fmt);
-    vprintf(fmt, args);
-    va_end(args);
-}
-
-#define LOG(format, ...) print_log(format, __FILENAME__, __LINE__, timer_get_elapsed(&log_timer), ##__VA_ARGS__)
-
-#define LOGE(format,...) LOG(LOG_FMT(E, format), ##__VA_ARGS__) // error
-#define LOGW(format,...) LOG(LOG_FMT(W, format), ##__VA_ARGS__) // warning
-#define LOGI(format,...) LOG(LOG_FMT(I, format), ##__VA_ARGS__) // info
-#define LOGV(format,...) LOG(LOG_FMT(V, format), ##__VA_ARGS__) // verbose
-#define LOGN(format,...) LOG(LOG_FMT(N, format), ##__VA_ARGS__) // network
-
-
-static void print_hex(uint8_t* data, int data_len)
+    LOG_LEVEL_VERBOSE = 0,
+    LOG_LEVEL_NETWORK,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE,
+} LogLevel;
+
+// per call site rate limiting state, one static instance per LOG*() use
+typedef struct
 {
-    char data_str[1024] = {0};
-    char byte[4] = {0};
-
-    for(int i = 0; i < data_len; ++i)
-    {
-        sprintf(byte,"%02X ",data[i]);
-        memcpy(data_str+(3*i), byte,3);
-    }
-
-    LOGI("%s",data_str);
-}
+    double window_start;
+    int count;
+    int suppressed;
+} LogSite;
+
+extern int log_level;
+
+void log_init(int log_level);
+void log_deinit();
+void log_set_level(int level);
+int  log_get_level();
+bool log_set_binary_file(const char* path);
+void log_flush();
+
+void log_write(LogSite* site, int level, const char* file, int line, const char* fmt, ...);
+
+#define LOG(level, format, ...) do { \
+    static LogSite _log_site = {0}; \
+    if((level) >= log_level) \
+        log_write(&_log_site, (level), __FILENAME__, __LINE__, format, ##__VA_ARGS__); \
+} while(0)
+
+#define LOGE(format,...) LOG(LOG_LEVEL_ERROR,   format, ##__VA_ARGS__) // error
+#define LOGW(format,...) LOG(LOG_LEVEL_WARNING, format, ##__VA_ARGS__) // warning
+#define LOGI(format,...) LOG(LOG_LEVEL_INFO,    format, ##__VA_ARGS__) // info
+#define LOGV(format,...) LOG(LOG_LEVEL_VERBOSE, format, ##__VA_ARGS__) // verbose
+#define LOGN(format,...) LOG(LOG_LEVEL_NETWORK, format, ##__VA_ARGS__) // network
+
+void print_hex(uint8_t* data, int data_len);
@@ -60,12 +60,6 @@ typedef struct
     Vector2f tex_coord;
 } Vertex;
 
-typedef struct
-{
-    Vector2f pos;
-    Vector3f color;
-} LinePoint;
-
 typedef struct
 {
     float m[4][4];
@@ -0,0 +1,273 @@
+#include "headers.h"
+#include "log.h"
+#include "socket.h"
+#include "timer.h"
+#include "atomics.h"
+#include "metrics.h"
+
+// Counters, gauges and histograms are updated with relaxed atomics so any
+// thread can record without locking. Registration is expected to happen
+// up front on a single thread.
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+} Histogram;
+
+typedef struct
+{
+    char name[METRIC_NAME_MAX+1];
+    MetricType type;
+    uint64_t value; // counter value or gauge bits
+    Histogram* hist;
+} Metric;
+
+static Metric metrics[MAX_METRICS] = {0};
+static int metrics_count = 0;
+
+static FILE* dump_file = NULL;
+static int stats_socket = -1;
+static Address stats_address = {0};
+static double time_of_last_dump = 0.0;
+
+static char json_buf[16384];
+
+static inline int msb64(uint64_t v)
+{
+#if _WIN32
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+static inline int histogram_bucket(uint64_t value)
+{
+    if(value < METRICS_HIST_SUB_BUCKETS)
+        return (int)value;
+
+    int shift = msb64(value) - METRICS_HIST_SUB_BITS;
+    int sub = (int)(value >> shift) - METRICS_HIST_SUB_BUCKETS;
+    return (shift+1)*METRICS_HIST_SUB_BUCKETS + sub;
+}
+
+static inline uint64_t histogram_bucket_value(int bucket)
+{
+    if(bucket < METRICS_HIST_SUB_BUCKETS)
+        return (uint64_t)bucket;
+
+    int shift = bucket/METRICS_HIST_SUB_BUCKETS - 1;
+    int sub = bucket % METRICS_HIST_SUB_BUCKETS;
+    return (uint64_t)(METRICS_HIST_SUB_BUCKETS + sub) << shift;
+}
+
+static inline bool valid_id(int id, MetricType type)
+{
+    return (id >= 0 && id < metrics_count && metrics[id].type == type);
+}
+
+bool metrics_init(const char* dump_path, uint16_t stats_port)
+{
+    if(dump_path)
+    {
+        dump_file = fopen(dump_path, "a");
+        if(!dump_file)
+        {
+            LOGW("Failed to open metrics file %s", dump_path);
+        }
+    }
+
+    if(stats_port > 0)
+    {
+        if(socket_create(&stats_socket))
+        {
+            stats_address.a = 127;
+            stats_address.b = 0;
+            stats_address.c = 0;
+            stats_address.d = 1;
+            stats_address.port = stats_port;
+        }
+        else
+        {
+            stats_socket = -1;
+        }
+    }
+
+    time_of_last_dump = timer_get_time();
+    return true;
+}
+
+void metrics_deinit()
+{
+    if(dump_file)
+    {
+        fclose(dump_file);
+        dump_file = NULL;
+    }
+
+    if(stats_socket >= 0)
+    {
+        socket_close(stats_socket);
+        stats_socket = -1;
+    }
+
+    for(int i = 0; i < metrics_count; ++i)
+    {
+        if(metrics[i].hist)
+        {
+            free(metrics[i].hist);
+            metrics[i].hist = NULL;
+        }
+    }
+    metrics_count = 0;
+}
+
+int metrics_register(const char* name, MetricType type)
+{
+    for(int i = 0; i < metrics_count; ++i)
+    {
+        if(strncmp(metrics[i].name, name, METRIC_NAME_MAX) == 0)
+            return i;
+    }
+
+    if(metrics_count >= MAX_METRICS)
+    {
+        LOGW("Too many metrics, can't register %s", name);
+        return -1;
+    }
+
+    Metric* m = &metrics[metrics_count];
+    memset(m, 0, sizeof(Metric));
+    strncpy(m->name, name, METRIC_NAME_MAX);
+    m->type = type;
+
+    if(type == METRIC_TYPE_HISTOGRAM)
+    {
+        m->hist = calloc(1, sizeof(Histogram));
+        if(!m->hist)
+            return -1;
+    }
+
+    return metrics_count++;
+}
+
+void metrics_counter_add(int id, uint64_t n)
+{
+    if(!valid_id(id, METRIC_TYPE_COUNTER)) return;
+    ATOMIC_ADD64(&metrics[id].value, n);
+}
+
+void metrics_gauge_set(int id, double value)
+{
+    if(!valid_id(id, METRIC_TYPE_GAUGE)) return;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ATOMIC_STORE64(&metrics[id].value, bits);
+}
+
+void metrics_histogram_record(int id, uint64_t value)
+{
+    if(!valid_id(id, METRIC_TYPE_HISTOGRAM)) return;
+
+    Histogram* h = metrics[id].hist;
+    ATOMIC_ADD64(&h->buckets[histogram_bucket(value)], 1);
+    ATOMIC_ADD64(&h->count, 1);
+    ATOMIC_ADD64(&h->sum, value);
+
+    // racing writers can only lose to a larger max, which is fine
+    if(value > ATOMIC_LOAD64(&h->max))
+        ATOMIC_STORE64(&h->max, value);
+}
+
+uint64_t metrics_histogram_percentile(int id, double percentile)
+{
+    if(!valid_id(id, METRIC_TYPE_HISTOGRAM)) return 0;
+
+    Histogram* h = metrics[id].hist;
+    uint64_t count = ATOMIC_LOAD64(&h->count);
+    if(count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(count * (percentile / 100.0));
+    uint64_t seen = 0;
+
+    for(int i = 0; i < METRICS_HIST_BUCKETS; ++i)
+    {
+        seen += ATOMIC_LOAD64(&h->buckets[i]);
+        if(seen > target)
+            return MIN(histogram_bucket_value(i), ATOMIC_LOAD64(&h->max));
+    }
+
+    return ATOMIC_LOAD64(&h->max);
+}
+
+int metrics_to_json(char* buf, int buf_len)
+{
+    int len = snprintf(buf, buf_len, "{\"time\":%.3f", timer_get_time());
+
+    for(int i = 0; i < metrics_count && len < buf_len; ++i)
+    {
+        Metric* m = &metrics[i];
+        switch(m->type)
+        {
+            case METRIC_TYPE_COUNTER:
+                len += snprintf(buf+len, buf_len-len, ",\"%s\":%llu", m->name, (unsigned long long)ATOMIC_LOAD64(&m->value));
+                break;
+
+            case METRIC_TYPE_GAUGE:
+            {
+                uint64_t bits = ATOMIC_LOAD64(&m->value);
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                len += snprintf(buf+len, buf_len-len, ",\"%s\":%.3f", m->name, value);
+            } break;
+
+            case METRIC_TYPE_HISTOGRAM:
+            {
+                uint64_t count = ATOMIC_LOAD64(&m->hist->count);
+                double mean = count > 0 ? (double)ATOMIC_LOAD64(&m->hist->sum)/count : 0.0;
+                len += snprintf(buf+len, buf_len-len, ",\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+                        m->name,
+                        (unsigned long long)count,
+                        mean,
+                        (unsigned long long)metrics_histogram_percentile(i, 50.0),
+                        (unsigned long long)metrics_histogram_percentile(i, 90.0),
+                        (unsigned long long)metrics_histogram_percentile(i, 99.0),
+                        (unsigned long long)ATOMIC_LOAD64(&m->hist->max));
+            } break;
+        }
+    }
+
+    if(len < buf_len)
+        len += snprintf(buf+len, buf_len-len, "}");
+
+    return MIN(len, buf_len-1);
+}
+
+void metrics_update(double period)
+{
+    double now = timer_get_time();
+    if(now - time_of_last_dump < period)
+        return;
+
+    time_of_last_dump = now;
+
+    int len = metrics_to_json(json_buf, sizeof(json_buf));
+
+    if(dump_file)
+    {
+        fprintf(dump_file, "%s\n", json_buf);
+        fflush(dump_file);
+    }
+
+    if(stats_socket >= 0)
+    {
+        socket_sendto(stats_socket, &stats_address, (uint8_t*)json_buf, len);
+    }
+}
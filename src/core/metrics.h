@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_METRICS 128
+#define METRIC_NAME_MAX 48
+
+// HDR-style log-linear buckets: each power of two is split into sub-buckets
+#define METRICS_HIST_SUB_BITS    4
+#define METRICS_HIST_SUB_BUCKETS (1 << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_BUCKETS     ((64 - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB_BUCKETS)
+
+typedef enum
+{
+    METRIC_TYPE_COUNTER,
+    METRIC_TYPE_GAUGE,
+    METRIC_TYPE_HISTOGRAM,
+} MetricType;
+
+bool metrics_init(const char* dump_path, uint16_t stats_port);
+void metrics_deinit();
+
+// register a metric, returns its id or -1 if the registry is full
+// registering an existing name returns the existing id
+int metrics_register(const char* name, MetricType type);
+
+void metrics_counter_add(int id, uint64_t n);
+void metrics_gauge_set(int id, double value);
+void metrics_histogram_record(int id, uint64_t value);
+
+uint64_t metrics_histogram_percentile(int id, double percentile);
+
+// writes every metric as a single line of JSON, returns the length
+int metrics_to_json(char* buf, int buf_len);
+
+// dumps a JSON line to the file and the local stats endpoint if period seconds have passed
+void metrics_update(double period);
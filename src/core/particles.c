@@ -1,13 +1,15 @@
 #include "headers.h"
+#include <stddef.h>
 #include "gfx.h"
 #include "math2d.h"
 #include "log.h"
 #include "glist.h"
+#include "profiler.h"
 //#include "lighting.h"
 //#include "camera.h"
 #include "particles.h"
 
-#define PARTICLES_EFFECT_VERSION 1
+#define PARTICLES_EFFECT_VERSION 2
 
 ParticleSpawner spawners[MAX_PARTICLE_SPAWNERS] = {0};
 glist* spawner_list;
@@ -15,37 +17,74 @@ glist* spawner_list;
 static int global_id_count = 0;
 int particles_image;
 
+// registered effects, hot constants kept apart from the spawn-time data
+static ParticleEffect effect_defs[MAX_PARTICLE_EFFECTS];
+static ParticleEffectHot effect_hot[MAX_PARTICLE_EFFECTS];
+static ParticleEffectLUT effect_lut[MAX_PARTICLE_EFFECTS];
+static uint8_t effect_priority[MAX_PARTICLE_EFFECTS];
+static int num_effect_defs = 1; // slot 0 stays empty
+
+// share of the particle cap each priority may fill, the rest is kept for higher ones
+static const float priority_share[PARTICLE_PRIORITY_MAX] = {0.5, 0.85, 1.0};
+
+static ParticleStats stats = {.max_particles = PARTICLES_BUDGET_MAX, .throttle = 1.0};
+static bool spawn_failed_warned = false;
+
+// fraction of each burst a priority still emits at the current throttle
+static float emission_scale(int priority)
+{
+    switch(priority)
+    {
+        case PARTICLE_PRIORITY_LOW:
+            return (stats.throttle - PARTICLES_THROTTLE_MIN)/(1.0 - PARTICLES_THROTTLE_MIN);
+        case PARTICLE_PRIORITY_NORMAL:
+            return MIN(1.0, stats.throttle*2.0);
+        default:
+            return 1.0;
+    }
+}
+
 static void emit_particle(ParticleSpawner* s)
 {
-    if(list_is_full(s->particle_list))
+    int priority = effect_priority[s->effect];
+    if(list_is_full(s->particle_list) || stats.alive >= stats.max_particles*priority_share[priority])
     {
-        LOGW("Too many particles!");
+        stats.particles_dropped++;
         return;
     }
+    stats.alive++;
     Particle* p = &s->particles[s->particle_list->count++];
+    const ParticleEffect* e = &effect_defs[s->effect];
 
     float angle = RAD((float)RAND_RANGE(0,360));
-    float mag = RAND_FLOAT(0.0,s->effect.spawn_radius_max) + s->effect.spawn_radius_min;
+    float mag = RAND_FLOAT(0.0,e->spawn_radius_max) + e->spawn_radius_min;
 
     float x_offset = mag*cos(angle);
     float y_offset = mag*sin(angle);
 
     p->pos.x = s->pos.x + x_offset;
     p->pos.y = s->pos.y + y_offset;
-    p->vel.x = RAND_FLOAT(s->effect.velocity_x.init_min, s->effect.velocity_x.init_max);
-    p->vel.y = RAND_FLOAT(s->effect.velocity_y.init_min, s->effect.velocity_y.init_max);
-    p->color = s->effect.color1;
-    p->rotation = RAND_FLOAT(s->effect.rotation_init_min, s->effect.rotation_init_max);
-    p->angular_vel = RAND_FLOAT(s->effect.angular_vel.init_min, s->effect.angular_vel.init_max);
-    p->scale = RAND_FLOAT(s->effect.scale.init_min, s->effect.scale.init_max);
-    p->opacity = RAND_FLOAT(s->effect.opacity.init_min, s->effect.opacity.init_max);
-    p->life_max = RAND_FLOAT(s->effect.life.init_min, s->effect.life.init_max);
+    p->vel.x = RAND_FLOAT(e->velocity_x.init_min, e->velocity_x.init_max);
+    p->vel.y = RAND_FLOAT(e->velocity_y.init_min, e->velocity_y.init_max);
+    p->color = s->overrides.use_color ? s->overrides.color : e->color1;
+    p->rotation = RAND_FLOAT(e->rotation_init_min, e->rotation_init_max);
+    p->angular_vel = RAND_FLOAT(e->angular_vel.init_min, e->angular_vel.init_max);
+    p->scale = RAND_FLOAT(e->scale.init_min, e->scale.init_max);
+    p->opacity = RAND_FLOAT(e->opacity.init_min, e->opacity.init_max);
+    p->life_max = RAND_FLOAT(e->life.init_min, e->life.init_max);
     p->life = 0.0;
+
+    if(s->overrides.scale > 0.0)
+        p->scale *= s->overrides.scale;
+
+    p->scale_init = p->scale;
+    p->opacity_init = p->opacity;
 }
 
 static void delete_particle(ParticleSpawner* spawner, int index)
 {
     list_remove(spawner->particle_list, index);
+    stats.alive--;
 }
 
 static int get_id()
@@ -81,7 +120,7 @@ void print_particle(Particle* p)
     printf("===================\n");
 }
 
-void print_particle_effect(ParticleEffect* e)
+void print_particle_effect(const ParticleEffect* e)
 {
     printf("===================\n");
     printf("Particle Effect:\n");
@@ -108,8 +147,39 @@ void print_particle_effect(ParticleEffect* e)
 
 void delete_spawner(int index)
 {
+    stats.alive -= spawners[index].particle_list->count;
     list_delete(spawners[index].particle_list);
     list_remove(spawner_list, index);
+
+    // the spawner moved into this slot still points at its old particle array
+    if(index < spawner_list->count)
+        spawners[index].particle_list->buf = spawners[index].particles;
+}
+
+// the lowest priority mortal spawner below priority, closest to the end of its life
+static int find_spawner_to_shed(int priority)
+{
+    int best = -1;
+    int best_priority = priority;
+    float best_age = 0.0;
+
+    for(int i = 0; i < spawner_list->count; ++i)
+    {
+        ParticleSpawner* s = &spawners[i];
+        if(!s->mortal)
+            continue;
+
+        int p = effect_priority[s->effect];
+        float age = s->dead ? 2.0 : s->life/s->life_max;
+
+        if(p < best_priority || (p == best_priority && best != -1 && age > best_age))
+        {
+            best = i;
+            best_priority = p;
+            best_age = age;
+        }
+    }
+    return best;
 }
 
 void particles_show_spawner(int id, bool show)
@@ -128,7 +198,106 @@ void particles_init()
     particles_image = gfx_load_image("src/img/particles.png", false, true, 32, 32);
 }
 
-ParticleSpawner* particles_spawn_effect(float x, float y, int z, ParticleEffect* effect, float lifetime, bool in_world, bool hidden)
+static float curve_sample(const ParticleCurve* curve, float t)
+{
+    float x = t*(PARTICLE_CURVE_POINTS-1);
+    int i = MIN((int)x, PARTICLE_CURVE_POINTS-2);
+    return lerp(curve->points[i], curve->points[i+1], x - i);
+}
+
+static void build_effect_hot(ParticleEffectHot* hot, const ParticleEffect* e)
+{
+    hot->life_rate = e->life.rate;
+    hot->scale_rate = e->scale.rate;
+    hot->angular_vel_rate = e->angular_vel.rate;
+    hot->opacity_rate = e->opacity.rate;
+    hot->velocity_x_rate = e->velocity_x.rate;
+    hot->velocity_y_rate = e->velocity_y.rate;
+    hot->sprite_index = e->sprite_index;
+    hot->use_scale_curve = e->use_scale_curve;
+    hot->use_opacity_curve = e->use_opacity_curve;
+}
+
+static void build_effect_lut(ParticleEffectLUT* lut, const ParticleEffect* e)
+{
+    float c[3][3];
+    gfx_color2floats(e->color1, &c[0][0], &c[0][1], &c[0][2]);
+    gfx_color2floats(e->color2, &c[1][0], &c[1][1], &c[1][2]);
+    gfx_color2floats(e->color3, &c[2][0], &c[2][1], &c[2][2]);
+
+    for(int i = 0; i < PARTICLE_LUT_SIZE; ++i)
+    {
+        float life_factor = (float)i/(PARTICLE_LUT_SIZE-1);
+
+        // color1 to color2 over the first half of life, color2 to color3 over the second
+        const float* c0 = life_factor >= 0.5 ? c[1] : c[0];
+        const float* c1 = life_factor >= 0.5 ? c[2] : c[1];
+        float t = life_factor >= 0.5 ? (life_factor-0.5)*2.0 : life_factor*2.0;
+
+        lut->color[i] = COLOR2(lerp(c0[0],c1[0],t),lerp(c0[1],c1[1],t),lerp(c0[2],c1[2],t));
+        lut->scale[i] = curve_sample(&e->scale_curve, life_factor);
+        lut->opacity[i] = curve_sample(&e->opacity_curve, life_factor);
+    }
+}
+
+int particles_register_effect(ParticleEffect* effect)
+{
+    if(num_effect_defs >= MAX_PARTICLE_EFFECTS)
+    {
+        LOGW("Too many particle effects!");
+        return 0;
+    }
+
+    int handle = num_effect_defs++;
+    effect_priority[handle] = PARTICLE_PRIORITY_NORMAL;
+    particles_update_effect(handle, effect);
+    return handle;
+}
+
+void particles_update_effect(int handle, ParticleEffect* effect)
+{
+    if(handle <= 0 || handle >= num_effect_defs)
+        return;
+
+    memcpy(&effect_defs[handle], effect, sizeof(ParticleEffect));
+    effect_defs[handle].version = PARTICLES_EFFECT_VERSION;
+    build_effect_hot(&effect_hot[handle], &effect_defs[handle]);
+    build_effect_lut(&effect_lut[handle], &effect_defs[handle]);
+}
+
+const ParticleEffect* particles_get_effect(int handle)
+{
+    if(handle < 0 || handle >= num_effect_defs)
+        handle = 0;
+    return &effect_defs[handle];
+}
+
+void particles_set_effect_priority(int handle, ParticlePriority priority)
+{
+    if(handle <= 0 || handle >= num_effect_defs)
+        return;
+    effect_priority[handle] = RANGE(priority, 0, PARTICLE_PRIORITY_MAX-1);
+}
+
+void particles_set_max(int max_particles)
+{
+    stats.max_particles = MAX(0, max_particles);
+}
+
+void particles_budget_update(double frame_work, double frame_time)
+{
+    if(frame_work > frame_time*PARTICLES_BUDGET_LOAD)
+        stats.throttle = MAX(stats.throttle - PARTICLES_THROTTLE_DROP, PARTICLES_THROTTLE_MIN);
+    else
+        stats.throttle = MIN(stats.throttle + PARTICLES_THROTTLE_RISE, 1.0);
+}
+
+ParticleStats particles_get_stats()
+{
+    return stats;
+}
+
+ParticleSpawner* particles_spawn_effect(float x, float y, int z, int effect, ParticleOverrides* overrides, float lifetime, bool in_world, bool hidden)
 {
     if(!spawner_list)
     {
@@ -136,30 +305,42 @@ ParticleSpawner* particles_spawn_effect(float x, float y, int z, ParticleEffect*
         return NULL;
     }
 
+    if(effect < 0 || effect >= num_effect_defs)
+        effect = 0;
+
     if(list_is_full(spawner_list))
     {
-        LOGW("Too many spawners!");
-        return NULL;
+        int shed = find_spawner_to_shed(effect_priority[effect]);
+        if(shed == -1)
+        {
+            stats.spawns_failed++;
+            if(!spawn_failed_warned)
+                LOGW("Too many spawners! (%d)", MAX_PARTICLE_SPAWNERS);
+            spawn_failed_warned = true;
+            return NULL;
+        }
+        delete_spawner(shed);
+        stats.spawners_shed++;
     }
+    spawn_failed_warned = false;
 
     ParticleSpawner* spawner = &spawners[spawner_list->count++];
 
-    memset(spawner,0,sizeof(ParticleSpawner));
+    // only the header, the particles array is filled as particles are emitted
+    memset(spawner,0,offsetof(ParticleSpawner,particles));
 
     spawner->particle_list = list_create(spawner->particles,MAX_PARTICLES_PER_SPAWNER,sizeof(Particle));
 
-    if(effect)
-    {
-        memcpy(&spawner->effect, effect, sizeof(ParticleEffect));
-    }
+    if(overrides)
+        spawner->overrides = *overrides;
 
-    spawner->effect.version = PARTICLES_EFFECT_VERSION;
+    spawner->effect = effect;
     spawner->id = get_id();
     spawner->pos.x = x;
     spawner->pos.y = y;
     spawner->z = z;
     spawner->in_world = in_world;
-    spawner->spawn_time_max = RAND_FLOAT(spawner->effect.spawn_time_min, spawner->effect.spawn_time_max);
+    spawner->spawn_time_max = RAND_FLOAT(effect_defs[effect].spawn_time_min, effect_defs[effect].spawn_time_max);
     spawner->spawn_time = spawner->spawn_time_max;
     spawner->hidden = hidden;
     spawner->mortal = (lifetime > 0.0);
@@ -172,11 +353,10 @@ ParticleSpawner* particles_spawn_effect(float x, float y, int z, ParticleEffect*
 
 void particles_respawn_effect(ParticleSpawner* spawner, float x, float y, float lifetime, bool in_world, bool hidden)
 {
-    spawner->effect.version = PARTICLES_EFFECT_VERSION;
     spawner->pos.x = x;
     spawner->pos.y = y;
     spawner->in_world = in_world;
-    spawner->spawn_time_max = RAND_FLOAT(spawner->effect.spawn_time_min, spawner->effect.spawn_time_max);
+    spawner->spawn_time_max = RAND_FLOAT(effect_defs[spawner->effect].spawn_time_min, effect_defs[spawner->effect].spawn_time_max);
     spawner->spawn_time = spawner->spawn_time_max;
     spawner->hidden = hidden;
     spawner->mortal = (lifetime > 0.0);
@@ -198,6 +378,13 @@ void particles_update(double delta_t)
 {
     if(spawner_list == NULL) return;
 
+    PROFILE_BEGIN("particles_update");
+
+    // recounted each update so spawners removed outside this file can't skew the budget
+    stats.alive = 0;
+    for(int i = 0; i < spawner_list->count; ++i)
+        stats.alive += spawners[i].particle_list->count;
+
     for(int i = spawner_list->count-1; i >= 0; --i)
     {
         ParticleSpawner* spawner = &spawners[i];
@@ -205,13 +392,16 @@ void particles_update(double delta_t)
         if(spawner->hidden)
             continue;
 
+        const ParticleEffectHot* hot = &effect_hot[spawner->effect];
+        const ParticleEffectLUT* lut = &effect_lut[spawner->effect];
+
         for(int j = spawner->particle_list->count-1; j >= 0; --j)
         {
             // update each particle
             Particle* p = &spawner->particles[j];
 
             // update life
-            p->life += delta_t*(spawner->effect.life.rate);
+            p->life += delta_t*(hot->life_rate);
 
             // check for death
             if(p->life >= p->life_max)
@@ -220,28 +410,26 @@ void particles_update(double delta_t)
                 continue;
             }
 
-            // update params
-            p->scale    += delta_t*(spawner->effect.scale.rate);
-            p->angular_vel += delta_t*(spawner->effect.angular_vel.rate);
-            p->opacity  += delta_t*(spawner->effect.opacity.rate);
-            p->vel.x    += delta_t*(spawner->effect.velocity_x.rate);
-            p->vel.y    += delta_t*(spawner->effect.velocity_y.rate);
+            int index = RANGE((int)((p->life / p->life_max)*(PARTICLE_LUT_SIZE-1) + 0.5), 0, PARTICLE_LUT_SIZE-1);
 
-            float r1,g1,b1;
-            float r2,g2,b2;
-            float r3,g3,b3;
+            // update params
+            if(hot->use_scale_curve)
+                p->scale = p->scale_init*lut->scale[index];
+            else
+                p->scale += delta_t*(hot->scale_rate);
 
-            gfx_color2floats(spawner->effect.color1, &r1, &g1, &b1);
-            gfx_color2floats(spawner->effect.color2, &r2, &g2, &b2);
-            gfx_color2floats(spawner->effect.color3, &r3, &g3, &b3);
+            if(hot->use_opacity_curve)
+                p->opacity = p->opacity_init*lut->opacity[index];
+            else
+                p->opacity += delta_t*(hot->opacity_rate);
 
-            float life_factor = (p->life / p->life_max);
+            p->angular_vel += delta_t*(hot->angular_vel_rate);
+            p->vel.x    += delta_t*(hot->velocity_x_rate);
+            p->vel.y    += delta_t*(hot->velocity_y_rate);
 
-            float r = life_factor >= 0.5 ?  lerp(r2,r3,(life_factor-0.5)*2.0) : lerp(r1,r2,life_factor*2.0);
-            float g = life_factor >= 0.5 ?  lerp(g2,g3,(life_factor-0.5)*2.0) : lerp(g1,g2,life_factor*2.0);
-            float b = life_factor >= 0.5 ?  lerp(b2,b3,(life_factor-0.5)*2.0) : lerp(b1,b2,life_factor*2.0);
+            if(!spawner->overrides.use_color)
+                p->color = lut->color[index];
 
-            p->color = COLOR2(r,g,b);
             p->rotation += p->angular_vel*delta_t;
 
             // update position
@@ -274,11 +462,24 @@ void particles_update(double delta_t)
             if(spawner->spawn_time >= spawner->spawn_time_max)
             {
                 spawner->spawn_time = 0.0;
-                spawner->spawn_time_max = RAND_FLOAT(spawner->effect.spawn_time_min, spawner->effect.spawn_time_max);
+                const ParticleEffect* e = &effect_defs[spawner->effect];
+                spawner->spawn_time_max = RAND_FLOAT(e->spawn_time_min, e->spawn_time_max);
+
+                int burst_count = e->burst_count_min;
+                if(e->burst_count_min < e->burst_count_max)
+                    burst_count = RAND_RANGE(e->burst_count_min,e->burst_count_max);
 
-                int burst_count = spawner->effect.burst_count_min;
-                if(spawner->effect.burst_count_min < spawner->effect.burst_count_max)
-                    burst_count = RAND_RANGE(spawner->effect.burst_count_min,spawner->effect.burst_count_max);
+                float scale = emission_scale(effect_priority[spawner->effect]);
+                if(scale < 1.0)
+                {
+                    // stochastic rounding keeps the average rate at low burst counts
+                    float n = burst_count*scale;
+                    int kept = (int)n;
+                    if(RAND_FLOAT(0.0,1.0) < n - kept)
+                        kept++;
+                    stats.particles_dropped += MAX(0, burst_count - kept);
+                    burst_count = kept;
+                }
 
                 burst_count = MAX(0, burst_count);
                 for(int i = 0; i < burst_count; ++i)
@@ -288,22 +489,26 @@ void particles_update(double delta_t)
             }
         }
     }
+
+    PROFILE_END();
 }
 
-void particles_draw_spawner(ParticleSpawner* spawner, bool ignore_light, bool add_to_existing_batch)
+void particles_draw_spawner(ParticleSpawner* spawner, bool ignore_light)
 {
     if(spawner == NULL) return;
 
-    if(spawner->effect.use_sprite)
+    const ParticleEffect* e = &effect_defs[spawner->effect];
+
+    if(e->use_sprite)
     {
-        if(!add_to_existing_batch) gfx_sprite_batch_begin(spawner->in_world);
-            
+        int sprite_index = effect_hot[spawner->effect].sprite_index;
+        bool blend_additive = e->blend_additive;
+
         for(int j = 0; j < spawner->particle_list->count; ++j)
         {
             Particle* p = &spawner->particles[j];
-            gfx_sprite_batch_add(particles_image, spawner->effect.sprite_index, p->pos.x, p->pos.y, p->color, false, p->scale, p->rotation, p->opacity, false,ignore_light,spawner->effect.blend_additive);
+            gfx_sprite_batch_add(particles_image, sprite_index, p->pos.x, p->pos.y, p->color, false, p->scale, p->rotation, p->opacity, false,ignore_light,blend_additive);
         }
-        if(!add_to_existing_batch) gfx_sprite_batch_draw();
     }
     else
     {
@@ -342,7 +547,7 @@ void particles_draw()
         if(spawner->hidden)
             continue;
 
-        particles_draw_spawner(spawner, false, false);
+        particles_draw_spawner(spawner, false);
     }
 }
 
@@ -360,6 +565,6 @@ void particles_draw_layer(int z)
         if(spawner->z != z)
             continue;
 
-        particles_draw_spawner(spawner, false, false);
+        particles_draw_spawner(spawner, false);
     }
 }
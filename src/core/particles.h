@@ -6,6 +6,34 @@
 
 #define MAX_PARTICLE_SPAWNERS 200
 #define MAX_PARTICLES_PER_SPAWNER 500
+#define MAX_PARTICLE_EFFECTS 64 // registered effects, handle 0 is an empty effect
+#define PARTICLE_CURVE_POINTS 4   // evenly spaced over a particle's life
+#define PARTICLE_LUT_SIZE 64      // samples over a particle's life, built when an effect is registered
+
+#define PARTICLES_BUDGET_MAX      20000 // live particles across every spawner
+#define PARTICLES_BUDGET_LOAD     0.8   // throttle once frame work passes this share of the frame time
+#define PARTICLES_THROTTLE_MIN    0.1
+#define PARTICLES_THROTTLE_DROP   0.05  // per frame over the load target
+#define PARTICLES_THROTTLE_RISE   0.01  // per frame under it
+
+// higher priorities keep emitting longer when the budget is tight
+typedef enum
+{
+    PARTICLE_PRIORITY_LOW,    // ambient, e.g. jets and smoke
+    PARTICLE_PRIORITY_NORMAL,
+    PARTICLE_PRIORITY_HIGH,   // gameplay feedback, e.g. explosions and heals
+    PARTICLE_PRIORITY_MAX,
+} ParticlePriority;
+
+typedef struct
+{
+    int alive;
+    int max_particles;
+    float throttle;             // 1.0 is full emission
+    uint64_t particles_dropped; // emissions skipped by the cap or the throttle
+    uint64_t spawners_shed;     // lower priority spawners removed to make room
+    uint64_t spawns_failed;
+} ParticleStats;
 
 typedef struct
 {
@@ -14,6 +42,12 @@ typedef struct
     float rate;
 } ParticleParam;
 
+// piecewise linear multiplier over normalized life, from birth to death
+typedef struct
+{
+    float points[PARTICLE_CURVE_POINTS];
+} ParticleCurve;
+
 typedef struct
 {
     uint8_t version;
@@ -44,8 +78,45 @@ typedef struct
 
     char name[100];
 
+    // version 2, older files end before these and load with the curves off
+    ParticleCurve scale_curve;   // replaces scale.rate when enabled
+    ParticleCurve opacity_curve; // replaces opacity.rate when enabled
+    bool use_scale_curve;
+    bool use_opacity_curve;
+
 } ParticleEffect;
 
+// the constants particles_update() reads for every particle, small enough
+// that one effect's worth fits a cache line
+typedef struct
+{
+    float life_rate;
+    float scale_rate;
+    float angular_vel_rate;
+    float opacity_rate;
+    float velocity_x_rate;
+    float velocity_y_rate;
+    int sprite_index;
+    bool use_scale_curve;
+    bool use_opacity_curve;
+} ParticleEffectHot;
+
+// an effect's color gradient and curves sampled over normalized life
+typedef struct
+{
+    uint32_t color[PARTICLE_LUT_SIZE];
+    float scale[PARTICLE_LUT_SIZE];
+    float opacity[PARTICLE_LUT_SIZE];
+} ParticleEffectLUT;
+
+// per spawn changes that don't need their own registered effect
+typedef struct
+{
+    uint32_t color;  // replaces the effect's color gradient when use_color is set
+    bool use_color;
+    float scale;     // multiplies the initial particle scale, 0 is treated as 1
+} ParticleOverrides;
+
 typedef struct
 {
     Vector2f pos;
@@ -55,6 +126,8 @@ typedef struct
     float rotation;
     float scale;
     float opacity;
+    float scale_init;   // what the curves multiply
+    float opacity_init;
     float life;
     float life_max;
 } Particle;
@@ -64,7 +137,8 @@ typedef struct
     int id;
     Vector2f pos;
     int z;
-    ParticleEffect effect;
+    int effect; // handle from particles_register_effect()
+    ParticleOverrides overrides;
     float life;
     float life_max;
     float spawn_time;
@@ -83,7 +157,21 @@ extern ParticleSpawner spawners[MAX_PARTICLE_SPAWNERS];
 extern glist* spawner_list;
 
 void particles_init();
-ParticleSpawner* particles_spawn_effect(float x, float y, int z, ParticleEffect* effect, float lifetime, bool in_world, bool hidden);
+
+// effects are copied into the library once, spawners refer to them by handle
+int particles_register_effect(ParticleEffect* effect);
+void particles_update_effect(int handle, ParticleEffect* effect);
+const ParticleEffect* particles_get_effect(int handle);
+void particles_set_effect_priority(int handle, ParticlePriority priority);
+
+// overrides PARTICLES_BUDGET_MAX, set from the --max-particles argument
+void particles_set_max(int max_particles);
+// frame_work is the CPU time of the last frame, excluding the wait for the next one
+void particles_budget_update(double frame_work, double frame_time);
+ParticleStats particles_get_stats();
+
+// overrides can be NULL
+ParticleSpawner* particles_spawn_effect(float x, float y, int z, int effect, ParticleOverrides* overrides, float lifetime, bool in_world, bool hidden);
 ParticleSpawner* get_spawner_by_id(int id);
 void particles_respawn_effect(ParticleSpawner* spawner, float x, float y, float lifetime, bool in_world, bool hidden);
 void particles_clear(ParticleSpawner* spawner);
@@ -91,7 +179,7 @@ void particles_update(double delta_t);
 void particles_show_spawner(int id, bool show);
 void particles_draw();
 void particles_draw_layer(int z);
-void particles_draw_spawner(ParticleSpawner* spawner, bool ignore_light, bool add_to_existing_batch);
+void particles_draw_spawner(ParticleSpawner* spawner, bool ignore_light);
 
 void print_particle(Particle* p);
-void print_particle_effect(ParticleEffect* e);
+void print_particle_effect(const ParticleEffect* e);
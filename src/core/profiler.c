@@ -0,0 +1,267 @@
+#include "headers.h"
+#include "log.h"
+#include "timer.h"
+#include "imgui.h"
+#include "atomics.h"
+#include "profiler.h"
+
+// Zones are recorded into a ring owned by the calling thread, so recording
+// never takes a lock. Exporting reads the rings while they may still be
+// written to, which at worst tears the few newest events. Each thread also
+// keeps its own overlay stats, the overlay copies them under a spin lock.
+
+#if _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef struct
+{
+    const char* name;
+    uint64_t start; // us
+    uint64_t dur;   // us
+    uint16_t depth;
+} ProfileEvent;
+
+typedef struct
+{
+    const char* name;
+    uint16_t depth;
+    double ms;     // smoothed per frame
+    double ms_max; // worst frame since the overlay was last reset
+} ZoneStats;
+
+typedef struct
+{
+    int tid;
+    ProfileEvent events[PROFILER_EVENTS];
+    uint64_t event_count; // total recorded, index is event_count % PROFILER_EVENTS
+    uint64_t frame_start; // event_count at the prior profiler_frame_end()
+
+    ProfileEvent stack[PROFILER_STACK_MAX];
+    int depth;
+
+    // written by profiler_frame_end() on this thread, read by the overlay
+    uint64_t stats_lock;
+    ZoneStats zone_stats[PROFILER_MAX_ZONES];
+    int zone_stats_count;
+    double frame_ms;
+} ProfileThread;
+
+static ProfileThread* threads[PROFILER_MAX_THREADS] = {0};
+static uint64_t thread_count = 0;
+static THREAD_LOCAL ProfileThread* local = NULL;
+
+
+static inline uint64_t profiler_time_us()
+{
+    return (uint64_t)(timer_get_time()*1000000.0);
+}
+
+static void stats_lock(ProfileThread* t)
+{
+    while(!ATOMIC_CAS64(&t->stats_lock, 0, 1))
+        ;
+}
+
+static void stats_unlock(ProfileThread* t)
+{
+    ATOMIC_STORE64_REL(&t->stats_lock, 0);
+}
+
+static ProfileThread* get_thread()
+{
+    if(local)
+        return local;
+
+    uint64_t index = ATOMIC_ADD64(&thread_count, 1);
+    if(index >= PROFILER_MAX_THREADS)
+        return NULL;
+
+    ProfileThread* t = calloc(1, sizeof(ProfileThread));
+    if(!t)
+        return NULL;
+
+    t->tid = (int)index;
+    threads[index] = t;
+    local = t;
+    return t;
+}
+
+void profiler_zone_begin(const char* name)
+{
+    ProfileThread* t = get_thread();
+    if(!t) return;
+
+    if(t->depth < PROFILER_STACK_MAX)
+    {
+        ProfileEvent* e = &t->stack[t->depth];
+        e->name = name;
+        e->depth = t->depth;
+        e->start = profiler_time_us();
+    }
+    t->depth++;
+}
+
+void profiler_zone_end()
+{
+    ProfileThread* t = get_thread();
+    if(!t) return;
+
+    if(t->depth == 0)
+    {
+        LOGW("Profiler zone end without a begin");
+        return;
+    }
+
+    t->depth--;
+    if(t->depth >= PROFILER_STACK_MAX)
+        return;
+
+    ProfileEvent* e = &t->stack[t->depth];
+    e->dur = profiler_time_us() - e->start;
+
+    memcpy(&t->events[t->event_count % PROFILER_EVENTS], e, sizeof(ProfileEvent));
+    ATOMIC_STORE64_REL(&t->event_count, t->event_count+1);
+}
+
+void profiler_frame_end()
+{
+    ProfileThread* t = get_thread();
+    if(!t) return;
+
+    uint64_t start = MAX(t->frame_start, t->event_count > PROFILER_EVENTS ? t->event_count - PROFILER_EVENTS : 0);
+
+    double ms[PROFILER_MAX_ZONES] = {0};
+    double total = 0.0;
+
+    stats_lock(t);
+
+    for(uint64_t i = start; i < t->event_count; ++i)
+    {
+        ProfileEvent* e = &t->events[i % PROFILER_EVENTS];
+
+        int z = 0;
+        for(; z < t->zone_stats_count; ++z)
+        {
+            if(t->zone_stats[z].name == e->name)
+                break;
+        }
+
+        if(z == t->zone_stats_count)
+        {
+            if(t->zone_stats_count >= PROFILER_MAX_ZONES)
+                continue;
+
+            t->zone_stats[z].name = e->name;
+            t->zone_stats[z].depth = e->depth;
+            t->zone_stats_count++;
+        }
+
+        ms[z] += e->dur / 1000.0;
+        if(e->depth == 0)
+            total += e->dur / 1000.0;
+    }
+
+    for(int z = 0; z < t->zone_stats_count; ++z)
+    {
+        ZoneStats* zs = &t->zone_stats[z];
+        zs->ms += (ms[z] - zs->ms) * 0.05;
+        zs->ms_max = MAX(zs->ms_max, ms[z]);
+    }
+    t->frame_ms += (total - t->frame_ms) * 0.05;
+
+    stats_unlock(t);
+
+    t->frame_start = t->event_count;
+}
+
+bool profiler_export_chrome_trace(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if(!fp)
+    {
+        LOGW("Failed to open trace file %s", path);
+        return false;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    int num_threads = (int)MIN(ATOMIC_LOAD64(&thread_count), PROFILER_MAX_THREADS);
+
+    for(int i = 0; i < num_threads; ++i)
+    {
+        ProfileThread* t = threads[i];
+        if(!t) continue;
+
+        uint64_t count = ATOMIC_LOAD64_ACQ(&t->event_count);
+        uint64_t start = count > PROFILER_EVENTS ? count - PROFILER_EVENTS : 0;
+
+        for(uint64_t j = start; j < count; ++j)
+        {
+            ProfileEvent* e = &t->events[j % PROFILER_EVENTS];
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%d}",
+                    first ? "" : ",\n",
+                    e->name,
+                    (unsigned long long)e->start,
+                    (unsigned long long)e->dur,
+                    t->tid);
+            first = false;
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    LOGI("Wrote profiler trace to %s", path);
+    return true;
+}
+
+void profiler_draw_overlay(int x, int y)
+{
+    ZoneStats stats[PROFILER_MAX_ZONES];
+    int num_threads = (int)MIN(ATOMIC_LOAD64(&thread_count), PROFILER_MAX_THREADS);
+    bool reset_max = false;
+
+    imgui_begin("Profiler", x, y);
+        for(int i = 0; i < num_threads; ++i)
+        {
+            ProfileThread* t = threads[i];
+            if(!t) continue;
+
+            stats_lock(t);
+            int count = t->zone_stats_count;
+            double frame_ms = t->frame_ms;
+            memcpy(stats, t->zone_stats, count*sizeof(ZoneStats));
+            stats_unlock(t);
+
+            // job workers never call profiler_frame_end(), they only show up in traces
+            if(count == 0) continue;
+
+            imgui_text("Thread %d: %6.2f ms", t->tid, frame_ms);
+            imgui_horizontal_line(1);
+            for(int z = 0; z < count; ++z)
+            {
+                ZoneStats* s = &stats[z];
+                imgui_text("%*s%-24s %6.2f ms (max %6.2f)", 2*s->depth, "", s->name, s->ms, s->ms_max);
+            }
+        }
+        reset_max = imgui_button("Reset Max");
+    imgui_end();
+
+    if(!reset_max)
+        return;
+
+    for(int i = 0; i < num_threads; ++i)
+    {
+        ProfileThread* t = threads[i];
+        if(!t) continue;
+
+        stats_lock(t);
+        for(int z = 0; z < t->zone_stats_count; ++z)
+            t->zone_stats[z].ms_max = 0.0;
+        stats_unlock(t);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Set to 0 to compile all zones out (build_release.sh does this)
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#define PROFILER_MAX_THREADS 8
+#define PROFILER_EVENTS      16384 // per thread ring
+#define PROFILER_STACK_MAX   32
+#define PROFILER_MAX_ZONES   32    // zones shown in the overlay
+
+#if PROFILER_ENABLED
+#define PROFILE_BEGIN(name)  profiler_zone_begin(name)
+#define PROFILE_END()        profiler_zone_end()
+#define PROFILE_FRAME_END()  profiler_frame_end()
+#else
+#define PROFILE_BEGIN(name)
+#define PROFILE_END()
+#define PROFILE_FRAME_END()
+#endif
+
+// name must be a string literal or otherwise outlive the profiler
+void profiler_zone_begin(const char* name);
+void profiler_zone_end();
+
+// aggregates zones recorded on the calling thread since the prior call,
+// each thread's stats show up separately in the overlay
+void profiler_frame_end();
+
+bool profiler_export_chrome_trace(const char* path);
+void profiler_draw_overlay(int x, int y);
@@ -1,54 +1,117 @@
 #include "headers.h"
 #include <GL/glew.h>
 
+#include "jobs.h"
+#include "log.h"
 #include "shader.h"
 
 #define SHADER_DIR "src/core/shaders"
 
+#define PROGRAM_BINARY_EXT     ".progbin"
+#define PROGRAM_BINARY_MAGIC   0x42504D53 // "SMPB"
+#define PROGRAM_BINARY_VERSION 1
+
 GLuint program_sprite_batch;
 GLuint program_shape;
-GLuint program_line;
 GLuint program_font;
 
-static void shader_add(GLuint program, GLenum shader_type, const char* shader_file_path);
+typedef struct
+{
+    const char* path;
+    char* buf;
+    int len;
+} ShaderSource;
+
+// header of a cached program binary, the driver's blob follows it
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key; // driver strings and both sources hashed together
+    uint32_t format;
+    uint32_t length;
+} ProgramBinaryHeader;
+
+static void shader_read_job(void* arg);
+static void shader_link(GLuint* p, ShaderSource* vert, ShaderSource* frag);
+static void shader_add(GLuint program, GLenum shader_type, ShaderSource* src);
+static uint64_t program_binary_key(ShaderSource* vert, ShaderSource* frag);
+static bool program_binary_load(GLuint program, const char* cache_path, uint64_t key);
+static void program_binary_save(GLuint program, const char* cache_path, uint64_t key);
 
 void shader_load_all()
 {
-    shader_build_program(&program_sprite_batch,
-        SHADER_DIR "/sprite_batch.vert.glsl",
-        SHADER_DIR "/sprite_batch.frag.glsl"
-    );
-
-    shader_build_program(&program_shape,
-        "src/core/shaders/shape.vert.glsl",
-        "src/core/shaders/shape.frag.glsl"
-    );
-
-    shader_build_program(&program_line,
-        "src/core/shaders/line.vert.glsl",
-        "src/core/shaders/line.frag.glsl"
-    );
-
-    shader_build_program(&program_font,
-        "src/core/shaders/font.vert.glsl",
-        "src/core/shaders/font.frag.glsl"
-    );
+    GLuint* programs[] = {&program_sprite_batch, &program_shape, &program_font};
+
+    ShaderSource sources[][2] =
+    {
+        {{SHADER_DIR "/sprite_batch.vert.glsl"}, {SHADER_DIR "/sprite_batch.frag.glsl"}},
+        {{SHADER_DIR "/shape.vert.glsl"},        {SHADER_DIR "/shape.frag.glsl"}},
+        {{SHADER_DIR "/font.vert.glsl"},         {SHADER_DIR "/font.frag.glsl"}},
+    };
+    int num_programs = sizeof(programs)/sizeof(programs[0]);
+
+    // file reads go to the job threads, compiling has to stay on the context thread
+    JobCounter done = {0};
+    for(int i = 0; i < num_programs; ++i)
+    {
+        jobs_add(shader_read_job, &sources[i][0], &done);
+        jobs_add(shader_read_job, &sources[i][1], &done);
+    }
+    jobs_wait(&done);
+
+    for(int i = 0; i < num_programs; ++i)
+    {
+        shader_link(programs[i], &sources[i][0], &sources[i][1]);
+        free(sources[i][0].buf);
+        free(sources[i][1].buf);
+    }
 }
 
 void shader_deinit()
 {
     glDeleteProgram(program_sprite_batch);
     glDeleteProgram(program_shape);
-    glDeleteProgram(program_line);
     glDeleteProgram(program_font);
 }
 
 void shader_build_program(GLuint* p, const char* vert_shader_path, const char* frag_shader_path)
+{
+    ShaderSource vert = {vert_shader_path};
+    ShaderSource frag = {frag_shader_path};
+
+    shader_read_job(&vert);
+    shader_read_job(&frag);
+
+    shader_link(p, &vert, &frag);
+
+    free(vert.buf);
+    free(frag.buf);
+}
+
+static void shader_link(GLuint* p, ShaderSource* vert, ShaderSource* frag)
 {
 	*p = glCreateProgram();
 
-    shader_add(*p, GL_VERTEX_SHADER,  vert_shader_path);
-    shader_add(*p, GL_FRAGMENT_SHADER,frag_shader_path);
+    // the binary cache sits next to the vertex shader, one file per program
+    bool use_cache = GLEW_ARB_get_program_binary && vert->buf && frag->buf;
+    char cache_path[256] = {0};
+    snprintf(cache_path, sizeof(cache_path), "%s" PROGRAM_BINARY_EXT, vert->path);
+    uint64_t key = 0;
+
+    if(use_cache)
+    {
+        key = program_binary_key(vert, frag);
+        if(program_binary_load(*p, cache_path, key))
+        {
+            LOGI("Loaded program binary: %s", cache_path);
+            return;
+        }
+        glProgramParameteri(*p, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    shader_add(*p, GL_VERTEX_SHADER,  vert);
+    shader_add(*p, GL_FRAGMENT_SHADER,frag);
 
 	glLinkProgram(*p);
 
@@ -62,45 +125,58 @@ void shader_build_program(GLuint* p, const char* vert_shader_path, const char* f
         exit(1);
 	}
 
-    glValidateProgram(*p);
-    glGetProgramiv(*p, GL_VALIDATE_STATUS, &success);
-    if (!success) {
-        GLchar info[1000+1] = {0};
-        glGetProgramInfoLog(*p, 1000, NULL, info);
-        fprintf(stderr, "Invalid shader program: '%s'\n", info);
-        exit(1);
-    }
-
+    if(use_cache)
+        program_binary_save(*p, cache_path, key);
 }
 
-static int read_file(const char* filepath, char* ret_buf, uint32_t max_buffer_size)
+// reads the whole file with a single fread, returns the length or -1
+static int read_file(const char* filepath, char** ret_buf)
 {
-    FILE* fp = fopen(filepath,"r");
-    
+    *ret_buf = NULL;
+
+    FILE* fp = fopen(filepath,"rb");
     if(!fp)
         return -1;
 
-    int c;
-    int i = 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
 
-    for(;;)
+    if(size < 0 || size > MAX_SHADER_LEN)
     {
-        c = fgetc(fp);
-        if(c == EOF)
-            break;
-
-        ret_buf[i++] = c;
+        fclose(fp);
+        return -1;
+    }
 
-        if(i >= max_buffer_size)
-            break;
+    char* buf = malloc(size+1);
+    if(!buf)
+    {
+        fclose(fp);
+        return -1;
     }
 
+    size_t len = fread(buf, 1, size, fp);
     fclose(fp);
 
-    return i;
+    buf[len] = '\0';
+    *ret_buf = buf;
+    return (int)len;
 }
-static void shader_add(GLuint program, GLenum shader_type, const char* shader_file_path)
+
+static void shader_read_job(void* arg)
 {
+    ShaderSource* src = (ShaderSource*)arg;
+
+    src->len = read_file(src->path, &src->buf);
+    if(!src->buf)
+        fprintf(stderr, "Failed to read shader file %s\n", src->path);
+}
+
+static void shader_add(GLuint program, GLenum shader_type, ShaderSource* src)
+{
+    if(!src->buf)
+        return;
+
     // create
 	GLuint shader_id = glCreateShader(shader_type);
     if (!shader_id)
@@ -109,26 +185,17 @@ static void shader_add(GLuint program, GLenum shader_type, const char* shader_fi
         return;
     }
 
-    char* buf = calloc(MAX_SHADER_LEN+1,sizeof(char));
-    if(!buf)
-    {
-        fprintf(stderr, "Failed to malloc shader buffer\n");
-        return;
-    }
-
     // load
-    int len = read_file(shader_file_path,buf, MAX_SHADER_LEN);
-    if(len == 0)
+    if(src->len <= 0)
     {
         printf("Read zero bytes from shader file.\n");
-        free(buf);
         return;
     }
 
 	// compile
-	printf("Compiling shader: %s (size: %d bytes)\n", shader_file_path, len);
+	printf("Compiling shader: %s (size: %d bytes)\n", src->path, src->len);
 
-	glShaderSource(shader_id, 1, (const char**)&buf, NULL);
+	glShaderSource(shader_id, 1, (const char**)&src->buf, NULL);
 	glCompileShader(shader_id);
 
 	// validate
@@ -139,13 +206,113 @@ static void shader_add(GLuint program, GLenum shader_type, const char* shader_fi
         GLchar info[1000+1] = {0};
 		glGetShaderInfoLog(shader_id, 1000, NULL, info);
 		fprintf(stderr,"Error compiling shader type %d: '%s'\n", shader_type, info);
-        free(buf);
         return;
 	}
 
 	glAttachShader(program, shader_id);
+}
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for(size_t i = 0; i < len; ++i)
+    {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+static uint64_t program_binary_key(ShaderSource* vert, ShaderSource* frag)
+{
+    // binaries are only valid for the driver that produced them
+    const GLenum driver_strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for(int i = 0; i < 3; ++i)
+    {
+        const char* str = (const char*)glGetString(driver_strings[i]);
+        if(str)
+            h = hash_bytes(h, str, strlen(str)+1);
+    }
+    h = hash_bytes(h, vert->buf, vert->len);
+    h = hash_bytes(h, frag->buf, frag->len);
+    return h;
+}
+
+static bool program_binary_load(GLuint program, const char* cache_path, uint64_t key)
+{
+    FILE* fp = fopen(cache_path, "rb");
+    if(!fp)
+        return false;
+
+    ProgramBinaryHeader h = {0};
+    bool valid = fread(&h, sizeof(h), 1, fp) == 1 &&
+                 h.magic == PROGRAM_BINARY_MAGIC &&
+                 h.version == PROGRAM_BINARY_VERSION &&
+                 h.key == key && h.length > 0;
+
+    void* binary = valid ? malloc(h.length) : NULL;
+    if(binary)
+        valid = fread(binary, 1, h.length, fp) == h.length;
+    fclose(fp);
+
+    if(!valid || !binary)
+    {
+        free(binary);
+        return false;
+    }
+
+    glProgramBinary(program, h.format, binary, h.length);
+    free(binary);
+
+    // drivers may still reject it, e.g. after an update that kept the version string
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success)
+        LOGW("Program binary %s was rejected, recompiling", cache_path);
+    return success;
+}
+
+static void program_binary_save(GLuint program, const char* cache_path, uint64_t key)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+
+    void* binary = malloc(length);
+    if(!binary)
+        return;
+
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, binary);
+
+    ProgramBinaryHeader h = {PROGRAM_BINARY_MAGIC, PROGRAM_BINARY_VERSION, key, format, (uint32_t)length};
 
-    free(buf);
+    char temp_path[256] = {0};
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+
+    FILE* fp = fopen(temp_path, "wb");
+    if(!fp)
+    {
+        LOGW("Failed to write program binary %s", cache_path);
+        free(binary);
+        return;
+    }
+
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(binary, 1, length, fp);
+    fclose(fp);
+    free(binary);
+
+    remove(cache_path);
+    if(rename(temp_path, cache_path) != 0)
+    {
+        LOGW("Failed to write program binary %s", cache_path);
+        remove(temp_path);
+    }
 }
 
 void shader_set_int(GLuint program, const char* name, int i)
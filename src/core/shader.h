@@ -5,7 +5,6 @@
 
 extern GLuint program_sprite_batch;
 extern GLuint program_shape;
-extern GLuint program_line;
 extern GLuint program_font;
 
 void shader_load_all();
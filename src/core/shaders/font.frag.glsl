@@ -1,10 +1,10 @@
 #version 330 core
 
 in vec2 tex_coord0;
+in vec4 fg_color0;
 out vec4 color;
 
 uniform sampler2D image;
-uniform vec4 fg_color;
 uniform float px_range; // set to distance field's pixel range
 
 float screenPxRange() {
@@ -23,5 +23,5 @@ void main() {
     float screenPxDistance = screenPxRange()*(sd - 0.5);
     float opacity = clamp(screenPxDistance + 0.5, 0.0, 1.0);
 
-    color = vec4(fg_color.rgb, opacity*fg_color.a);
+    color = vec4(fg_color0.rgb, opacity*fg_color0.a);
 }
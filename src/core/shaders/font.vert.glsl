@@ -2,16 +2,22 @@
 
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 tex_coord;
+layout (location = 2) in vec4 fg_color;
 
 out vec2 tex_coord0;
+out vec4 fg_color0;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec4 tex;
+// must match FrameUniforms in gfx.c
+layout (std140, row_major) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 ambient_color;
+};
 
 void main()
 {
     tex_coord0 = tex_coord;
-    gl_Position = projection * view * model * vec4(position.xy,0.0,1.0);
+    fg_color0 = fg_color;
+    gl_Position = projection * view * vec4(position.xy,0.0,1.0);
 }
@@ -1,10 +1,8 @@
 #version 330 core
 
+in vec4 color0;
 out vec4 out_color;
 
-uniform vec3 color;
-uniform float opacity;
-
 void main() {
-    out_color = vec4(color.xyz, opacity);
+    out_color = color0;
 }
@@ -1,12 +1,20 @@
 #version 330 core
 
 layout (location = 0) in vec2 position;
+layout (location = 1) in vec4 color; // rgb and opacity
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+out vec4 color0;
+
+// must match FrameUniforms in gfx.c
+layout (std140, row_major) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 ambient_color;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position.xy,0.0,1.0);
+    color0 = color;
+    gl_Position = projection * view * vec4(position.xy,0.0,1.0);
 }
@@ -12,7 +12,13 @@ in vec2 to_light_vector[16];
 out vec4 outColor;
 
 uniform sampler2D images[16];
-uniform vec3 ambient_color;
+// must match FrameUniforms in gfx.c
+layout (std140, row_major) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 ambient_color;
+};
 uniform vec3 light_color[16];
 uniform vec3 light_atten[16];
 
@@ -45,7 +51,7 @@ void main() {
     }
 
     total_diffuse = min(total_diffuse,vec3(1.0,1.0,1.0)); // cap the total diffuse
-    total_diffuse = max(total_diffuse, ambient_color);
+    total_diffuse = max(total_diffuse, ambient_color.rgb);
 
     vec4 my_color;
 
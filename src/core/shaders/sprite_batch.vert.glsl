@@ -2,14 +2,18 @@
 
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 tex_coord;
-layout (location = 2) in mat4 model;
+layout (location = 2) in vec2 sprite_pos;
+layout (location = 3) in vec2 sprite_size;
+layout (location = 4) in float sprite_rotation;
+layout (location = 5) in vec4 sprite_color; // rgb and opacity
 layout (location = 6) in vec4 sprite_rect;
-layout (location = 7) in vec3 color;
-layout (location = 8) in float opacity;
-layout (location = 9) in uint tex_unit;
-layout (location = 10) in uint ignore_light;
-layout (location = 11) in uint blending_mode;
-layout (location = 12) in uint mask_color;
+layout (location = 7) in uint sprite_flags;
+
+// must match SPRITE_FLAG_* in gfx.c
+#define FLAG_TEX_UNIT_MASK  0x0Fu
+#define FLAG_IGNORE_LIGHT   0x10u
+#define FLAG_BLEND_ADDITIVE 0x20u
+#define FLAG_MASK_COLOR     0x40u
 
 out vec2 tex_coord0;
 out vec3 color0;
@@ -22,27 +26,33 @@ flat out uint mask_color0;
 out vec2 to_light_vector[16];
 
 uniform vec2 light_pos[16];
-uniform mat4 view;
-uniform mat4 projection;
+// must match FrameUniforms in gfx.c
+layout (std140, row_major) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 ambient_color;
+};
 
 void main()
 {
     tex_coord0.x = sprite_rect.x + sprite_rect.z*tex_coord.x;
     tex_coord0.y = sprite_rect.y + sprite_rect.w*tex_coord.y;
 
-    color0 = color;
-    opacity0 = opacity;
-    image_index0 = tex_unit;
-    ignore_light0 = ignore_light;
-    mask_color0 = mask_color;
-    blending_mode0 = blending_mode;
+    color0 = sprite_color.rgb;
+    opacity0 = sprite_color.a;
+    image_index0 = sprite_flags & FLAG_TEX_UNIT_MASK;
+    ignore_light0 = (sprite_flags & FLAG_IGNORE_LIGHT) != 0u ? 1u : 0u;
+    mask_color0 = (sprite_flags & FLAG_MASK_COLOR) != 0u ? 1u : 0u;
+    blending_mode0 = (sprite_flags & FLAG_BLEND_ADDITIVE) != 0u ? 1u : 0u;
 
-    //if(tex_unit == 0)
-    //{
-    //    color0 = vec3(1.0,0.0,0.0);
-    //}
+    // scale, rotate about z, then translate
+    vec2 scaled = position * sprite_size;
+    float c = cos(sprite_rotation);
+    float s = sin(sprite_rotation);
+    vec2 rotated = vec2(c*scaled.x - s*scaled.y, s*scaled.x + c*scaled.y);
 
-    vec4 world_pos = model * vec4(position.xy,0.0,1.0);
+    vec4 world_pos = vec4(rotated + sprite_pos, 0.0, 1.0);
     for(int i = 0; i < 16; ++i)
     {
         to_light_vector[i] = light_pos[i] - world_pos.xy;
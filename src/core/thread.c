@@ -0,0 +1,121 @@
+#include "headers.h"
+
+#include "thread.h"
+
+// Long lived threads, mutexes and condition variables. Short tasks belong on
+// the job pool (jobs.h) instead.
+
+#if _WIN32
+static DWORD WINAPI thread_main(LPVOID arg)
+#else
+static void* thread_main(void* arg)
+#endif
+{
+    Thread* thread = (Thread*)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+bool thread_start(Thread* thread, thread_func func, void* arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+
+#if _WIN32
+    thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+    return thread->handle != NULL;
+#else
+    return pthread_create(&thread->handle, NULL, thread_main, thread) == 0;
+#endif
+}
+
+void thread_join(Thread* thread)
+{
+#if _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+}
+
+void mutex_init(Mutex* m)
+{
+#if _WIN32
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+void mutex_deinit(Mutex* m)
+{
+#if _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
+
+void mutex_lock(Mutex* m)
+{
+#if _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+void mutex_unlock(Mutex* m)
+{
+#if _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+void cond_init(Cond* c)
+{
+#if _WIN32
+    InitializeConditionVariable(c);
+#else
+    pthread_cond_init(c, NULL);
+#endif
+}
+
+void cond_deinit(Cond* c)
+{
+#if _WIN32
+    (void)c; // nothing to free
+#else
+    pthread_cond_destroy(c);
+#endif
+}
+
+void cond_wait(Cond* c, Mutex* m)
+{
+#if _WIN32
+    SleepConditionVariableCS(c, m, INFINITE);
+#else
+    pthread_cond_wait(c, m);
+#endif
+}
+
+void cond_signal(Cond* c)
+{
+#if _WIN32
+    WakeConditionVariable(c);
+#else
+    pthread_cond_signal(c);
+#endif
+}
+
+void cond_broadcast(Cond* c)
+{
+#if _WIN32
+    WakeAllConditionVariable(c);
+#else
+    pthread_cond_broadcast(c);
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+#if !_WIN32
+#include <pthread.h>
+#endif
+
+typedef void (*thread_func)(void* arg);
+
+typedef struct
+{
+#if _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    thread_func func;
+    void* arg;
+} Thread;
+
+#if _WIN32
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#endif
+
+// thread must stay valid until thread_join() returns
+bool thread_start(Thread* thread, thread_func func, void* arg);
+void thread_join(Thread* thread);
+
+void mutex_init(Mutex* m);
+void mutex_deinit(Mutex* m);
+void mutex_lock(Mutex* m);
+void mutex_unlock(Mutex* m);
+
+// m must be locked, it is released while waiting and locked again on wake
+void cond_init(Cond* c);
+void cond_deinit(Cond* c);
+void cond_wait(Cond* c, Mutex* m);
+void cond_signal(Cond* c);
+void cond_broadcast(Cond* c);
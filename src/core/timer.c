@@ -5,6 +5,7 @@
 #include <sys/time.h>
 #endif
 
+#include "math2d.h"
 #include "timer.h"
 
 static struct
@@ -89,11 +90,39 @@ static double get_time()
     return (double) (get_timer_value() - _timer.offset) / (double)_timer.frequency;
 }
 
+// sleeps until about t (in get_time() seconds), the OS may wake us late
+static void sleep_until(double t)
+{
+    double remaining = t - get_time();
+    if(remaining <= 0.0)
+        return;
+
+#if _WIN32
+    usleep((__int64)(remaining*1000000.0));
+#elif defined(_POSIX_TIMERS) && defined(_POSIX_MONOTONIC_CLOCK) && !defined(__APPLE__)
+    if(_timer.monotonic)
+    {
+        // absolute wake up time, so time spent getting here doesn't add to the sleep
+        uint64_t wake = _timer.offset + (uint64_t)(t*_timer.frequency);
+        struct timespec ts;
+        ts.tv_sec = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        return;
+    }
+    usleep((useconds_t)(remaining*1000000.0));
+#else
+    usleep((useconds_t)(remaining*1000000.0));
+#endif
+}
+
 void timer_begin(Timer* timer)
 {
     timer->time_start = get_time();
     timer->time_last = timer->time_start;
     timer->frame_fps = 0.0f;
+    timer->sleep_margin = TIMER_SPIN_MARGIN;
+    timer_reset_pacing(timer);
 }
 
 double timer_get_time()
@@ -107,20 +136,61 @@ void timer_set_fps(Timer* timer, float fps)
     timer->spf = 1.0f / fps;
 }
 
+void timer_set_vsync(Timer* timer, bool vsync)
+{
+    timer->vsync = vsync;
+}
+
+// Sleeps until sleep_margin before the deadline, then spins the rest. The
+// margin follows how late the OS wakes us, so coarse schedulers spin longer.
 void timer_wait_for_frame(Timer* timer)
 {
-    double now;
-    for(;;)
+    double deadline = timer->time_last + timer->spf;
+    double now = get_time();
+
+    if(timer->vsync)
+        deadline = now;
+
+    if(timer->sleep_margin <= 0.0)
+        timer->sleep_margin = TIMER_SPIN_MARGIN;
+
+    double wake = deadline - timer->sleep_margin;
+    if(now < wake)
     {
+        sleep_until(wake);
         now = get_time();
-        if(now >= timer->time_last + timer->spf)
-            break;
-        
-        //usleep(100);
+
+        double oversleep = MAX(now - wake, 0.0);
+        TimerPacing* p = &timer->pacing;
+        p->sleeps++;
+        p->oversleep_sum += oversleep;
+        p->oversleep_max = MAX(p->oversleep_max, oversleep);
+
+        // grow right away when a wake up eats into the spin, shrink back slowly
+        if(oversleep > timer->sleep_margin*0.5)
+            timer->sleep_margin = MIN(oversleep*2.0, timer->spf);
+        else
+            timer->sleep_margin = MAX(timer->sleep_margin*0.99, TIMER_SPIN_MARGIN);
     }
 
+    while(now < deadline)
+        now = get_time();
+
+    double late = now - deadline;
+    TimerPacing* p = &timer->pacing;
+    p->frames++;
+    p->late_sum += late;
+    p->late_max = MAX(p->late_max, late);
+
     timer->frame_fps = 1.0f / (now - timer->time_last);
-    timer->time_last = now;
+
+    // keep the cadence on the deadlines unless a whole frame was missed
+    timer->time_last = (late < timer->spf) ? deadline : now;
+}
+
+void timer_reset_pacing(Timer* timer)
+{
+    memset(&timer->pacing, 0, sizeof(TimerPacing));
 }
 
 double timer_get_elapsed(Timer* timer)
@@ -134,6 +204,53 @@ double timer_get_prior_frame_fps(Timer* timer)
     return timer->frame_fps;
 }
 
+void fixed_step_init(FixedStep* fs, double dt, int max_steps)
+{
+    memset(fs, 0, sizeof(FixedStep));
+    fs->dt = dt;
+    fs->max_steps = MAX(max_steps, 1);
+    fixed_step_reset(fs);
+}
+
+void fixed_step_reset(FixedStep* fs)
+{
+    fs->accum = 0.0;
+    fs->time_prior = get_time();
+    fs->time_scale = 1.0;
+}
+
+int fixed_step_advance(FixedStep* fs, double now)
+{
+    double elapsed = MAX(now - fs->time_prior, 0.0);
+    fs->time_prior = now;
+
+    fs->accum += elapsed*fs->time_scale;
+
+    int steps = (int)(fs->accum / fs->dt);
+    if(steps > 1)
+        fs->late++;
+
+    if(steps > fs->max_steps)
+    {
+        // running the whole backlog would overrun the next frame too, drop it
+        // and let game time run slower for a while instead
+        fs->overruns++;
+        fs->dropped_steps += steps - fs->max_steps;
+        steps = fs->max_steps;
+        fs->accum = fmod(fs->accum, fs->dt);
+        fs->time_scale = MAX(fs->time_scale*0.75, FIXED_STEP_MIN_SCALE);
+    }
+    else
+    {
+        fs->accum -= steps*fs->dt;
+        if(steps <= 1)
+            fs->time_scale = MIN(fs->time_scale + FIXED_STEP_RECOVERY, 1.0);
+    }
+
+    fs->steps += steps;
+    return steps;
+}
+
 void timer_delay_us(int us)
 {
     usleep(us);
@@ -1,21 +1,69 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_SPIN_MARGIN 0.001 // seconds before a deadline where sleeping stops and spinning starts
+
+// how well timer_wait_for_frame() hit its deadlines, in seconds
+typedef struct
+{
+    int frames;
+    double late_sum; // past the deadline when the wait returned
+    double late_max;
+    int sleeps;
+    double oversleep_sum; // past the requested wake up time
+    double oversleep_max;
+} TimerPacing;
+
+#define FIXED_STEP_MAX_STEPS 5    // default catch-up budget per fixed_step_advance()
+#define FIXED_STEP_MIN_SCALE 0.25  // slowest game time is allowed to run while overloaded
+#define FIXED_STEP_RECOVERY  0.01  // time scale regained per advance once caught up
+
+// Fixed timestep accumulator shared by the client and server loops. After a
+// stall only max_steps run back to back, the rest of the backlog is dropped
+// and game time is slowed down until the loop keeps up again.
+typedef struct
+{
+    double dt;
+    int max_steps;
+    double accum;
+    double time_prior;
+    double time_scale; // 1.0 is real time
+
+    // cumulative, for telemetry
+    uint64_t steps;
+    uint64_t late;          // advances that needed more than one step
+    uint64_t overruns;      // advances that hit max_steps
+    uint64_t dropped_steps; // steps skipped because of the budget
+} FixedStep;
+
 typedef struct
 {
     float  fps;
     float  spf;
     double time_start;
-    double time_last;
+    double time_last; // deadline of the prior frame
     double frame_fps;
+
+    bool vsync; // the swap blocks on vblank, so the timer doesn't wait
+    double sleep_margin; // starts at TIMER_SPIN_MARGIN, grows when the OS oversleeps
+    TimerPacing pacing;
 } Timer;
 
 void init_timer(void);
 
 void timer_begin(Timer* timer);
 void timer_set_fps(Timer* timer, float fps);
+void timer_set_vsync(Timer* timer, bool vsync);
 void timer_wait_for_frame(Timer* timer);
+void timer_reset_pacing(Timer* timer);
 double timer_get_prior_frame_fps(Timer* timer);
 
 double timer_get_elapsed(Timer* timer);
+
+void fixed_step_init(FixedStep* fs, double dt, int max_steps);
+void fixed_step_reset(FixedStep* fs); // forgets the backlog and the time since the last advance
+int fixed_step_advance(FixedStep* fs, double now); // how many steps of dt to run now
 void timer_delay_us(int us);
 double timer_get_time();
@@ -2,6 +2,13 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+// Mesa's surfaceless EGL platform gives a context with no display server at all
+#if !_WIN32
+#define WINDOW_HEADLESS_EGL 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "math2d.h"
 #include "imgui.h"
 #include "window.h"
@@ -10,6 +17,7 @@ typedef struct
 {
     int action;
     int action_prior;
+    bool pressed; // latched until taken, for updates that don't run once per poll
 } MouseAction;
 
 static MouseAction mouse_left;
@@ -32,7 +40,20 @@ static int text_buf_max = 0;
 static double window_coord_x = 0;
 static double window_coord_y = 0;
 
+// offscreen rendering target, 0 when drawing to the window
+static GLuint offscreen_fbo = 0;
+static GLuint offscreen_rbo = 0;
+
+#if WINDOW_HEADLESS_EGL
+// set when the offscreen context came from EGL directly, window is NULL then
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+#endif
+
 static bool get_window_monitor(GLFWmonitor** monitor, GLFWwindow* window);
+static GLFWwindow* create_offscreen_window(bool null_platform);
+static bool create_surfaceless_context();
+static bool init_glew(bool offscreen);
 
 static void window_size_callback(GLFWwindow* window, int _window_width, int _window_height);
 static void window_move_callback(GLFWwindow* window, int xpos, int ypos);
@@ -95,15 +116,8 @@ bool window_init(int _view_width, int _view_height)
     glfwSwapInterval(0); // vsync
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 
-    printf("Initializing GLEW.\n");
-
-    // GLEW
-    glewExperimental = 1;
-    if(glewInit() != GLEW_OK)
-    {
-        fprintf(stderr, "Failed to initialize GLEW\n");
+    if(!init_glew(false))
         return false;
-    }
 
     mouse_left.action = GLFW_RELEASE;
     mouse_right.action = GLFW_RELEASE;
@@ -121,6 +135,183 @@ bool window_init(int _view_width, int _view_height)
 }
 
 
+// A context that draws into an FBO, for machines without a display or GPU.
+// Tries GLFW 3.4's null platform with OSMesa, then Mesa's surfaceless EGL
+// platform without GLFW, then a hidden GLFW window on the default platform.
+bool window_init_offscreen(int _view_width, int _view_height)
+{
+    view_width = _view_width;
+    view_height = _view_height;
+
+    window_width = view_width;
+    window_height = view_height;
+
+    window = create_offscreen_window(true);
+    if(window == NULL && !create_surfaceless_context())
+    {
+        window = create_offscreen_window(false);
+        if(window == NULL)
+        {
+            fprintf(stderr, "Failed to create an offscreen GL context!\n");
+            return false;
+        }
+    }
+
+    if(window)
+    {
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(0);
+    }
+
+    if(!init_glew(true))
+        return false;
+
+    glGenRenderbuffers(1, &offscreen_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreen_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, view_width, view_height);
+
+    glGenFramebuffers(1, &offscreen_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_rbo);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Offscreen framebuffer is incomplete!\n");
+        return false;
+    }
+
+    glViewport(0, 0, view_width, view_height);
+
+    mouse_left.action = GLFW_RELEASE;
+    mouse_right.action = GLFW_RELEASE;
+
+    printf("Offscreen renderer: %s\n", glGetString(GL_RENDERER));
+    return true;
+}
+
+// rgba must hold view_width*view_height*4 bytes, rows are stored top down
+void window_read_pixels(unsigned char* rgba)
+{
+    int stride = view_width*4;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, view_width, view_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    // GL's origin is the bottom left
+    unsigned char* row = malloc(stride);
+    for(int y = 0; y < view_height/2; ++y)
+    {
+        unsigned char* a = rgba + y*stride;
+        unsigned char* b = rgba + (view_height-1-y)*stride;
+        memcpy(row, a, stride);
+        memcpy(a, b, stride);
+        memcpy(b, row, stride);
+    }
+    free(row);
+}
+
+static GLFWwindow* create_offscreen_window(bool null_platform)
+{
+#if defined(GLFW_PLATFORM_NULL) && defined(GLFW_OSMESA_CONTEXT_API)
+    glfwInitHint(GLFW_PLATFORM, null_platform ? GLFW_PLATFORM_NULL : GLFW_ANY_PLATFORM);
+#else
+    if(null_platform)
+        return NULL;
+#endif
+
+    if(!glfwInit())
+        return NULL;
+
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef GLFW_OSMESA_CONTEXT_API
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, null_platform ? GLFW_OSMESA_CONTEXT_API : GLFW_EGL_CONTEXT_API);
+#endif
+
+    GLFWwindow* w = glfwCreateWindow(view_width, view_height, "Spacemen", NULL, NULL);
+    if(w == NULL)
+        glfwTerminate();
+    return w;
+}
+
+static bool create_surfaceless_context()
+{
+#if WINDOW_HEADLESS_EGL
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(!get_platform_display)
+        return false;
+
+    egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if(egl_display == EGL_NO_DISPLAY)
+        return false;
+
+    if(!eglInitialize(egl_display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API))
+    {
+        eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if(eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) && num_configs > 0)
+        egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+
+    // nothing is ever presented, the FBO is the only render target
+    if(egl_context == EGL_NO_CONTEXT || !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+    {
+        if(egl_context != EGL_NO_CONTEXT)
+            eglDestroyContext(egl_display, egl_context);
+        eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        egl_context = EGL_NO_CONTEXT;
+        return false;
+    }
+
+    printf("Using a surfaceless EGL context.\n");
+    return true;
+#else
+    return false;
+#endif
+}
+
+static bool init_glew(bool offscreen)
+{
+    printf("Initializing GLEW.\n");
+
+    glewExperimental = 1;
+    GLenum err = glewInit();
+
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // OSMesa and EGL contexts have no GLX display, the GL entry points still load (through glvnd's libGL)
+    if(offscreen && err == GLEW_ERROR_NO_GLX_DISPLAY)
+        err = GLEW_OK;
+#endif
+
+    if(err != GLEW_OK)
+    {
+        fprintf(stderr, "Failed to initialize GLEW\n");
+        return false;
+    }
+    return true;
+}
+
 void window_get_mouse_coords(int* x, int* y)
 {
     *x = (int)(window_coord_x);
@@ -139,11 +330,31 @@ void window_set_mouse_view_coords(int x, int y)
 {
     double _x = (double)x / (view_width/(float)window_width);
     double _y = (double)y / (view_height/(float)window_height);
-    glfwSetCursorPos(window, _x, _y);
+    if(window)
+        glfwSetCursorPos(window, _x, _y);
 }
 
 void window_deinit()
 {
+    if(offscreen_fbo)
+    {
+        glDeleteFramebuffers(1, &offscreen_fbo);
+        glDeleteRenderbuffers(1, &offscreen_rbo);
+        offscreen_fbo = 0;
+        offscreen_rbo = 0;
+    }
+
+#if WINDOW_HEADLESS_EGL
+    if(egl_context != EGL_NO_CONTEXT)
+    {
+        eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(egl_display, egl_context);
+        eglTerminate(egl_display);
+        egl_context = EGL_NO_CONTEXT;
+        egl_display = EGL_NO_DISPLAY;
+    }
+#endif
+
     glfwTerminate();
 }
 
@@ -154,17 +365,25 @@ void window_poll_events()
 
 bool window_should_close()
 {
-    return (glfwWindowShouldClose(window) != 0);
+    return window && (glfwWindowShouldClose(window) != 0);
 }
 
 void window_set_close(int value)
 {
-    glfwSetWindowShouldClose(window,value);
+    if(window)
+        glfwSetWindowShouldClose(window,value);
 }
 
 void window_swap_buffers()
 {
-    glfwSwapBuffers(window);
+    if(window)
+        glfwSwapBuffers(window);
+}
+
+void window_set_vsync(bool vsync)
+{
+    if(window)
+        glfwSwapInterval(vsync ? 1 : 0);
 }
 
 // https://github.com/glfw/glfw/issues/1699
@@ -657,11 +876,15 @@ static void mouse_button_callback(GLFWwindow* window, int button, int action, in
     {
         mouse_left.action_prior = mouse_left.action;
         mouse_left.action = action;
+        if(action == GLFW_PRESS)
+            mouse_left.pressed = true;
     }
     else if(button == GLFW_MOUSE_BUTTON_RIGHT)
     {
         mouse_right.action_prior = mouse_left.action;
         mouse_right.action = action;
+        if(action == GLFW_PRESS)
+            mouse_right.pressed = true;
     }
 
     if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
@@ -722,14 +945,30 @@ bool window_mouse_right_went_up()
     return went_up_this_frame;
 }
 
+bool window_mouse_left_take_press()
+{
+    bool pressed = mouse_left.pressed;
+    mouse_left.pressed = false;
+    return pressed;
+}
+
+bool window_mouse_right_take_press()
+{
+    bool pressed = mouse_right.pressed;
+    mouse_right.pressed = false;
+    return pressed;
+}
+
 void window_mouse_set_cursor_ibeam()
 {
-    glfwSetCursor(window,cursor_ibeam);
+    if(window)
+        glfwSetCursor(window,cursor_ibeam);
 }
 
 void window_mouse_set_cursor_normal()
 {
-    glfwSetCursor(window,NULL); // standard
+    if(window)
+        glfwSetCursor(window,NULL); // standard
 }
 
 void windows_text_mode_buf_insert(char c, int index)
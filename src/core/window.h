@@ -23,6 +23,8 @@ extern int view_width;
 extern int view_height;
 
 bool window_init(int _view_width, int _view_height);
+bool window_init_offscreen(int _view_width, int _view_height);
+void window_read_pixels(unsigned char* rgba);
 void window_deinit();
 
 float window_scale_view_to_world(float distance);
@@ -38,6 +40,7 @@ void window_poll_events();
 bool window_should_close();
 void window_set_close(int value);
 void window_swap_buffers();
+void window_set_vsync(bool vsync);
 
 bool window_controls_is_key_state(int key, int state);
 void window_controls_set_cb(key_cb_t cb);
@@ -62,6 +65,10 @@ bool window_mouse_right_went_down();
 bool window_mouse_right_went_up();
 void window_mouse_update_actions();
 
+// true once per press since the last call, so a press reaches exactly one simulation tick
+bool window_mouse_left_take_press();
+bool window_mouse_right_take_press();
+
 void window_mouse_set_cursor_ibeam();
 void window_mouse_set_cursor_normal();
 
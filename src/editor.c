@@ -19,6 +19,8 @@ int player_selection = 0;
 
 
 static ParticleSpawner* particle_spawner; 
+static ParticleEffect particle_effect; // edited here, pushed to the library each frame
+static int particle_effect_handle;
 static char particles_file_name[33] = {0};
 
 static char* effect_options[100] = {0};
@@ -26,6 +28,7 @@ static int prior_selected_effect = 0;
 static int selected_effect = 0;
 
 static void randomize_effect(ParticleEffect* effect);
+static void edit_curve(char* id, bool* enabled, ParticleCurve* curve, float max);
 
 void editor_init()
 {
@@ -52,11 +55,15 @@ void editor_init()
         .img_index = particles_image,
         .use_sprite = true,
         .blend_additive = false,
+        .scale_curve = {{1.0,1.0,1.0,1.0}},
+        .opacity_curve = {{1.0,1.0,1.0,1.0}},
     };
 
     randomize_effect(&effect);
 
-    particle_spawner = particles_spawn_effect(view_width-200, 200, 1, &effect, 0, false, true);
+    particle_effect = effect;
+    particle_effect_handle = particles_register_effect(&particle_effect);
+    particle_spawner = particles_spawn_effect(view_width-200, 200, 1, particle_effect_handle, NULL, 0, false, true);
 }
 
 
@@ -233,7 +240,7 @@ void editor_draw()
 
             case 2: // particles
             {
-                ParticleEffect* effect = &particle_spawner->effect;
+                ParticleEffect* effect = &particle_effect;
                 particle_spawner->hidden = false;
 
                 gfx_draw_string(view_width-300, 100, 0xAAAAAAAA, 0.2, 0.0, 1.0, false, false, "Preview");
@@ -294,6 +301,7 @@ void editor_draw()
                     effect->scale.init_max = (effect->scale.init_min > effect->scale.init_max ? effect->scale.init_min : effect->scale.init_max);
                     imgui_slider_float("Rate##scale", -1.0,1.0,&effect->scale.rate);
                 imgui_horizontal_end();
+                edit_curve("scale", &effect->use_scale_curve, &effect->scale_curve, 3.0);
                 imgui_text_sized(big,"Velocity X");
                 imgui_horizontal_begin();
                     imgui_slider_float("Min##velx", -300.0,300.0,&effect->velocity_x.init_min);
@@ -315,6 +323,7 @@ void editor_draw()
                     effect->opacity.init_max = (effect->opacity.init_min > effect->opacity.init_max ? effect->opacity.init_min : effect->opacity.init_max);
                     imgui_slider_float("Rate##opacity", -1.0,1.0,&effect->opacity.rate);
                 imgui_horizontal_end();
+                edit_curve("opacity", &effect->use_opacity_curve, &effect->opacity_curve, 1.0);
                 imgui_text_sized(big,"Angular Velocity");
                 imgui_horizontal_begin();
                     imgui_slider_float("Min##angular_vel", -360.0,360.0,&effect->angular_vel.init_min);
@@ -357,6 +366,8 @@ void editor_draw()
                 imgui_checkbox("Blend Addtive",&effect->blend_additive);
                 imgui_newline();
 
+                particles_update_effect(particle_effect_handle, effect);
+
                 imgui_text_box("Filename##file_name_particles",particles_file_name,IM_ARRAYSIZE(particles_file_name));
 
                 char file_path[64]= {0};
@@ -366,7 +377,7 @@ void editor_draw()
                 {
                     if(imgui_button("Save##particles"))
                     {
-                        effects_save(file_path, effect);
+                        effects_save(file_path, particles_get_effect(particle_effect_handle));
                     }
                 }
 
@@ -376,7 +387,7 @@ void editor_draw()
                 }
 
                 // show preview
-                particles_draw_spawner(particle_spawner, true, false);
+                particles_draw_spawner(particle_spawner, true);
             }
 
             case 3: // console
@@ -388,6 +399,36 @@ void editor_draw()
 
 }
 
+// a curve replaces the rate, its points multiply the initial value over the particle's life
+static void edit_curve(char* id, bool* enabled, ParticleCurve* curve, float max)
+{
+    char label[32] = {0};
+    bool was_enabled = *enabled;
+
+    snprintf(label,31,"Curve##%s",id);
+    imgui_checkbox(label, enabled);
+    if(!*enabled)
+        return;
+
+    // effects from before curves existed have all zero points
+    if(!was_enabled)
+    {
+        bool empty = true;
+        for(int i = 0; i < PARTICLE_CURVE_POINTS; ++i)
+            empty &= (curve->points[i] == 0.0);
+        for(int i = 0; empty && i < PARTICLE_CURVE_POINTS; ++i)
+            curve->points[i] = 1.0;
+    }
+
+    imgui_horizontal_begin();
+    for(int i = 0; i < PARTICLE_CURVE_POINTS; ++i)
+    {
+        snprintf(label,31,"%d##%s_curve",i,id);
+        imgui_slider_float(label, 0.0, max, &curve->points[i]);
+    }
+    imgui_horizontal_end();
+}
+
 static void randomize_effect(ParticleEffect* effect)
 {
     effect->life.init_min = RAND_FLOAT(0.1,5.0);
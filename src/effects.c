@@ -1,30 +1,32 @@
 #include "io.h"
 #include "log.h"
+#include "jobs.h"
 #include "effects.h"
 
 ParticleEffect particle_effects[EFFECT_MAX];
+int effect_handles[EFFECT_MAX];
 int num_effects = 0;
 
 EffectEntry effect_map[] = {
-    {EFFECT_GUN_SMOKE1,"gun_smoke.effect"},
-    {EFFECT_SPARKS1,"sparks1.effect"},
-    {EFFECT_HEAL1,"heal1.effect"},
-    {EFFECT_HEAL2,"heal2.effect"},
-    {EFFECT_HOLY1,"holy1.effect"},
-    {EFFECT_BLOOD1,"blood1.effect"},
-    {EFFECT_DEBRIS1,"debris1.effect"},
-    {EFFECT_MELEE1,"melee1.effect"},
-    {EFFECT_BULLET_CASING,"bullet_casing.effect"},
-    {EFFECT_FIRE,"fire.effect"},
-    {EFFECT_BLOCK_DESTROY,"block_destroy.effect"},
-    {EFFECT_SMOKE,"smoke.effect"},
-    {EFFECT_SMOKE2,"smoke2.effect"},
-    {EFFECT_BULLET_TRAIL,"bullet_trail.effect"},
-    {EFFECT_GUN_BLAST,"gun_blast.effect"},
-    {EFFECT_LEVEL_UP,"level_up.effect"},
-    {EFFECT_JETS,"jets.effect"},
-    {EFFECT_EXPLOSION,"explosion.effect"},
-    {EFFECT_PLAYER_ACTIVATE,"player_activate.effect"}
+    {EFFECT_GUN_SMOKE1,"gun_smoke.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_SPARKS1,"sparks1.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_HEAL1,"heal1.effect",PARTICLE_PRIORITY_HIGH},
+    {EFFECT_HEAL2,"heal2.effect",PARTICLE_PRIORITY_HIGH},
+    {EFFECT_HOLY1,"holy1.effect",PARTICLE_PRIORITY_HIGH},
+    {EFFECT_BLOOD1,"blood1.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_DEBRIS1,"debris1.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_MELEE1,"melee1.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_BULLET_CASING,"bullet_casing.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_FIRE,"fire.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_BLOCK_DESTROY,"block_destroy.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_SMOKE,"smoke.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_SMOKE2,"smoke2.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_BULLET_TRAIL,"bullet_trail.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_GUN_BLAST,"gun_blast.effect",PARTICLE_PRIORITY_NORMAL},
+    {EFFECT_LEVEL_UP,"level_up.effect",PARTICLE_PRIORITY_HIGH},
+    {EFFECT_JETS,"jets.effect",PARTICLE_PRIORITY_LOW},
+    {EFFECT_EXPLOSION,"explosion.effect",PARTICLE_PRIORITY_HIGH},
+    {EFFECT_PLAYER_ACTIVATE,"player_activate.effect",PARTICLE_PRIORITY_HIGH}
 };
 
 static int get_effect_map_index(char* file_name)
@@ -40,11 +42,26 @@ static int get_effect_map_index(char* file_name)
     return -1;
 }
 
+typedef struct
+{
+    char path[100];
+    ParticleEffect* effect;
+} EffectLoad;
+
+static void effect_load_job(void* arg)
+{
+    EffectLoad* load = (EffectLoad*)arg;
+    effects_load(load->path, load->effect);
+}
+
 void effects_load_all()
 {
     char files[32][32] = {0};
     num_effects = io_get_files_in_dir("src/effects",".effect", files);
 
+    EffectLoad loads[32] = {0};
+    JobCounter done = {0};
+
     LOGI("Num effects: %d",num_effects);
 
     for(int i = 0; i < num_effects; ++i)
@@ -66,15 +83,41 @@ void effects_load_all()
         }
         else
         {
-            effects_load(full_path,&particle_effects[index]);
-            strncpy(particle_effects[index].name,filename,100);
+            memcpy(loads[i].path, full_path, sizeof(loads[i].path));
+            loads[i].effect = &particle_effects[index];
+            jobs_add(effect_load_job, &loads[i], &done);
 
             LOGI("%d: %s",i,filename);
         }
     }
+
+    jobs_wait(&done);
+
+    // the file contents overwrite the whole effect, so name them afterwards
+    for(int i = 0; i < num_effects; ++i)
+    {
+        if(loads[i].effect)
+            strncpy(loads[i].effect->name, io_get_filename(files[i]), 100);
+    }
+
+    // reloading updates the registered effects in place, so live spawners pick up the changes
+    for(int i = 0; i < EFFECT_MAX; ++i)
+    {
+        if(effect_handles[i] == 0)
+            effect_handles[i] = particles_register_effect(&particle_effects[i]);
+        else
+            particles_update_effect(effect_handles[i], &particle_effects[i]);
+    }
+
+    int num_effects_in_map = sizeof(effect_map)/sizeof(EffectEntry);
+    for(int i = 0; i < num_effects_in_map; ++i)
+    {
+        if(effect_map[i].effect_index < EFFECT_MAX)
+            particles_set_effect_priority(effect_handles[effect_map[i].effect_index], effect_map[i].priority);
+    }
 }
 
-bool effects_save(char* file_path, ParticleEffect* effect)
+bool effects_save(char* file_path, const ParticleEffect* effect)
 {
     FILE* fp = fopen(file_path,"wb");
     if(!fp)
@@ -98,6 +141,8 @@ bool effects_load(char* file_path, ParticleEffect* effect)
         return false;
     }
 
+    // files saved before the curves were added are shorter, the rest stays zeroed
+    memset(effect,0,sizeof(ParticleEffect));
     fread(effect,sizeof(ParticleEffect),1,fp);
     LOGI("Loaded effect: %s", file_path);
     fclose(fp);
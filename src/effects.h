@@ -30,11 +30,13 @@ typedef struct
 {
     int effect_index;
     char* file_name;
+    ParticlePriority priority;
 } EffectEntry;
 
 extern ParticleEffect particle_effects[EFFECT_MAX];
+extern int effect_handles[EFFECT_MAX]; // particle library handles, filled by effects_load_all()
 extern int num_effects;
 
 void effects_load_all();
-bool effects_save(char* file_path, ParticleEffect* effect);
+bool effects_save(char* file_path, const ParticleEffect* effect);
 bool effects_load(char* file_path, ParticleEffect* effect);
@@ -16,6 +16,9 @@
 #include "editor.h"
 #include "powerups.h"
 #include "text_list.h"
+#include "profiler.h"
+#include "jobs.h"
+#include "thread.h"
 
 
 // =========================
@@ -31,6 +34,9 @@ bool back_to_home = false;
 bool paused = false;
 bool debug_enabled = false;
 bool game_debug_enabled = false;
+bool profiler_enabled = false;
+bool render_offscreen = false;
+bool vsync_enabled = false;
 bool initiate_game = false;
 int num_players = 2;
 float game_end_counter;
@@ -39,7 +45,6 @@ int client_id = -1;
 
 GameSettings game_settings = {0};
 
-ParticleEffect mouse_click_effect = {0};
 
 
 // local game vars
@@ -81,6 +86,44 @@ MenuKeys menu_keys = {0};
 typedef void (*loop_update_func)(float _dt, bool is_client);
 typedef void (*loop_draw_func)(bool is_client);
 
+// Updates run on their own thread at TARGET_FPS so a slow flush, frame wait or
+// swap can't hold back simulation and network reads. world_lock guards all
+// game state; the render thread holds it while polling input and while _draw
+// records into gfx's queues, GL submission and the swap happen unlocked.
+// The draws read (and their imgui widgets change) live game state, so the
+// lock covers them instead of a copy of the world: a slow draw still delays
+// the next tick.
+
+#define SIM_LERP_MAX_DIST 100.0 // further than this in one tick is a respawn, not movement
+
+typedef struct
+{
+    uint16_t id;
+    Vector2f pos;
+    float angle_deg;
+} RenderPose;
+
+static Thread sim_thread;
+static Mutex world_lock;
+static volatile bool sim_running = false;
+
+// guarded by world_lock
+static loop_update_func sim_update = NULL; // NULL between screens
+static DisplayScreen sim_screen;
+static bool sim_is_client = false;
+static FixedStep sim_step;
+static double sim_tick_time = 0.0; // when the latest tick ran
+
+// poses from before the latest tick, frames are drawn between these and the live state
+static RenderPose player_poses_prior[MAX_PLAYERS];
+static RenderPose projectile_poses_prior[MAX_PROJECTILES];
+static int num_projectile_poses_prior = 0;
+
+// live poses put aside while the interpolated ones are drawn
+static RenderPose player_poses_live[MAX_PLAYERS];
+static RenderPose projectile_poses_live[MAX_PROJECTILES];
+static bool projectile_pose_swapped[MAX_PROJECTILES];
+
 
 // =========================
 // Function Prototypes
@@ -124,6 +167,12 @@ void stars_init();
 void stars_update();
 void stars_draw();
 void player_list_draw();
+static void sim_start();
+static void sim_stop();
+static void sim_run_due_ticks(double now);
+static void poses_save_prior();
+static void poses_interpolate(float t);
+static void poses_restore();
 
 void key_cb(GLFWwindow* window, int key, int scan_code, int action, int mods);
 
@@ -131,12 +180,11 @@ void key_cb(GLFWwindow* window, int key, int scan_code, int action, int mods);
 // Main Loop
 // =========================
 
+// the benchmark (bench.c) provides its own main and reuses the rest of this file
+#if !SPACEMEN_BENCH
 int main(int argc, char* argv[])
 {
 
-    // test_packing();
-    // exit(0);
-
     init_timer();
     log_init(0);
 
@@ -196,6 +244,23 @@ int main(int argc, char* argv[])
 
     return 0;
 }
+#endif
+
+static void parse_log_level(const char* name)
+{
+    const char* names[] = {"verbose", "network", "info", "warning", "error", "none"};
+
+    for(int i = 0; i < (int)(sizeof(names)/sizeof(names[0])); ++i)
+    {
+        if(strcmp(name, names[i]) == 0)
+        {
+            log_set_level(LOG_LEVEL_VERBOSE + i);
+            return;
+        }
+    }
+
+    LOGW("Unknown log level %s", name);
+}
 
 void parse_args(int argc, char* argv[])
 {
@@ -228,6 +293,30 @@ void parse_args(int argc, char* argv[])
                     role = ROLE_CLIENT;
                     screen = SCREEN_GAME_START;
                 }
+
+                // let the swap wait for vblank instead of the frame timer
+                else if(strncmp(argv[i]+2,"vsync",5) == 0)
+                {
+                    vsync_enabled = true;
+                }
+
+                // --log-level=verbose|network|info|warning|error|none
+                else if(strncmp(argv[i]+2,"log-level=",10) == 0)
+                {
+                    parse_log_level(argv[i]+12);
+                }
+
+                // --log-binary=<path>, records the log to a file instead of stdout
+                else if(strncmp(argv[i]+2,"log-binary=",11) == 0)
+                {
+                    log_set_binary_file(argv[i]+13);
+                }
+
+                // --max-particles=N, lowers the live particle cap for slow machines
+                else if(strncmp(argv[i]+2,"max-particles=",14) == 0)
+                {
+                    particles_set_max(atoi(argv[i]+16));
+                }
             }
             else
             {
@@ -237,13 +326,37 @@ void parse_args(int argc, char* argv[])
     }
 }
 
+static bool loading_bar_ready = false;
+
+static void load_progress(int loaded, int total, const char* path)
+{
+    LOGI("   [%d/%d] %s", loaded, total, path);
+
+    // the font is uploaded from inside gfx_init(), nothing can be drawn yet
+    if(!loading_bar_ready)
+        return;
+
+    float w = view_width/3.0;
+    float h = 12.0;
+    float x = view_width/2.0;
+    float y = view_height/2.0;
+    float fill = w*loaded/(float)total;
+
+    gfx_clear_buffer(0,0,0);
+    gfx_set_render_layer(LAYER_HUD);
+    gfx_draw_rect_xywh(x, y, w, h, COLOR_WHITE, 0.0, 1.0, 1.0, false, false);
+    gfx_draw_rect_xywh(x - w/2.0 + fill/2.0, y, fill, h, COLOR_WHITE, 0.0, 1.0, 1.0, true, false);
+    gfx_flush();
+    window_swap_buffers();
+}
+
 void init()
 {
     if(initialized) return;
     initialized = true;
 
     LOGI("Resolution: %d %d",VIEW_WIDTH, VIEW_HEIGHT);
-    bool success = window_init(VIEW_WIDTH, VIEW_HEIGHT);
+    bool success = render_offscreen ? window_init_offscreen(VIEW_WIDTH, VIEW_HEIGHT) : window_init(VIEW_WIDTH, VIEW_HEIGHT);
 
     if(!success)
     {
@@ -251,16 +364,34 @@ void init()
         exit(1);
     }
 
+    window_set_vsync(vsync_enabled);
     window_controls_set_cb(key_cb);
     window_controls_set_key_mode(KEY_MODE_NORMAL);
 
     LOGI("Initializing...");
 
+    jobs_init(0);
+
     LOGI(" - Shaders.");
     shader_load_all();
 
+    LOGI(" - Effects.");
+    effects_load_all();
+
+    // decode every image on the job threads while the GL setup below runs,
+    // arguments have to match the gfx_load_image() calls or they decode twice
+    gfx_set_load_progress_cb(load_progress);
+    gfx_image_prefetch("src/core/fonts/atlas.png", false, 0, 0);
+    gfx_image_prefetch("src/img/particles.png", false, 32, 32);
+    gfx_image_prefetch("src/img/spaceship.png", false, 32, 32);
+    gfx_image_prefetch("src/img/laser.png", false, 10, 3);
+    gfx_image_prefetch("src/img/powerups.png", false, 32, 32);
+    gfx_font_prefetch();
+    imgui_theme_prefetch("retro.theme");
+
     LOGI(" - Graphics.");
     gfx_init(VIEW_WIDTH, VIEW_HEIGHT);
+    loading_bar_ready = true;
     world_box.w = view_width;
     world_box.h = view_height;
     world_box.x = view_width/2.0;
@@ -271,9 +402,6 @@ void init()
     ready_zone.x = view_width-200;
     ready_zone.y = view_height-200;
 
-    LOGI(" - Effects.");
-    effects_load_all();
-
     LOGI(" - Particles.");
     particles_init();
 
@@ -300,8 +428,8 @@ void init()
 
     stars_init();
 
-    memcpy(&mouse_click_effect, &particle_effects[EFFECT_PLAYER_ACTIVATE],sizeof(ParticleEffect));
-    // mouse_click_spawner = particles_spawn_effect(0,0, &mouse_click_effect,1.0,true,true);
+    LOGI(" - Atlases.");
+    gfx_atlas_build();
 }
 
 
@@ -333,8 +461,10 @@ void deinit()
 {
     if(!initialized) return;
     initialized = false;
+    sim_stop();
     shader_deinit();
     window_deinit();
+    jobs_deinit();
 }
 
 void reset_game()
@@ -350,51 +480,268 @@ void reset_game()
 void run_loop(DisplayScreen _screen, loop_update_func _update, loop_draw_func _draw)
 {
     bool is_client = (role == ROLE_CLIENT);
+    const double dt = 1.0/TARGET_FPS;
 
     timer_set_fps(&game_timer,TARGET_FPS);
+    timer_set_vsync(&game_timer,vsync_enabled);
     timer_begin(&game_timer);
-    double curr_time = timer_get_time();
-    double new_time  = 0.0;
-    double accum = 0.0;
-    const double dt = 1.0/TARGET_FPS;
 
     back_to_home = false;
 
+    sim_start();
+
+    mutex_lock(&world_lock);
+    sim_update = _update;
+    sim_screen = _screen;
+    sim_is_client = is_client;
+    fixed_step_init(&sim_step, dt, FIXED_STEP_MAX_STEPS);
+    sim_tick_time = timer_get_time();
+    poses_save_prior();
+    mutex_unlock(&world_lock);
+
+    double frame_work = 0.0;
+
     // loop
     for(;;)
     {
-        new_time = timer_get_time();
-        double frame_time = new_time - curr_time;
-        curr_time = new_time;
-        accum += frame_time;
+        mutex_lock(&world_lock);
+
+        double frame_start = timer_get_time();
+        particles_budget_update(frame_work, dt);
 
+        // edges are per render frame for imgui, ticks take latched presses instead
+        window_mouse_update_actions();
         window_poll_events();
-        if(window_should_close())
-            break;
 
+        bool done = window_should_close() || back_to_home || screen != _screen;
         if(back_to_home)
-        {
             net_client_disconnect();
+
+        if(done)
+        {
+            sim_update = NULL;
+            mutex_unlock(&world_lock);
             break;
         }
 
-        if(screen != _screen)
-            break;
+        TimerPacing* pacing = &game_timer.pacing;
 
-        while(accum >= dt)
+        PROFILE_BEGIN("frame");
+
+        // without a simulation thread the ticks run here like they used to
+        if(!sim_running)
         {
-            if(_update != NULL) _update(dt, is_client);
-            accum -= dt;
+            PROFILE_BEGIN("update");
+            sim_run_due_ticks(timer_get_time());
+            PROFILE_END();
         }
 
+        PROFILE_BEGIN("draw");
+        poses_interpolate(RANGE((timer_get_time() - sim_tick_time)/dt, 0.0, 1.0));
+
+        gfx_set_render_layer(LAYER_BACKGROUND);
         if (_draw != NULL) {
             _draw(is_client);
         }
 
+        if(profiler_enabled)
+        {
+            gfx_set_render_layer(LAYER_HUD);
+            profiler_draw_overlay(view_width - 420, 10);
+
+            ParticleStats pstats = particles_get_stats();
+
+            imgui_begin("Frame Pacing", 10, view_height - 140);
+                imgui_text("Late:      %6.3f ms (max %6.3f)", 1000.0*pacing->late_sum/MAX(pacing->frames,1), 1000.0*pacing->late_max);
+                imgui_text("Oversleep: %6.3f ms (max %6.3f)", 1000.0*pacing->oversleep_sum/MAX(pacing->sleeps,1), 1000.0*pacing->oversleep_max);
+                imgui_text("Spin margin: %.3f ms", 1000.0*game_timer.sleep_margin);
+                imgui_text("Sim: %llu overruns, %llu steps dropped, speed %.2fx",
+                           (unsigned long long)sim_step.overruns, (unsigned long long)sim_step.dropped_steps, sim_step.time_scale);
+                imgui_text("Particles: %d/%d, throttle %.2f, %llu dropped, %llu shed",
+                           pstats.alive, pstats.max_particles, pstats.throttle,
+                           (unsigned long long)pstats.particles_dropped, (unsigned long long)pstats.spawners_shed);
+                if(imgui_button("Reset"))
+                    timer_reset_pacing(&game_timer);
+            imgui_end();
+        }
+
+        poses_restore();
+        PROFILE_END();
+
+        frame_work = timer_get_time() - frame_start;
+        mutex_unlock(&world_lock);
+
+        PROFILE_BEGIN("wait");
         timer_wait_for_frame(&game_timer);
+        PROFILE_END();
 
+        PROFILE_BEGIN("swap");
+        double flush_start = timer_get_time();
+        gfx_flush();
+        frame_work += timer_get_time() - flush_start;
         window_swap_buffers();
-        window_mouse_update_actions();
+        PROFILE_END();
+
+        PROFILE_END();
+        PROFILE_FRAME_END();
+    }
+
+    TimerPacing* pacing = &game_timer.pacing;
+    LOGI("Frame pacing: %d frames, late %.3f ms (max %.3f), oversleep %.3f ms (max %.3f)",
+         pacing->frames,
+         1000.0*pacing->late_sum/MAX(pacing->frames,1), 1000.0*pacing->late_max,
+         1000.0*pacing->oversleep_sum/MAX(pacing->sleeps,1), 1000.0*pacing->oversleep_max);
+
+    ParticleStats pstats = particles_get_stats();
+    LOGI("Particles: %llu dropped, %llu spawners shed, %llu spawns failed",
+         (unsigned long long)pstats.particles_dropped, (unsigned long long)pstats.spawners_shed,
+         (unsigned long long)pstats.spawns_failed);
+}
+
+// =========================
+// Simulation Thread
+// =========================
+
+static void sim_thread_main(void* arg)
+{
+    const double dt = 1.0/TARGET_FPS;
+
+    while(sim_running)
+    {
+        mutex_lock(&world_lock);
+        PROFILE_BEGIN("update");
+        sim_run_due_ticks(timer_get_time());
+        PROFILE_END();
+        double wait = sim_update ? (dt - sim_step.accum)/sim_step.time_scale : dt;
+        mutex_unlock(&world_lock);
+
+        PROFILE_FRAME_END();
+
+        // sleep until roughly the next tick, oversleeping just means two ticks run back to back
+        if(wait > 0.0)
+            timer_delay_us((int)(wait*1000000.0));
+    }
+}
+
+static void sim_start()
+{
+    if(sim_running)
+        return;
+
+    mutex_init(&world_lock);
+    sim_running = true;
+
+    if(!thread_start(&sim_thread, sim_thread_main, NULL))
+    {
+        LOGW("Failed to start the simulation thread, updating on the render thread");
+        sim_running = false;
+    }
+}
+
+static void sim_stop()
+{
+    if(!sim_running)
+        return;
+
+    sim_running = false;
+    thread_join(&sim_thread);
+    mutex_deinit(&world_lock);
+}
+
+// world_lock must be held
+static void sim_run_due_ticks(double now)
+{
+    if(sim_update == NULL)
+        return;
+
+    int steps = fixed_step_advance(&sim_step, now);
+    for(int i = 0; i < steps; ++i)
+    {
+        // an update can switch screens, the next one belongs to the next run_loop()
+        if(screen != sim_screen || back_to_home)
+            break;
+
+        poses_save_prior();
+        sim_update(sim_step.dt, sim_is_client);
+        sim_tick_time = timer_get_time();
+    }
+}
+
+static void poses_save_prior()
+{
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+        player_poses_prior[i].pos = players[i].pos;
+        player_poses_prior[i].angle_deg = players[i].angle_deg;
+    }
+
+    num_projectile_poses_prior = plist->count;
+    for(int i = 0; i < plist->count; ++i)
+    {
+        projectile_poses_prior[i].id = projectiles[i].id;
+        projectile_poses_prior[i].pos = projectiles[i].pos;
+        projectile_poses_prior[i].angle_deg = projectiles[i].angle_deg;
+    }
+}
+
+static bool pose_lerp(RenderPose* prior, Vector2f* pos, float* angle_deg, float t)
+{
+    float dx = pos->x - prior->pos.x;
+    float dy = pos->y - prior->pos.y;
+    if(dx*dx + dy*dy > SIM_LERP_MAX_DIST*SIM_LERP_MAX_DIST)
+        return false;
+
+    // shortest way around
+    float da = fmodf(*angle_deg - prior->angle_deg, 360.0);
+    if(da > 180.0) da -= 360.0;
+    else if(da < -180.0) da += 360.0;
+
+    pos->x = prior->pos.x + dx*t;
+    pos->y = prior->pos.y + dy*t;
+    *angle_deg = prior->angle_deg + da*t;
+    return true;
+}
+
+// world_lock must be held until poses_restore()
+static void poses_interpolate(float t)
+{
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+        Player* p = &players[i];
+        player_poses_live[i].pos = p->pos;
+        player_poses_live[i].angle_deg = p->angle_deg;
+        pose_lerp(&player_poses_prior[i], &p->pos, &p->angle_deg, t);
+    }
+
+    for(int i = 0; i < plist->count; ++i)
+    {
+        Projectile* proj = &projectiles[i];
+        projectile_pose_swapped[i] = false;
+
+        // removals shift the list, only slots that still hold the same projectile are blended
+        if(i >= num_projectile_poses_prior || projectile_poses_prior[i].id != proj->id)
+            continue;
+
+        projectile_poses_live[i].pos = proj->pos;
+        projectile_poses_live[i].angle_deg = proj->angle_deg;
+        projectile_pose_swapped[i] = pose_lerp(&projectile_poses_prior[i], &proj->pos, &proj->angle_deg, t);
+    }
+}
+
+static void poses_restore()
+{
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+        players[i].pos = player_poses_live[i].pos;
+        players[i].angle_deg = player_poses_live[i].angle_deg;
+    }
+
+    for(int i = 0; i < plist->count; ++i)
+    {
+        if(!projectile_pose_swapped[i])
+            continue;
+        projectiles[i].pos = projectile_poses_live[i].pos;
+        projectiles[i].angle_deg = projectile_poses_live[i].angle_deg;
     }
 }
 
@@ -742,11 +1089,12 @@ void draw_game_start(bool is_client)
     uint8_t g = background_color >> 8;
     uint8_t b = background_color >> 0;
 
-    gfx_clear_lines();
     gfx_clear_buffer(r,g,b);
 
     stars_draw();
 
+    gfx_set_render_layer(LAYER_HUD);
+
     if(is_client)
     {
 
@@ -790,25 +1138,28 @@ void draw_game_start(bool is_client)
 
             // projectiles
             // -----------------------------------------------------------------------
+            gfx_set_render_layer(LAYER_PROJECTILES);
             for(int i = 0; i < plist->count; ++i)
             {
                 projectile_draw(&projectiles[i]);
             }
 
+            gfx_set_render_layer(LAYER_PARTICLES_BELOW);
             particles_draw_layer(0);
 
             // players
             // -----------------------------------------------------------------------
+            gfx_set_render_layer(LAYER_PLAYERS);
             for(int i = 0; i < MAX_PLAYERS; ++i)
             {
                 Player* p = &players[i];
                 player_draw(p);
             }
 
+            gfx_set_render_layer(LAYER_PARTICLES_ABOVE);
             particles_draw_layer(1);
 
-            gfx_draw_lines();
-
+            gfx_set_render_layer(LAYER_HUD);
             player_list_draw();
         }
 
@@ -887,18 +1238,22 @@ void draw_game_end(bool is_client)
     uint8_t b = background_color >> 0;
 
     gfx_clear_buffer(r,g,b);
-    gfx_clear_lines();
 
     gfx_draw_rect(&world_box, COLOR_BLACK, 0.0, 1.0, 1.0, false, true);
 
     stars_draw();
 
+    gfx_set_render_layer(LAYER_PARTICLES_BELOW);
     particles_draw_layer(0);
 
+    gfx_set_render_layer(LAYER_PLAYERS);
     player_draw(&players[winner_index]);
 
+    gfx_set_render_layer(LAYER_PARTICLES_ABOVE);
     particles_draw_layer(1);
 
+    gfx_set_render_layer(LAYER_HUD);
+
     char text[100] = {0};
     sprintf(text, "%s wins!", players[winner_index].settings.name);
     float title_scale = 1.0;
@@ -923,6 +1278,12 @@ void draw_game_end(bool is_client)
 
 void simulate(double dt)
 {
+    PROFILE_BEGIN("simulate");
+
+    // taken every tick so presses while paused don't fire later
+    bool leftc = window_mouse_left_take_press();
+    bool rightc = window_mouse_right_take_press();
+
     if(!paused)
     {
         projectile_update(dt);
@@ -935,8 +1296,6 @@ void simulate(double dt)
 
         if(role == ROLE_LOCAL)
         {
-            bool leftc = window_mouse_left_went_down();
-            bool rightc = window_mouse_right_went_down();
             if(leftc || rightc)
             {
                 Rect r = {0};
@@ -959,12 +1318,8 @@ void simulate(double dt)
                             player2 = p;
                             player_set_controls();
 
-                            ParticleEffect e = mouse_click_effect;
-                            // e.scale.init_min = 
-                            e.color1 = COLOR(0,0xff,0);
-                            e.color2 = e.color1;
-                            e.color3 = e.color1;
-                            particles_spawn_effect(mx,my,1, &e,1.0,true,false);
+                            ParticleOverrides o = {.color = COLOR(0,0xff,0), .use_color = true};
+                            particles_spawn_effect(mx,my,1, effect_handles[EFFECT_PLAYER_ACTIVATE], &o,1.0,true,false);
                             text_list_add(text_lst, 5.0, "Controlling %s", p->settings.name);
 
                         }
@@ -974,22 +1329,16 @@ void simulate(double dt)
                             p->ai = !p->ai;
                             if(p->ai)
                             {
-                                ParticleEffect e = mouse_click_effect;
-                                e.color1 = COLOR(0xff,0,0);
-                                e.color2 = e.color1;
-                                e.color3 = e.color1;
-                                particles_spawn_effect(mx,my,1, &e,1.0,true,false);
+                                ParticleOverrides o = {.color = COLOR(0xff,0,0), .use_color = true};
+                                particles_spawn_effect(mx,my,1, effect_handles[EFFECT_PLAYER_ACTIVATE], &o,1.0,true,false);
                                 text_list_add(text_lst, 5.0, "AI enabled for %s", p->settings.name);
                             }
                             else
                             {
                                 p->actions[PLAYER_ACTION_SHOOT].state = false;
 
-                                ParticleEffect e = mouse_click_effect;
-                                e.color1 = COLOR(0,0,0xff);
-                                e.color2 = e.color1;
-                                e.color3 = e.color1;
-                                particles_spawn_effect(mx,my,1, &e,1.0,true,false);
+                                ParticleOverrides o = {.color = COLOR(0,0,0xff), .use_color = true};
+                                particles_spawn_effect(mx,my,1, effect_handles[EFFECT_PLAYER_ACTIVATE], &o,1.0,true,false);
                                 text_list_add(text_lst, 5.0, "AI disabled for %s", p->settings.name);
                             }
                         }
@@ -1006,10 +1355,14 @@ void simulate(double dt)
     }
 
     if(!paused) projectile_handle_collisions(dt);
+
+    PROFILE_END();
 }
 
 void simulate_client(double dt)
 {
+    PROFILE_BEGIN("simulate_client");
+
     //projectile_update(dt);
     //player_update(player,dt); // client-side prediction
 
@@ -1051,6 +1404,7 @@ void simulate_client(double dt)
         }
     }
 
+    PROFILE_END();
 }
 
 
@@ -1137,7 +1491,6 @@ void draw_game(bool is_client)
     uint8_t b = background_color >> 0;
 
     gfx_clear_buffer(r,g,b);
-    gfx_clear_lines();
 
     gfx_draw_rect(&world_box, COLOR_BLACK, 0.0, 1.0, 1.0, false, true);
 
@@ -1146,6 +1499,7 @@ void draw_game(bool is_client)
 
     // projectiles
     // -----------------------------------------------------------------------
+    gfx_set_render_layer(LAYER_PROJECTILES);
     for(int i = 0; i < plist->count; ++i)
     {
         projectile_draw(&projectiles[i]);
@@ -1155,21 +1509,24 @@ void draw_game(bool is_client)
     // -----------------------------------------------------------------------
     powerups_draw();
 
+    gfx_set_render_layer(LAYER_PARTICLES_BELOW);
     particles_draw_layer(0);
 
 
     // players
     // -----------------------------------------------------------------------
+    gfx_set_render_layer(LAYER_PLAYERS);
     for(int i = 0; i < MAX_PLAYERS; ++i)
     {
         Player* p = &players[i];
         player_draw(p);
     }
 
+    gfx_set_render_layer(LAYER_PARTICLES_ABOVE);
     particles_draw_layer(1);
 
 
-    gfx_draw_lines();
+    gfx_set_render_layer(LAYER_HUD);
 
     if(true)
     {
@@ -1231,13 +1588,11 @@ void stars_update()
 
 void stars_draw()
 {
-    gfx_sprite_batch_begin(true);
     for(int i = 0; i < NUM_STARS; ++i)
     {
         // gfx_sprite_batch_add(stars_image, 0, stars[i].x, stars[i].y, COLOR_WHITE, false, stars_size[i], 0.0, 1.0, true, true, false);
         gfx_sprite_batch_add(stars_image, 0, stars[i].x, stars[i].y, COLOR_WHITE, false, stars_size[i], 0.0, 1.0, true, true, false);
     }
-    gfx_sprite_batch_draw();
 }
 
 void key_cb(GLFWwindow* window, int key, int scan_code, int action, int mods)
@@ -1275,6 +1630,15 @@ void key_cb(GLFWwindow* window, int key, int scan_code, int action, int mods)
             {
                 game_debug_enabled = !game_debug_enabled;
             }
+            else if(key == GLFW_KEY_F4)
+            {
+                profiler_enabled = !profiler_enabled;
+            }
+            else if(key == GLFW_KEY_F5)
+            {
+                if(profiler_export_chrome_trace("client_trace.json"))
+                    text_list_add(text_lst, 3.0, "Saved profiler trace to client_trace.json");
+            }
             else if(key == GLFW_KEY_ENTER)
             {
                 if(screen == SCREEN_GAME_START && role == ROLE_LOCAL)
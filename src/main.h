@@ -32,6 +32,17 @@ typedef enum
     GAME_STATUS_MAX
 } GameStatus;
 
+// render queue layers, drawn bottom to top
+typedef enum
+{
+    LAYER_BACKGROUND = 0,
+    LAYER_PROJECTILES,
+    LAYER_PARTICLES_BELOW,
+    LAYER_PLAYERS,
+    LAYER_PARTICLES_ABOVE,
+    LAYER_HUD,
+} RenderLayer;
+
 typedef enum
 {
     SCREEN_SERVER,
@@ -77,6 +88,9 @@ extern bool back_to_menu;
 extern bool paused;
 extern bool debug_enabled;
 extern bool game_debug_enabled;
+extern bool profiler_enabled;
+extern bool render_offscreen; // init() draws into an FBO of a hidden window
+extern bool vsync_enabled;
 extern int num_players;
 extern float game_end_counter;
 extern uint8_t winner_index;
@@ -94,5 +108,9 @@ extern Settings menu_settings;
 extern bool can_target_player;
 extern bool easy_movement;
 
+void init();
+void init_server();
+void deinit();
+void draw_game(bool is_client);
 bool is_in_world(Rect* r);
 Vector2f limit_rect_pos(Rect* limit, Rect* rect);
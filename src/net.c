@@ -6,11 +6,15 @@
 #include <sys/select.h>
 #endif
 
+#include <signal.h>
+
 #include "core/socket.h"
 #include "core/timer.h"
 #include "core/window.h"
 #include "core/log.h"
 #include "core/circbuf.h"
+#include "core/metrics.h"
+#include "core/profiler.h"
 
 #include "main.h"
 #include "net.h"
@@ -32,13 +36,32 @@
 
 #define GAME_ID 0xC68BB822
 #define PORT 27001
+#define STATS_PORT 27002 // JSON metrics are pushed to this port on localhost
+
+#define METRICS_FILE   "server_metrics.jsonl"
+#define METRICS_PERIOD 10.0f // seconds
+#define TRACE_FILE     "server_trace.json" // written when TRACE_SIGNAL is received
+
+// serializing the trace takes long enough to hitch a tick, so it's only done on request
+#if _WIN32
+#define TRACE_SIGNAL SIGBREAK // ctrl+break in the server console
+#else
+#define TRACE_SIGNAL SIGUSR1  // kill -USR1 <pid>
+#endif
 
 #define MAXIMUM_RTT 1.0f
+#define TIME_SAMPLES 8
 
 #define DEFAULT_TIMEOUT 1.0f // seconds
 #define PING_PERIOD 3.0f
 #define DISCONNECTION_TIMEOUT 7.0f // seconds
 #define INPUT_QUEUE_MAX 16
+#define INPUT_REDUNDANCY 12 // number of most recent inputs carried in every INPUT packet
+
+// server input jitter buffer, in ticks
+#define JITTER_DEPTH_MIN 2
+#define JITTER_DEPTH_MAX 8
+#define JITTER_WINDOW    ((int)TARGET_FPS) // steps between depth reductions
 
 typedef struct
 {
@@ -47,6 +70,44 @@ typedef struct
     uint16_t remote_latest_packet_id;
 } NodeInfo;
 
+typedef struct
+{
+    int32_t rtt;    // us
+    int32_t offset; // us
+} TimeSample;
+
+// NTP-style rtt and clock offset estimation from the timestamps echoed in packet headers
+typedef struct
+{
+    TimeSample samples[TIME_SAMPLES];
+    int sample_count;
+    int sample_index;
+    double srtt;    // smoothed rtt (ms)
+    double rtt_var; // variance of rtt (ms^2)
+    double offset;  // remote clock minus local clock (ms)
+
+    uint32_t remote_time;      // time of the latest packet from the peer
+    uint32_t remote_time_recv; // local time that packet arrived
+} TimeEstimator;
+
+// Holds a client's inputs so exactly one is released per server sim step
+typedef struct
+{
+    NetPlayerInput inputs[INPUT_QUEUE_MAX]; // ring, ordered by tick
+    int head;
+    int count;
+    int depth;          // ticks to buffer before playing
+    bool playing;
+    uint32_t play_tick; // tick released on the latest step
+    NetPlayerInput last;
+
+    int window_steps;
+    int window_min_count;
+
+    uint32_t underflows;
+    uint32_t overflows;
+} InputJitterBuffer;
+
 // Info server stores about a client
 typedef struct
 {
@@ -61,8 +122,9 @@ typedef struct
     ConnectionRejectionReason last_reject_reason;
     PacketError last_packet_error;
     Packet prior_state_pkt;
-    NetPlayerInput net_player_inputs[INPUT_QUEUE_MAX];
-    int input_count;
+    InputJitterBuffer input_buffer;
+    uint32_t input_tick; // newest input tick received
+    TimeEstimator time_est;
 } ClientInfo;
 
 struct
@@ -73,6 +135,27 @@ struct
     int num_clients;
 } server = {0};
 
+// metric ids, registered in server_metrics_init()
+static struct
+{
+    int step_time;
+    int tick_overruns;
+    int tick_budget_overruns;
+    int ticks_dropped;
+    int time_scale;
+    int packets_in[PACKET_TYPE_ERROR+1];
+    int bytes_in[PACKET_TYPE_ERROR+1];
+    int packets_out[PACKET_TYPE_ERROR+1];
+    int bytes_out[PACKET_TYPE_ERROR+1];
+    int drop_bad_format;
+    int drop_auth_failed;
+    int drop_not_latest;
+    int input_underflows;
+    int input_overflows;
+    int num_clients;
+    int client_rtt[MAX_CLIENTS];
+} server_metrics;
+
 // ---
 
 #define IMAX_BITS(m) ((m)/((m)%255+1) / 255%255*8 + 7-86/((m)%255+12))
@@ -80,9 +163,7 @@ struct
 
 // ---
 
-static NetPlayerInput net_player_inputs[INPUT_QUEUE_MAX]; // shared
-static int input_count = 0;
-static int inputs_per_packet = 1.0; //(TARGET_FPS/TICK_RATE);
+static int input_count = 0; // inputs added since the last INPUT packet
 
 
 static inline void pack_u8(Packet* pkt, uint8_t d);
@@ -103,6 +184,119 @@ static inline void unpack_bytes(Packet* pkt, uint8_t* d, int len, int* offset);
 static inline uint8_t unpack_string(Packet* pkt, char* s, int maxlen, int* offset);
 static inline Vector2f unpack_vec2(Packet* pkt, int* offset);
 
+// Records that make up the STATE, SETTINGS and INPUT payloads. The send and
+// receive paths and net_bench_packing() all go through these so the wire
+// format is only written down once.
+
+typedef struct
+{
+    uint8_t id;
+    Vector2f pos;
+    float angle;
+    float energy;
+    float hp;
+    uint8_t deaths;
+    bool invincible;
+} PlayerStateRecord;
+
+typedef struct
+{
+    uint16_t id;
+    Vector2f pos;
+    float angle;
+    uint8_t player_id;
+} ProjectileStateRecord;
+
+typedef struct
+{
+    uint8_t type;
+    Vector2f pos;
+} PowerupStateRecord;
+
+static inline void pack_player_state(Packet* pkt, uint8_t id, Player* p)
+{
+    pack_u8(pkt, id);
+    pack_vec2(pkt, p->pos);
+    pack_float(pkt, p->angle_deg);
+    pack_float(pkt, p->energy);
+    pack_float(pkt, p->hp);
+    pack_u8(pkt, p->deaths);
+    pack_u8(pkt, p->invincible ? 0x01 : 0x00);
+}
+
+static inline void unpack_player_state(Packet* pkt, int* offset, PlayerStateRecord* r)
+{
+    r->id         = unpack_u8(pkt, offset);
+    r->pos        = unpack_vec2(pkt, offset);
+    r->angle      = unpack_float(pkt, offset);
+    r->energy     = unpack_float(pkt, offset);
+    r->hp         = unpack_float(pkt, offset);
+    r->deaths     = unpack_u8(pkt, offset);
+    r->invincible = (unpack_u8(pkt, offset) == 0x01);
+}
+
+static inline void pack_projectile_state(Packet* pkt, Projectile* proj)
+{
+    pack_u16(pkt, proj->id);
+    pack_vec2(pkt, proj->pos);
+    pack_float(pkt, proj->angle_deg);
+    pack_u8(pkt, proj->player_id);
+}
+
+static inline void unpack_projectile_state(Packet* pkt, int* offset, ProjectileStateRecord* r)
+{
+    r->id        = unpack_u16(pkt, offset);
+    r->pos       = unpack_vec2(pkt, offset);
+    r->angle     = unpack_float(pkt, offset);
+    r->player_id = unpack_u8(pkt, offset);
+}
+
+static inline void pack_powerup_state(Packet* pkt, Powerup* pup)
+{
+    pack_u8(pkt, (uint8_t)pup->type);
+    pack_vec2(pkt, pup->pos);
+}
+
+static inline void unpack_powerup_state(Packet* pkt, int* offset, PowerupStateRecord* r)
+{
+    r->type = unpack_u8(pkt, offset);
+    r->pos  = unpack_vec2(pkt, offset);
+}
+
+static inline void pack_player_settings(Packet* pkt, Settings* settings)
+{
+    pack_u8(pkt, settings->sprite_index);
+    pack_u32(pkt, settings->color);
+    pack_string(pkt, settings->name, PLAYER_NAME_MAX);
+}
+
+// returns the length of the name
+static inline uint8_t unpack_player_settings(Packet* pkt, int* offset, Settings* settings)
+{
+    settings->sprite_index = unpack_u8(pkt, offset);
+    settings->color = unpack_u32(pkt, offset);
+    return unpack_string(pkt, settings->name, PLAYER_NAME_MAX, offset);
+}
+
+// keys are ordered oldest first, the newest belongs to newest_tick
+static inline void pack_inputs(Packet* pkt, uint32_t newest_tick, uint16_t* keys, int count)
+{
+    pack_u32(pkt, newest_tick);
+    pack_u8(pkt, (uint8_t)count);
+    for(int i = 0; i < count; ++i)
+        pack_u16(pkt, keys[i]);
+}
+
+// returns the number of keys read, at most INPUT_REDUNDANCY
+static inline int unpack_inputs(Packet* pkt, int* offset, uint32_t* newest_tick, uint16_t keys[INPUT_REDUNDANCY])
+{
+    *newest_tick = unpack_u32(pkt, offset);
+    int count = MIN(unpack_u8(pkt, offset), INPUT_REDUNDANCY);
+    for(int i = 0; i < count; ++i)
+        keys[i] = unpack_u16(pkt, offset);
+    return count;
+}
+
 static uint64_t rand64(void)
 {
     uint64_t r = 0;
@@ -126,6 +320,61 @@ static inline bool is_packet_id_greater(uint16_t id, uint16_t cmp)
            ((id <= cmp) && (cmp - id  > 32768));
 }
 
+static inline uint32_t net_time_us()
+{
+    return (uint32_t)(uint64_t)(timer_get_time()*1000000.0);
+}
+
+static void time_estimator_recv(TimeEstimator* te, PacketHeader* hdr, uint32_t recv_time)
+{
+    te->remote_time = hdr->time;
+    te->remote_time_recv = recv_time;
+
+    if(hdr->echo_time == 0)
+        return;
+
+    // t0: we sent, t1: peer received, t2: peer sent, t3: we received
+    uint32_t t0 = hdr->echo_time;
+    uint32_t t2 = hdr->time;
+    uint32_t t1 = t2 - hdr->echo_delay;
+    uint32_t t3 = recv_time;
+
+    int32_t rtt = (int32_t)(t3 - t0) - (int32_t)(t2 - t1);
+    if(rtt < 0 || rtt > MAXIMUM_RTT*1000000)
+        return;
+
+    int64_t offset = ((int64_t)(int32_t)(t1 - t0) + (int64_t)(int32_t)(t2 - t3)) / 2;
+
+    TimeSample* sample = &te->samples[te->sample_index];
+    sample->rtt = rtt;
+    sample->offset = (int32_t)offset;
+    te->sample_index = (te->sample_index + 1) % TIME_SAMPLES;
+    te->sample_count = MIN(te->sample_count+1, TIME_SAMPLES);
+
+    double rtt_ms = rtt / 1000.0;
+    if(te->sample_count == 1)
+    {
+        te->srtt = rtt_ms;
+        te->rtt_var = 0.0;
+    }
+    else
+    {
+        double err = rtt_ms - te->srtt;
+        te->srtt += err / 8.0;
+        te->rtt_var += (err*err - te->rtt_var) / 4.0;
+    }
+
+    // the lowest rtt sample had the least queuing, so its offset is the most trustworthy
+    int best = 0;
+    for(int i = 1; i < te->sample_count; ++i)
+    {
+        if(te->samples[i].rtt < te->samples[best].rtt)
+            best = i;
+    }
+    te->offset = te->samples[best].offset / 1000.0;
+}
+
+
 static char* packet_type_to_str(PacketType type)
 {
     switch(type)
@@ -237,11 +486,26 @@ static bool has_data_waiting(int socket)
     return has_data;
 }
 
-static int net_send(NodeInfo* node_info, Address* to, Packet* pkt)
+// te is the estimator of the node being sent to, its echo fields go in the header
+static int net_send(NodeInfo* node_info, Address* to, Packet* pkt, TimeEstimator* te)
 {
+    pkt->hdr.time = net_time_us();
+
+    if(te)
+    {
+        pkt->hdr.echo_time = te->remote_time;
+        pkt->hdr.echo_delay = pkt->hdr.time - te->remote_time_recv;
+    }
+
     int pkt_len = get_packet_size(pkt);
     int sent_bytes = socket_sendto(node_info->socket, to, (uint8_t*)pkt, pkt_len);
 
+    if(node_info == &server.info && pkt->hdr.type <= PACKET_TYPE_ERROR)
+    {
+        metrics_counter_add(server_metrics.packets_out[pkt->hdr.type], 1);
+        metrics_counter_add(server_metrics.bytes_out[pkt->hdr.type], sent_bytes);
+    }
+
 #if SERVER_PRINT_SIMPLE==1
     print_packet_simple(pkt,"SEND");
 #elif SERVER_PRINT_VERBOSE==1
@@ -353,9 +617,87 @@ static void update_server_num_clients()
     server.num_clients = num_clients;
 }
 
+static void jitter_buffer_drop_oldest(InputJitterBuffer* jb)
+{
+    jb->head = (jb->head + 1) % INPUT_QUEUE_MAX;
+    jb->count--;
+}
+
+static void jitter_buffer_push(InputJitterBuffer* jb, NetPlayerInput* input)
+{
+    if(jb->playing && input->tick <= jb->play_tick)
+        return; // too late, that tick has already been played
+
+    if(jb->count >= INPUT_QUEUE_MAX)
+    {
+        jitter_buffer_drop_oldest(jb);
+        jb->overflows++;
+        metrics_counter_add(server_metrics.input_overflows, 1);
+    }
+
+    int index = (jb->head + jb->count) % INPUT_QUEUE_MAX;
+    memcpy(&jb->inputs[index], input, sizeof(NetPlayerInput));
+    jb->count++;
+}
+
+// returns the input to apply for this sim step
+static NetPlayerInput* jitter_buffer_pop(InputJitterBuffer* jb)
+{
+    if(jb->depth == 0)
+        jb->depth = JITTER_DEPTH_MIN;
+
+    if(!jb->playing)
+    {
+        if(jb->count < jb->depth)
+            return &jb->last; // still filling
+
+        jb->playing = true;
+        jb->play_tick = jb->inputs[jb->head].tick - 1;
+        jb->window_steps = 0;
+        jb->window_min_count = jb->count;
+    }
+
+    jb->play_tick++;
+
+    if(jb->count > 0 && jb->inputs[jb->head].tick == jb->play_tick)
+    {
+        memcpy(&jb->last, &jb->inputs[jb->head], sizeof(NetPlayerInput));
+        jitter_buffer_drop_oldest(jb);
+    }
+    else
+    {
+        // missing input, hold the prior keys and rebuffer deeper. the tick stays
+        // unplayed so a late input for it is still accepted
+        jb->underflows++;
+        metrics_counter_add(server_metrics.input_underflows, 1);
+        jb->depth = MIN(jb->depth+1, JITTER_DEPTH_MAX);
+        jb->play_tick--;
+        jb->playing = false;
+        return &jb->last;
+    }
+
+    // buffered more than needed for a whole window, catch up by skipping the next tick
+    jb->window_min_count = MIN(jb->window_min_count, jb->count);
+    if(++jb->window_steps >= JITTER_WINDOW)
+    {
+        if(jb->window_min_count > 1 && jb->inputs[jb->head].tick == jb->play_tick+1)
+        {
+            jitter_buffer_drop_oldest(jb);
+            jb->play_tick++;
+            jb->depth = MAX(jb->depth-1, JITTER_DEPTH_MIN);
+        }
+        jb->window_steps = 0;
+        jb->window_min_count = jb->count;
+    }
+
+    return &jb->last;
+}
+
 static void remove_client(ClientInfo* cli)
 {
     LOGN("Remove client.");
+    LOGN("Input buffer: depth %d, underflows %u, overflows %u", cli->input_buffer.depth, cli->input_buffer.underflows, cli->input_buffer.overflows);
+    metrics_gauge_set(server_metrics.client_rtt[cli->client_id], 0.0); // the slot is empty now
     cli->state = DISCONNECTED;
     cli->remote_latest_packet_id = 0;
     players[cli->client_id].active = false;
@@ -391,14 +733,14 @@ static void server_send(PacketType type, ClientInfo* cli)
             pack_bytes(&pkt, cli->client_salt, 8);
             pack_bytes(&pkt, cli->server_salt, 8);
 
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
         } break;
 
         case PACKET_TYPE_CONNECT_ACCEPTED:
         {
             cli->state = CONNECTED;
             pack_u8(&pkt, (uint8_t)cli->client_id);
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
 
             server_send_message(TO_ALL, FROM_SERVER, "client added %u", cli->client_id);
         } break;
@@ -406,12 +748,12 @@ static void server_send(PacketType type, ClientInfo* cli)
         case PACKET_TYPE_CONNECT_REJECTED:
         {
             pack_u8(&pkt, (uint8_t)cli->last_reject_reason);
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
         } break;
 
         case PACKET_TYPE_PING:
             pkt.data_len = 0;
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
             break;
 
         case PACKET_TYPE_STATE:
@@ -428,16 +770,7 @@ static void server_send(PacketType type, ClientInfo* cli)
             {
                 if(server.clients[i].state == CONNECTED)
                 {
-                    Player* p = &players[i];
-                    pack_u8(&pkt,(uint8_t)i);
-
-                    pack_vec2(&pkt,p->pos);
-                    pack_float(&pkt, p->angle_deg);
-                    pack_float(&pkt,p->energy);
-                    pack_float(&pkt,p->hp);
-                    pack_u8(&pkt,p->deaths);
-                    pack_u8(&pkt,p->invincible ? 0x01 : 0x00);
-
+                    pack_player_state(&pkt, (uint8_t)i, &players[i]);
                     num_clients++;
                 }
             }
@@ -452,10 +785,7 @@ static void server_send(PacketType type, ClientInfo* cli)
 
             for(int i = 0; i < plist->count; ++i)
             {
-                pack_u16(&pkt,projectiles[i].id);
-                pack_vec2(&pkt,projectiles[i].pos);
-                pack_float(&pkt,projectiles[i].angle_deg);
-                pack_u8(&pkt,projectiles[i].player_id);
+                pack_projectile_state(&pkt, &projectiles[i]);
             }
 
             // powerups
@@ -472,9 +802,7 @@ static void server_send(PacketType type, ClientInfo* cli)
                     continue;
 
                 num_active_powerups++;
-
-                pack_u8(&pkt, (uint8_t)pup->type);
-                pack_vec2(&pkt, pup->pos);
+                pack_powerup_state(&pkt, pup);
             }
 
             pkt.data[tindex] = num_active_powerups;
@@ -484,7 +812,7 @@ static void server_send(PacketType type, ClientInfo* cli)
             if(memcmp(&cli->prior_state_pkt.data, &pkt.data, pkt.data_len) == 0)
                 break;
 
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
             memcpy(&cli->prior_state_pkt, &pkt, get_packet_size(&pkt));
 
         } break;
@@ -492,7 +820,7 @@ static void server_send(PacketType type, ClientInfo* cli)
         case PACKET_TYPE_ERROR:
         {
             pack_u8(&pkt, (uint8_t)cli->last_packet_error);
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
         } break;
 
         case PACKET_TYPE_SETTINGS:
@@ -506,9 +834,7 @@ static void server_send(PacketType type, ClientInfo* cli)
                 if (server.clients[i].state == CONNECTED)
                 {
                     pack_u8(&pkt, (uint8_t)i);
-                    pack_u8(&pkt, players[i].settings.sprite_index);
-                    pack_u32(&pkt, players[i].settings.color);
-                    pack_string(&pkt, players[i].settings.name, PLAYER_NAME_MAX);
+                    pack_player_settings(&pkt, &players[i].settings);
 
                     LOGNV("Sending Settings, Client ID: %d", i);
                     LOGNV("  color: 0x%08x", players[i].settings.color);
@@ -521,14 +847,14 @@ static void server_send(PacketType type, ClientInfo* cli)
 
             pkt.data[0] = num_clients;
 
-            net_send(&server.info, &cli->address, &pkt);
+            net_send(&server.info, &cli->address, &pkt,&cli->time_est);
         } break;
 
         case PACKET_TYPE_GAME_SETTINGS:
         {
             pack_u8(&pkt, game_settings.num_lives);
 
-            net_send(&server.info, &cli->address, &pkt);
+            net_send(&server.info, &cli->address, &pkt,&cli->time_est);
         } break;
 
         case PACKET_TYPE_DISCONNECT:
@@ -537,7 +863,7 @@ static void server_send(PacketType type, ClientInfo* cli)
             pkt.data_len = 0;
             // redundantly send so packet is guaranteed to get through
             for(int i = 0; i < 3; ++i)
-                net_send(&server.info,&cli->address,&pkt);
+                net_send(&server.info,&cli->address,&pkt,&cli->time_est);
         } break;
 
         default:
@@ -560,28 +886,16 @@ static void server_update_players()
 
         Player* p = &players[cli->client_id];
 
-        //printf("Applying inputs to player. input count: %d\n", cli->input_count);
+        // apply one input per step
+        NetPlayerInput* input = jitter_buffer_pop(&cli->input_buffer);
 
-        if(cli->input_count == 0)
+        for(int j = 0; j < PLAYER_ACTION_MAX; ++j)
         {
-            player_update(p,1.0/TARGET_FPS);
+            bool key_state = (input->keys & ((uint32_t)1<<j)) != 0;
+            p->actions[j].state = key_state;
         }
-        else
-        {
-            for(int i = 0; i < cli->input_count; ++i)
-            {
-                // apply input to player
-                for(int j = 0; j < PLAYER_ACTION_MAX; ++j)
-                {
-                    bool key_state = (cli->net_player_inputs[i].keys & ((uint32_t)1<<j)) != 0;
-                    p->actions[j].state = key_state;
-                }
-
-                player_update(p,cli->net_player_inputs[i].delta_t);
-            }
 
-            cli->input_count = 0;
-        }
+        player_update(p,1.0/TARGET_FPS);
 
     }
 
@@ -715,6 +1029,61 @@ static void server_update_game_status()
 
 }
 
+static void server_metrics_init()
+{
+    char name[METRIC_NAME_MAX+1] = {0};
+
+    metrics_init(METRICS_FILE, STATS_PORT);
+
+    server_metrics.step_time     = metrics_register("server.step_us", METRIC_TYPE_HISTOGRAM);
+    server_metrics.tick_overruns = metrics_register("server.tick_overruns", METRIC_TYPE_COUNTER);
+    server_metrics.tick_budget_overruns = metrics_register("server.tick_budget_overruns", METRIC_TYPE_COUNTER);
+    server_metrics.ticks_dropped = metrics_register("server.ticks_dropped", METRIC_TYPE_COUNTER);
+    server_metrics.time_scale    = metrics_register("server.time_scale", METRIC_TYPE_GAUGE);
+    server_metrics.num_clients   = metrics_register("server.num_clients", METRIC_TYPE_GAUGE);
+
+    for(int i = 0; i <= PACKET_TYPE_ERROR; ++i)
+    {
+        char type_str[32] = {0};
+        strncpy(type_str, packet_type_to_str(i), 31);
+        for(char* c = type_str; *c; ++c)
+        {
+            if(*c == ' ') *c = '_';
+        }
+
+        snprintf(name, METRIC_NAME_MAX, "net.packets_in.%s", type_str);
+        server_metrics.packets_in[i] = metrics_register(name, METRIC_TYPE_COUNTER);
+        snprintf(name, METRIC_NAME_MAX, "net.bytes_in.%s", type_str);
+        server_metrics.bytes_in[i] = metrics_register(name, METRIC_TYPE_COUNTER);
+        snprintf(name, METRIC_NAME_MAX, "net.packets_out.%s", type_str);
+        server_metrics.packets_out[i] = metrics_register(name, METRIC_TYPE_COUNTER);
+        snprintf(name, METRIC_NAME_MAX, "net.bytes_out.%s", type_str);
+        server_metrics.bytes_out[i] = metrics_register(name, METRIC_TYPE_COUNTER);
+    }
+
+    server_metrics.drop_bad_format  = metrics_register("net.drop.bad_format", METRIC_TYPE_COUNTER);
+    server_metrics.drop_auth_failed = metrics_register("net.drop.auth_failed", METRIC_TYPE_COUNTER);
+    server_metrics.drop_not_latest  = metrics_register("net.drop.not_latest", METRIC_TYPE_COUNTER);
+    server_metrics.input_underflows = metrics_register("input.underflows", METRIC_TYPE_COUNTER);
+    server_metrics.input_overflows  = metrics_register("input.overflows", METRIC_TYPE_COUNTER);
+
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        snprintf(name, METRIC_NAME_MAX, "client%d.rtt_ms", i);
+        server_metrics.client_rtt[i] = metrics_register(name, METRIC_TYPE_GAUGE);
+    }
+}
+
+#if PROFILER_ENABLED
+static volatile sig_atomic_t trace_requested = 0;
+
+static void trace_signal_handler(int sig)
+{
+    (void)sig;
+    trace_requested = 1;
+}
+#endif
+
 int net_server_start()
 {
     // init
@@ -739,21 +1108,28 @@ int net_server_start()
     socket_bind(sock, NULL, PORT);
     server.info.socket = sock;
 
+    server_metrics_init();
+    LOGN("Writing metrics to %s and 127.0.0.1:%u every %.0f seconds.", METRICS_FILE, STATS_PORT, METRICS_PERIOD);
+
     LOGN("Server Started with tick rate %f.", TICK_RATE);
 
     double t0=timer_get_time();
     double t1=0.0;
     double accum = 0.0;
 
-    double t0_g=timer_get_time();
-    double t1_g=0.0;
-    double accum_g = 0.0;
+    FixedStep game_step;
+    fixed_step_init(&game_step, 1.0/TARGET_FPS, FIXED_STEP_MAX_STEPS);
 
     const double dt = 1.0/TICK_RATE;
 
+#if PROFILER_ENABLED
+    signal(TRACE_SIGNAL, trace_signal_handler);
+#endif
+
     for(;;)
     {
         // handle connections, receive inputs
+        PROFILE_BEGIN("recv");
         for(;;)
         {
             // Read all pending packets
@@ -768,14 +1144,19 @@ int net_server_start()
             int offset = 0;
 
             int bytes_received = net_recv(&server.info, &from, &recv_pkt);
+            uint32_t recv_time = net_time_us();
 
             if(!validate_packet_format(&recv_pkt))
             {
+                metrics_counter_add(server_metrics.drop_bad_format, 1);
                 LOGN("Invalid packet format!");
-                timer_delay_us(1000); // delay 1ms
                 continue;
             }
 
+            // counted once the type is known to be valid
+            metrics_counter_add(server_metrics.packets_in[recv_pkt.hdr.type], 1);
+            metrics_counter_add(server_metrics.bytes_in[recv_pkt.hdr.type], bytes_received);
+
             ClientInfo* cli = NULL;
 
             int client_id = server_get_client(&from, &cli);
@@ -825,6 +1206,7 @@ int net_server_start()
 
                 if(!auth)
                 {
+                    metrics_counter_add(server_metrics.drop_auth_failed, 1);
                     LOGN("Client Failed authentication");
 
                     if(recv_pkt.hdr.type == PACKET_TYPE_CONNECT_CHALLENGE_RESP)
@@ -836,15 +1218,22 @@ int net_server_start()
                     break;
                 }
 
+                // inputs are deduplicated by tick, so late INPUT packets are still useful
                 bool is_latest = is_packet_id_greater(recv_pkt.hdr.id, cli->remote_latest_packet_id);
-                if(!is_latest)
+
+                // reordered and duplicate packets would skew the rtt and clock offset
+                if(is_latest)
+                    time_estimator_recv(&cli->time_est, &recv_pkt.hdr, recv_time);
+
+                if(!is_latest && recv_pkt.hdr.type != PACKET_TYPE_INPUT)
                 {
+                    metrics_counter_add(server_metrics.drop_not_latest, 1);
                     LOGN("Not latest packet from client. Ignoring...");
-                    timer_delay_us(1000); // delay 1ms
                     break;
                 }
 
-                cli->remote_latest_packet_id = recv_pkt.hdr.id;
+                if(is_latest)
+                    cli->remote_latest_packet_id = recv_pkt.hdr.id;
                 cli->time_of_latest_packet = timer_get_time();
 
                 LOGNV("%s() : %s", __func__, packet_type_to_str(recv_pkt.hdr.type));
@@ -875,11 +1264,23 @@ int net_server_start()
 
                     case PACKET_TYPE_INPUT:
                     {
-                        uint8_t _input_count = unpack_u8(&recv_pkt, &offset);
+                        uint32_t newest_tick;
+                        uint16_t keys[INPUT_REDUNDANCY];
+                        int _input_count = unpack_inputs(&recv_pkt, &offset, &newest_tick, keys);
+
                         for(int i = 0; i < _input_count; ++i)
                         {
-                            // get input, copy into array
-                            unpack_bytes(&recv_pkt, (uint8_t*)&cli->net_player_inputs[cli->input_count++], sizeof(NetPlayerInput), &offset);
+                            NetPlayerInput input = {0};
+                            input.tick = newest_tick - (_input_count - 1 - i);
+                            input.keys = keys[i];
+                            input.delta_t = 1.0/TARGET_FPS;
+
+                            // already have it from an earlier packet
+                            if(input.tick <= cli->input_tick)
+                                continue;
+
+                            jitter_buffer_push(&cli->input_buffer, &input);
+                            cli->input_tick = input.tick;
                         }
                     } break;
 
@@ -887,14 +1288,7 @@ int net_server_start()
                     {
                         Player* p = &players[cli->client_id];
 
-                        uint8_t sprite_index = unpack_u8(&recv_pkt, &offset);
-                        p->settings.sprite_index = sprite_index;
-
-                        uint32_t color = unpack_u32(&recv_pkt, &offset);
-                        p->settings.color = color;
-
-                        memset(p->settings.name, 0, PLAYER_NAME_MAX);
-                        uint8_t namelen = unpack_string(&recv_pkt, p->settings.name, PLAYER_NAME_MAX, &offset);
+                        uint8_t namelen = unpack_player_settings(&recv_pkt, &offset, &p->settings);
 
                         LOGNV("Server Received Settings, Client ID: %d", cli->client_id);
                         LOGNV("  color: 0x%08x", p->settings.color);
@@ -944,17 +1338,27 @@ int net_server_start()
 
             //timer_delay_us(1000); // delay 1ms
         }
+        PROFILE_END();
+
+
+        uint64_t late = game_step.late;
+        uint64_t overruns = game_step.overruns;
+        uint64_t dropped = game_step.dropped_steps;
 
+        int steps = fixed_step_advance(&game_step, timer_get_time());
 
-        t1_g = timer_get_time();
-        double elapsed_time_g = t1_g - t0_g;
-        t0_g = t1_g;
+        metrics_counter_add(server_metrics.tick_overruns, game_step.late - late);
+        metrics_counter_add(server_metrics.tick_budget_overruns, game_step.overruns - overruns);
+        metrics_counter_add(server_metrics.ticks_dropped, game_step.dropped_steps - dropped);
+        metrics_gauge_set(server_metrics.time_scale, game_step.time_scale);
 
-        accum_g += elapsed_time_g;
-        while(accum_g >= 1.0/TARGET_FPS)
+        for(int i = 0; i < steps; ++i)
         {
+            double step_start = timer_get_time();
+            PROFILE_BEGIN("step");
             server_update_players();
-            accum_g -= 1.0/TARGET_FPS;
+            PROFILE_END();
+            metrics_histogram_record(server_metrics.step_time, (uint64_t)((timer_get_time() - step_start)*1000000.0));
         }
 
         server_update_game_status();
@@ -967,6 +1371,8 @@ int net_server_start()
 
         if(accum >= dt)
         {
+            PROFILE_BEGIN("send");
+
             // send state packet to all clients
             if(server.num_clients > 0)
             {
@@ -995,10 +1401,28 @@ int net_server_start()
 
                     // send world state to connected clients...
                     server_send(PACKET_TYPE_STATE,cli);
+
+                    metrics_gauge_set(server_metrics.client_rtt[i], cli->time_est.srtt);
                 }
             }
             accum = 0.0;
+
+            PROFILE_END();
+        }
+
+        metrics_gauge_set(server_metrics.num_clients, server.num_clients);
+        metrics_update(METRICS_PERIOD);
+
+        PROFILE_FRAME_END();
+#if PROFILER_ENABLED
+        if(trace_requested)
+        {
+            trace_requested = 0;
+            signal(TRACE_SIGNAL, trace_signal_handler); // some platforms reset the handler once it runs
+            if(profiler_export_chrome_trace(TRACE_FILE))
+                LOGN("Saved trace to %s", TRACE_FILE);
         }
+#endif
 
         // don't wait, just proceed to handling packets
         //timer_wait_for_frame(&server_timer);
@@ -1028,7 +1452,7 @@ void server_send_event(EventType event, float x, float y)
         if(cli->state != CONNECTED) continue;
 
         pkt.hdr.ack = cli->remote_latest_packet_id;
-        net_send(&server.info,&cli->address,&pkt);
+        net_send(&server.info,&cli->address,&pkt,&cli->time_est);
     }
 }
 
@@ -1070,7 +1494,7 @@ void server_send_message(uint8_t to, uint8_t from, char* fmt, ...)
             if(cli->state != CONNECTED) continue;
 
             pkt.hdr.ack = cli->remote_latest_packet_id;
-            net_send(&server.info,&cli->address,&pkt);
+            net_send(&server.info,&cli->address,&pkt,&cli->time_est);
         }
     }
     else
@@ -1081,7 +1505,7 @@ void server_send_message(uint8_t to, uint8_t from, char* fmt, ...)
         if(cli->state != CONNECTED) return;
 
         pkt.hdr.ack = cli->remote_latest_packet_id;
-        net_send(&server.info,&cli->address,&pkt);
+        net_send(&server.info,&cli->address,&pkt,&cli->time_est);
     }
 }
 
@@ -1098,7 +1522,12 @@ struct
     double time_of_latest_sent_packet;
     double time_of_last_ping;
     double time_of_last_received_ping;
-    double rtt;
+    double time_of_last_input;
+    TimeEstimator time_est;
+    uint32_t input_tick;
+    NetPlayerInput input_history[INPUT_REDUNDANCY]; // indexed by tick % INPUT_REDUNDANCY
+    int input_history_count;
+    bool input_changed;
     uint8_t player_count;
     uint8_t server_salt[8];
     uint8_t client_salt[8];
@@ -1107,13 +1536,19 @@ struct
 
 bool net_client_add_player_input(NetPlayerInput* input)
 {
-    if(input_count >= INPUT_QUEUE_MAX)
+    if(client.input_history_count > 0)
     {
-        LOGW("Input array is full!");
-        return false;
+        NetPlayerInput* prior = &client.input_history[client.input_tick % INPUT_REDUNDANCY];
+        if(prior->keys != input->keys)
+            client.input_changed = true;
     }
 
-    memcpy(&net_player_inputs[input_count], input, sizeof(NetPlayerInput));
+    input->tick = ++client.input_tick;
+
+    memcpy(&client.input_history[input->tick % INPUT_REDUNDANCY], input, sizeof(NetPlayerInput));
+    if(client.input_history_count < INPUT_REDUNDANCY)
+        client.input_history_count++;
+
     input_count++;
 
     return true;
@@ -1210,8 +1645,13 @@ static void client_clear()
     client.time_of_latest_sent_packet = 0.0;
     client.time_of_last_ping = 0.0;
     client.time_of_last_received_ping = 0.0;
-    client.rtt = 0.0;
+    client.time_of_last_input = 0.0;
+    memset(&client.time_est, 0, sizeof(TimeEstimator));
 
+    client.input_tick = 0;
+    client.input_history_count = 0;
+    client.input_changed = false;
+    input_count = 0;
 }
 
 static void client_send(PacketType type)
@@ -1237,7 +1677,7 @@ static void client_send(PacketType type)
             pack_bytes(&pkt, (uint8_t*)client.client_salt, 8);
             pkt.data_len = MAX_PACKET_DATA_SIZE; // pad to 1024
 
-            net_send(&client.info,&server.address,&pkt);
+            net_send(&client.info,&server.address,&pkt,&client.time_est);
         } break;
 
         case PACKET_TYPE_CONNECT_CHALLENGE_RESP:
@@ -1247,41 +1687,45 @@ static void client_send(PacketType type)
             pack_bytes(&pkt, (uint8_t*)client.xor_salts, 8);
             pkt.data_len = MAX_PACKET_DATA_SIZE; // pad to 1024
 
-            net_send(&client.info,&server.address,&pkt);
+            net_send(&client.info,&server.address,&pkt,&client.time_est);
         } break;
 
         case PACKET_TYPE_PING:
         {
             pack_bytes(&pkt, (uint8_t*)client.xor_salts, 8);
-            net_send(&client.info,&server.address,&pkt);
+            net_send(&client.info,&server.address,&pkt,&client.time_est);
         } break;
 
         case PACKET_TYPE_INPUT:
         {
             pack_bytes(&pkt, (uint8_t*)client.xor_salts, 8);
-            pack_u8(&pkt, input_count);
-            for(int i = 0; i < input_count; ++i)
+
+            // send the last INPUT_REDUNDANCY inputs, oldest first, so a lost packet
+            // is covered by the ones that follow it
+            int count = client.input_history_count;
+            uint16_t keys[INPUT_REDUNDANCY];
+            for(int i = 0; i < count; ++i)
             {
-                pack_bytes(&pkt, (uint8_t*)&net_player_inputs[i], sizeof(NetPlayerInput));
+                uint32_t tick = client.input_tick - (count - 1 - i);
+                keys[i] = (uint16_t)client.input_history[tick % INPUT_REDUNDANCY].keys;
             }
+            pack_inputs(&pkt, client.input_tick, keys, count);
 
             circbuf_add(&client.input_packets,&pkt);
-            net_send(&client.info,&server.address,&pkt);
+            net_send(&client.info,&server.address,&pkt,&client.time_est);
         } break;
 
         case PACKET_TYPE_SETTINGS:
         {
             pack_bytes(&pkt, (uint8_t*)client.xor_salts, 8);
-            pack_u8(&pkt, player->settings.sprite_index);
-            pack_u32(&pkt, player->settings.color);
-            pack_string(&pkt, player->settings.name, PLAYER_NAME_MAX);
+            pack_player_settings(&pkt, &player->settings);
 
             // LOGN("Client Send Settings");
             // LOGN("  color: 0x%08x", player->settings.color);
             // LOGN("  sprite index: %u", player->settings.sprite_index);
             // LOGN("  name (%d): %s", strlen(player->settings.name), player->settings.name);
 
-            net_send(&client.info,&server.address,&pkt);
+            net_send(&client.info,&server.address,&pkt,&client.time_est);
         } break;
 
         case PACKET_TYPE_DISCONNECT:
@@ -1291,7 +1735,7 @@ static void client_send(PacketType type)
             // redundantly send so packet is guaranteed to get through
             for(int i = 0; i < 3; ++i)
             {
-                net_send(&client.info,&server.address,&pkt);
+                net_send(&client.info,&server.address,&pkt,&client.time_est);
                 pkt.hdr.id = client.info.local_latest_packet_id;
             }
         } break;
@@ -1507,8 +1951,10 @@ void net_client_update()
 
                     for(int i = 0; i < num_players; ++i)
                     {
+                        PlayerStateRecord r;
+                        unpack_player_state(&srvpkt, &offset, &r);
 
-                        uint8_t client_id = unpack_u8(&srvpkt, &offset);
+                        uint8_t client_id = r.id;
 
                         //LOGN("  %d: Client ID %d", i, client_id);
 
@@ -1518,20 +1964,13 @@ void net_client_update()
                             break;
                         }
 
-                        Vector2f pos    = unpack_vec2(&srvpkt, &offset);
-                        float angle     = unpack_float(&srvpkt, &offset);
-                        float energy    = unpack_float(&srvpkt, &offset);
-                        float hp        = unpack_float(&srvpkt, &offset);
-                        uint8_t deaths  = unpack_u8(&srvpkt, &offset);
-                        uint8_t invincible = unpack_u8(&srvpkt, &offset);
-
-                        //LOGN("      Pos: %f, %f. Angle: %f", pos.x, pos.y, angle);
+                        //LOGN("      Pos: %f, %f. Angle: %f", r.pos.x, r.pos.y, r.angle);
 
                         Player* p = &players[client_id];
 
                         p->active = true;
-                        p->deaths = deaths;
-                        p->invincible = invincible == 0x01 ? true : false;
+                        p->deaths = r.deaths;
+                        p->invincible = r.invincible;
 
                         ParticleSpawner* jets = get_spawner_by_id(p->jets_id);
                         if(jets)
@@ -1553,11 +1992,11 @@ void net_client_update()
                         p->server_state_prior.energy = p->energy;
                         p->server_state_prior.hp = p->hp;
 
-                        p->server_state_target.pos.x = pos.x;
-                        p->server_state_target.pos.y = pos.y;
-                        p->server_state_target.angle = angle;
-                        p->server_state_target.energy = energy;
-                        p->server_state_target.hp = hp;
+                        p->server_state_target.pos.x = r.pos.x;
+                        p->server_state_target.pos.y = r.pos.y;
+                        p->server_state_target.angle = r.angle;
+                        p->server_state_target.energy = r.energy;
+                        p->server_state_target.hp = r.hp;
 
                         if(!prior_active[client_id])
                         {
@@ -1580,26 +2019,24 @@ void net_client_update()
                         {
                             Projectile* p = &projectiles[i];
 
-                            uint16_t id = unpack_u16(&srvpkt, &offset);
-                            Vector2f pos = unpack_vec2(&srvpkt, &offset);
-                            float angle = unpack_float(&srvpkt, &offset);
-                            uint8_t player_id = unpack_u8(&srvpkt, &offset);
+                            ProjectileStateRecord r;
+                            unpack_projectile_state(&srvpkt, &offset, &r);
 
                             p->lerp_t = 0.0;
 
-                            //LOGN("      Pos: %f, %f. Angle: %f", pos.x, pos.y, angle);
+                            //LOGN("      Pos: %f, %f. Angle: %f", r.pos.x, r.pos.y, r.angle);
 
                             p->server_state_prior.id = p->id;
                             p->server_state_prior.pos.x = p->pos.x;
                             p->server_state_prior.pos.y = p->pos.y;
                             p->server_state_prior.angle = p->angle_deg;
 
-                            p->server_state_target.id = id;
-                            p->server_state_target.pos.x = pos.x;
-                            p->server_state_target.pos.y = pos.y;
-                            p->server_state_target.angle = angle;
+                            p->server_state_target.id = r.id;
+                            p->server_state_target.pos.x = r.pos.x;
+                            p->server_state_target.pos.y = r.pos.y;
+                            p->server_state_target.angle = r.angle;
 
-                            p->player_id = player_id;
+                            p->player_id = r.player_id;
                         }
                     }
 
@@ -1611,10 +2048,10 @@ void net_client_update()
 
                         for(int i = 0; i < num_active_powerups; ++i)
                         {
-                            uint8_t type = (PowerupType)unpack_u8(&srvpkt, &offset);
-                            Vector2f pos = unpack_vec2(&srvpkt, &offset);
+                            PowerupStateRecord r;
+                            unpack_powerup_state(&srvpkt, &offset, &r);
 
-                            powerups_add(pos.x, pos.y, type);
+                            powerups_add(r.pos.x, r.pos.y, (PowerupType)r.type);
                         }
                     }
 
@@ -1663,9 +2100,7 @@ void net_client_update()
                         }
 
                         Player* p = &players[client_id];
-                        p->settings.sprite_index = unpack_u8(&srvpkt, &offset);
-                        p->settings.color = unpack_u32(&srvpkt, &offset);
-                        uint8_t namelen = unpack_string(&srvpkt, p->settings.name, PLAYER_NAME_MAX, &offset);
+                        uint8_t namelen = unpack_player_settings(&srvpkt, &offset, &p->settings);
 
                         LOGN("Client Received Settings, Client ID: %d", client_id);
                         LOGN("  color: 0x%08x", p->settings.color);
@@ -1686,7 +2121,6 @@ void net_client_update()
                 case PACKET_TYPE_PING:
                 {
                     client.time_of_last_received_ping = timer_get_time();
-                    client.rtt = 1000.0f*(client.time_of_last_received_ping - client.time_of_last_ping);
                 } break;
 
                 case PACKET_TYPE_MESSAGE:
@@ -1715,16 +2149,16 @@ void net_client_update()
                     switch(event)
                     {
                         case EVENT_TYPE_HIT:
-                            particles_spawn_effect(x,y, 1, &particle_effects[EFFECT_EXPLOSION], 0.2, false, false);
+                            particles_spawn_effect(x,y, 1, effect_handles[EFFECT_EXPLOSION], NULL, 0.2, false, false);
                             break;
                         case EVENT_TYPE_HEAL:
-                            particles_spawn_effect(x,y, 1, &particle_effects[EFFECT_HEAL1], 1.0, true, false);
+                            particles_spawn_effect(x,y, 1, effect_handles[EFFECT_HEAL1], NULL, 1.0, true, false);
                             break;
                         case EVENT_TYPE_HEAL_FULL:
-                            particles_spawn_effect(x,y, 1, &particle_effects[EFFECT_HEAL2], 1.0, true, false);
+                            particles_spawn_effect(x,y, 1, effect_handles[EFFECT_HEAL2], NULL, 1.0, true, false);
                             break;
                         case EVENT_TYPE_HOLY:
-                            particles_spawn_effect(x,y, 1, &particle_effects[EFFECT_HOLY1], 1.0, true, false);
+                            particles_spawn_effect(x,y, 1, effect_handles[EFFECT_HOLY1], NULL, 1.0, true, false);
                         default:
                             break;
                     }
@@ -1759,9 +2193,13 @@ void net_client_update()
     }
 
     // handle publishing inputs
-    if(input_count >= inputs_per_packet)
+    // key changes go out immediately, otherwise inputs are batched at the tick rate
+    double time_since_input = timer_get_time() - client.time_of_last_input;
+    if(input_count > 0 && (client.input_changed || time_since_input >= 1.0/TICK_RATE))
     {
         client_send(PACKET_TYPE_INPUT);
+        client.time_of_last_input = timer_get_time();
+        client.input_changed = false;
         input_count = 0;
     }
 }
@@ -1771,9 +2209,22 @@ bool net_client_is_connected()
     return (client.state == CONNECTED);
 }
 
+// smoothed, in ms
 double net_client_get_rtt()
 {
-    return client.rtt;
+    return client.time_est.srtt;
+}
+
+// standard deviation of rtt, in ms
+double net_client_get_jitter()
+{
+    return sqrt(client.time_est.rtt_var);
+}
+
+// server clock minus client clock on the 32-bit microsecond wire clock, in ms
+double net_client_get_clock_offset()
+{
+    return client.time_est.offset;
 }
 
 void net_client_disconnect()
@@ -1820,7 +2271,7 @@ void net_client_send_message(uint8_t to, char* fmt, ...)
 
     free(msg);
 
-    net_send(&client.info,&server.address,&pkt);
+    net_send(&client.info,&server.address,&pkt,&client.time_est);
 }
 
 
@@ -1834,7 +2285,7 @@ int net_client_send(uint8_t* data, uint32_t len)
     memcpy(pkt.data,data,len);
     pkt.data_len = len;
 
-    int sent_bytes = net_send(&client.info, &server.address, &pkt);
+    int sent_bytes = net_send(&client.info, &server.address, &pkt,&client.time_est);
     return sent_bytes;
 }
 
@@ -1842,6 +2293,11 @@ int net_client_recv(Packet* pkt)
 {
     Address from = {0};
     int recv_bytes = net_recv(&client.info, &from, pkt);
+
+    // only samples packets the caller will also treat as the latest
+    if(recv_bytes > 0 && pkt->hdr.game_id == GAME_ID && is_packet_id_greater(pkt->hdr.id, client.info.remote_latest_packet_id))
+        time_estimator_recv(&client.time_est, &pkt->hdr, net_time_us());
+
     return recv_bytes;
 }
 
@@ -1991,64 +2447,264 @@ static inline Vector2f unpack_vec2(Packet* pkt, int* offset)
     return r;
 }
 
-void test_packing()
+// =========================
+// Serialization benchmark
+// =========================
+
+#define BENCH_UDP_OVERHEAD 28 // IPv4 + UDP headers per datagram
+
+static const float bench_tick_rates[] = {10.0f, 20.0f, 30.0f, 60.0f};
+#define BENCH_NUM_TICK_RATES (int)(sizeof(bench_tick_rates)/sizeof(bench_tick_rates[0]))
+
+static volatile float bench_sink;
+
+// same layout as server_send(PACKET_TYPE_STATE)
+static void bench_pack_state(Packet* pkt, Player* plrs, int num_plrs, Projectile* projs, int num_projs, Powerup* pups, int num_pups)
+{
+    pkt->data_len = 0;
+    pack_u8(pkt, (uint8_t)GAME_STATUS_RUNNING);
+    pack_u8(pkt, 0);
+    pack_u8(pkt, (uint8_t)num_plrs);
+    for(int i = 0; i < num_plrs; ++i)
+        pack_player_state(pkt, (uint8_t)i, &plrs[i]);
+
+    pack_u8(pkt, (uint8_t)num_projs);
+    for(int i = 0; i < num_projs; ++i)
+        pack_projectile_state(pkt, &projs[i]);
+
+    pack_u8(pkt, (uint8_t)num_pups);
+    for(int i = 0; i < num_pups; ++i)
+        pack_powerup_state(pkt, &pups[i]);
+}
+
+static float bench_unpack_state(Packet* pkt)
+{
+    float sum = 0.0;
+    int offset = 2;
+
+    int num_plrs = unpack_u8(pkt, &offset);
+    for(int i = 0; i < num_plrs; ++i)
+    {
+        PlayerStateRecord r;
+        unpack_player_state(pkt, &offset, &r);
+        sum += r.pos.x + r.hp;
+    }
+
+    int num_projs = unpack_u8(pkt, &offset);
+    for(int i = 0; i < num_projs; ++i)
+    {
+        ProjectileStateRecord r;
+        unpack_projectile_state(pkt, &offset, &r);
+        sum += r.pos.x + r.angle;
+    }
+
+    int num_pups = unpack_u8(pkt, &offset);
+    for(int i = 0; i < num_pups; ++i)
+    {
+        PowerupStateRecord r;
+        unpack_powerup_state(pkt, &offset, &r);
+        sum += r.pos.y;
+    }
+
+    return sum;
+}
+
+// same layout as client_send(PACKET_TYPE_INPUT)
+static void bench_pack_input(Packet* pkt, uint16_t* keys, int count)
+{
+    uint8_t salts[8] = {0};
+    pkt->data_len = 0;
+    pack_bytes(pkt, salts, 8);
+    pack_inputs(pkt, 1000, keys, count);
+}
+
+static float bench_unpack_input(Packet* pkt)
+{
+    int offset = 8;
+    uint32_t newest_tick;
+    uint16_t keys[INPUT_REDUNDANCY];
+    int count = unpack_inputs(pkt, &offset, &newest_tick, keys);
+
+    float sum = (float)newest_tick;
+    for(int i = 0; i < count; ++i)
+        sum += keys[i];
+    return sum;
+}
+
+// same layout as server_send(PACKET_TYPE_SETTINGS)
+static void bench_pack_settings(Packet* pkt, Player* plrs, int num_plrs)
+{
+    pkt->data_len = 0;
+    pack_u8(pkt, (uint8_t)num_plrs);
+    for(int i = 0; i < num_plrs; ++i)
+    {
+        pack_u8(pkt, (uint8_t)i);
+        pack_player_settings(pkt, &plrs[i].settings);
+    }
+}
+
+static float bench_unpack_settings(Packet* pkt)
 {
+    float sum = 0.0;
+    int offset = 0;
 
+    int num_plrs = unpack_u8(pkt, &offset);
+    for(int i = 0; i < num_plrs; ++i)
+    {
+        Settings settings;
+        sum += unpack_u8(pkt, &offset);
+        sum += unpack_player_settings(pkt, &offset, &settings);
+    }
+    return sum;
+}
 
-    Packet pkt = {0};
+static void bench_print_rates(int bytes, int multiplier)
+{
+    for(int i = 0; i < BENCH_NUM_TICK_RATES; ++i)
+        printf(" %9.2f", (bytes + BENCH_UDP_OVERHEAD) * bench_tick_rates[i] * multiplier / 1024.0);
+}
 
-    uint16_t id0;
-    Vector2f pos0;
-    float a0;
-    uint8_t pid0;
-    uint32_t color0;
-    uint64_t u64_0;
+static void bench_print_rate_header(const char* label)
+{
+    for(int i = 0; i < BENCH_NUM_TICK_RATES; ++i)
+    {
+        char col[32];
+        snprintf(col, sizeof(col), "%s@%.0f", label, bench_tick_rates[i]);
+        printf(" %9s", col);
+    }
+    printf("\n");
+}
 
-    id0 = 12037;
-    pack_u16(&pkt,id0);
+// Encode/decode throughput and wire sizes of the per-tick packets, used to
+// size bandwidth per server. Rates are in KB/s and include UDP/IP overhead.
+void net_bench_packing(int iterations)
+{
+    static Player plrs[256];
+    static Projectile projs[MAX_PROJECTILES];
+    static Powerup pups[4];
+    static Packet pkt;
 
-    pos0.x = 123.456;
-    pos0.y = 69.420;
-    pack_vec2(&pkt,pos0);
+    const int player_counts[] = {2, 4, 8, 16, 32, 64};
+    const int projectile_counts[] = {0, 16, 64, 255};
 
-    a0 = 234.1354;
-    pack_float(&pkt,a0);
+    srand(1234);
 
-    pid0 = 85;
-    pack_u8(&pkt,pid0);
+    for(int i = 0; i < 256; ++i)
+    {
+        Player* p = &plrs[i];
+        memset(p, 0, sizeof(Player));
+        p->pos.x = RAND_FLOAT(0.0, VIEW_WIDTH);
+        p->pos.y = RAND_FLOAT(0.0, VIEW_HEIGHT);
+        p->angle_deg = RAND_FLOAT(0.0, 360.0);
+        p->energy = RAND_FLOAT(0.0, MAX_ENERGY);
+        p->hp = RAND_FLOAT(0.0, 100.0);
+        p->deaths = rand() % 3;
+        p->settings.sprite_index = rand() % 4;
+        p->settings.color = (uint32_t)rand() & 0x00FFFFFF;
+        snprintf(p->settings.name, PLAYER_NAME_MAX+1, "Spaceman %07d", rand());
+    }
 
-    color0 = 2342612;
-    pack_u32(&pkt,color0);
+    for(int i = 0; i < MAX_PROJECTILES; ++i)
+    {
+        Projectile* proj = &projs[i];
+        memset(proj, 0, sizeof(Projectile));
+        proj->id = (uint16_t)i;
+        proj->pos.x = RAND_FLOAT(0.0, VIEW_WIDTH);
+        proj->pos.y = RAND_FLOAT(0.0, VIEW_HEIGHT);
+        proj->angle_deg = RAND_FLOAT(0.0, 360.0);
+        proj->player_id = rand() % MAX_PLAYERS;
+    }
 
-    u64_0 = 0xab000000cd000001;
-    pack_u64(&pkt,u64_0);
+    for(int i = 0; i < 4; ++i)
+    {
+        memset(&pups[i], 0, sizeof(Powerup));
+        pups[i].type = 1 + i % (POWERUP_TYPE_MAX-1);
+        pups[i].pos.x = RAND_FLOAT(0.0, VIEW_WIDTH);
+        pups[i].pos.y = RAND_FLOAT(0.0, VIEW_HEIGHT);
+    }
 
+    iterations = MAX(iterations, 1);
 
-    LOGI("Packet Length: %d", pkt.data_len);
-    print_hex(pkt.data, pkt.data_len);
+    // STATE, server -> each client every tick
+    printf("\nSTATE (server to client, 4 powerups), downstream KB/s per client and for the whole server at %.0f Hz\n", TICK_RATE);
+    printf("%7s %5s %6s %9s %9s %9s", "players", "proj", "bytes", "enc ns", "dec ns", "enc MB/s");
+    printf(" %9s", "server");
+    bench_print_rate_header("client");
 
+    for(int i = 0; i < (int)(sizeof(player_counts)/sizeof(player_counts[0])); ++i)
+    {
+        for(int j = 0; j < (int)(sizeof(projectile_counts)/sizeof(projectile_counts[0])); ++j)
+        {
+            int np = player_counts[i];
+            int nproj = projectile_counts[j];
+
+            double t0 = timer_get_time();
+            for(int k = 0; k < iterations; ++k)
+                bench_pack_state(&pkt, plrs, np, projs, nproj, pups, 4);
+            double t1 = timer_get_time();
+            for(int k = 0; k < iterations; ++k)
+                bench_sink += bench_unpack_state(&pkt);
+            double t2 = timer_get_time();
+
+            int bytes = get_packet_size(&pkt);
+            double enc_ns = (t1-t0)*1e9/iterations;
+            double dec_ns = (t2-t1)*1e9/iterations;
+
+            printf("%7d %5d %6d %9.0f %9.0f %9.1f", np, nproj, bytes, enc_ns, dec_ns, bytes/enc_ns*1000.0);
+            printf(" %9.1f", (bytes + BENCH_UDP_OVERHEAD) * TICK_RATE * np / 1024.0);
+            bench_print_rates(bytes, 1);
+            printf("\n");
+        }
+    }
 
-    uint16_t id1;
-    Vector2f pos1;
-    float a1;
-    uint8_t pid1;
-    uint32_t color1;
-    uint64_t u64_1;
+    // INPUT, each client -> server on every tick it sends
+    printf("\nINPUT (client to server), upstream KB/s per client\n");
+    printf("%7s %6s %9s %9s %9s", "inputs", "bytes", "enc ns", "dec ns", "enc MB/s");
+    bench_print_rate_header("client");
 
-    int index = 0;
-    id1 = unpack_u16(&pkt, &index);
-    pos1 = unpack_vec2(&pkt, &index);
-    a1 = unpack_float(&pkt, &index);
-    pid1 = unpack_u8(&pkt, &index);
-    color1 = unpack_u32(&pkt, &index);
-    u64_1 = unpack_u64(&pkt, &index);
+    uint16_t keys[INPUT_REDUNDANCY];
+    for(int i = 0; i < INPUT_REDUNDANCY; ++i)
+        keys[i] = rand() & 0xFF;
 
-    LOGI("Unpack final index: %d", index);
+    for(int count = 1; count <= INPUT_REDUNDANCY; count = (count == INPUT_REDUNDANCY ? count+1 : MIN(count*2, INPUT_REDUNDANCY)))
+    {
+        double t0 = timer_get_time();
+        for(int k = 0; k < iterations; ++k)
+            bench_pack_input(&pkt, keys, count);
+        double t1 = timer_get_time();
+        for(int k = 0; k < iterations; ++k)
+            bench_sink += bench_unpack_input(&pkt);
+        double t2 = timer_get_time();
+
+        int bytes = get_packet_size(&pkt);
+        double enc_ns = (t1-t0)*1e9/iterations;
+        double dec_ns = (t2-t1)*1e9/iterations;
+
+        printf("%7d %6d %9.0f %9.0f %9.1f", count, bytes, enc_ns, dec_ns, bytes/enc_ns*1000.0);
+        bench_print_rates(bytes, 1);
+        printf("\n");
+    }
+
+    // SETTINGS, sent to every client whenever someone changes theirs
+    printf("\nSETTINGS (server to client, full length names)\n");
+    printf("%7s %6s %9s %9s %9s\n", "players", "bytes", "enc ns", "dec ns", "enc MB/s");
+
+    for(int i = 0; i < (int)(sizeof(player_counts)/sizeof(player_counts[0])); ++i)
+    {
+        int np = player_counts[i];
 
-    LOGI("ID: %u  =  %u", id0, id1);
-    LOGI("Pos: %.3f, %.3f  =  %.3f, %.3f", pos0.x, pos0.y, pos1.x, pos1.y);
-    LOGI("Angle: %.4f  =  %.4f", a0, a1);
-    LOGI("P ID: %u  =  %u", pid0, pid1);
-    LOGI("Color: %u  =  %u", color0, color1);
-    LOGI("u64: %llu  =  %llu", u64_0, u64_1);
+        double t0 = timer_get_time();
+        for(int k = 0; k < iterations; ++k)
+            bench_pack_settings(&pkt, plrs, np);
+        double t1 = timer_get_time();
+        for(int k = 0; k < iterations; ++k)
+            bench_sink += bench_unpack_settings(&pkt);
+        double t2 = timer_get_time();
+
+        int bytes = get_packet_size(&pkt);
+        double enc_ns = (t1-t0)*1e9/iterations;
+        double dec_ns = (t2-t1)*1e9/iterations;
+
+        printf("%7d %6d %9.0f %9.0f %9.1f\n", np, bytes, enc_ns, dec_ns, bytes/enc_ns*1000.0);
+    }
 }
@@ -82,6 +82,9 @@ PACK(struct PacketHeader
     uint32_t ack_bitfield;
     uint8_t type;
     uint8_t pad[3]; // pad to be 4-byte aligned
+    uint32_t time;       // sender clock in microseconds (wraps every ~71 minutes)
+    uint32_t echo_time;  // time of the latest packet received from the peer, 0 if none
+    uint32_t echo_delay; // microseconds between receiving that packet and sending this one
 });
 
 typedef struct PacketHeader PacketHeader;
@@ -98,6 +101,7 @@ typedef struct Packet Packet;
 
 PACK(struct NetPlayerInput
 {
+    uint32_t tick; // client simulation tick the input was sampled on
     double delta_t;
     uint32_t keys;
 });
@@ -156,10 +160,13 @@ bool net_client_set_server_ip(char* address);
 void net_client_get_server_ip_str(char* ip_str);
 bool net_client_data_waiting();
 double net_client_get_rtt();
+double net_client_get_jitter();
+double net_client_get_clock_offset();
 void net_client_send_settings();
 void net_client_send_message(uint8_t to, char* fmt, ...);
 int net_client_send(uint8_t* data, uint32_t len);
 int net_client_recv(Packet* pkt);
 void net_client_deinit();
 
-void test_packing();
+// serialization benchmark and wire size report, see spacemen_bench --net
+void net_bench_packing(int iterations);
@@ -98,7 +98,7 @@ void players_init()
 
         if(role != ROLE_SERVER)
         {
-            ParticleSpawner* j = particles_spawn_effect(p->pos.x,p->pos.y, 0, &particle_effects[EFFECT_JETS],0.0,true,true);
+            ParticleSpawner* j = particles_spawn_effect(p->pos.x,p->pos.y, 0, effect_handles[EFFECT_JETS], NULL, 0.0,true,true);
             p->jets_id = j->id;
         }
     }
@@ -467,13 +467,13 @@ void player_update(Player* p, double delta_t)
             switch(pup->type)
             {
                 case POWERUP_TYPE_INVINCIBILITY:
-                    particles_spawn_effect(pup->pos.x, pup->pos.y, 1, &particle_effects[EFFECT_HOLY1], 1.0, true, false);
+                    particles_spawn_effect(pup->pos.x, pup->pos.y, 1, effect_handles[EFFECT_HOLY1], NULL, 1.0, true, false);
                     break;
                 case POWERUP_TYPE_HEALTH:
-                    particles_spawn_effect(p->pos.x, p->pos.y, 1, &particle_effects[EFFECT_HEAL1], 1.0, true, false);
+                    particles_spawn_effect(p->pos.x, p->pos.y, 1, effect_handles[EFFECT_HEAL1], NULL, 1.0, true, false);
                     break;
                 case POWERUP_TYPE_HEALTH_FULL:
-                    particles_spawn_effect(p->pos.x, p->pos.y, 1, &particle_effects[EFFECT_HEAL2], 1.0, true, false);
+                    particles_spawn_effect(p->pos.x, p->pos.y, 1, effect_handles[EFFECT_HEAL2], NULL, 1.0, true, false);
                     break;
                 default:
                     break;
@@ -776,10 +776,8 @@ void player_handle_net_inputs(Player* p, double delta_t)
         }
     }
 
-    if(p->input.keys != p->input_prior.keys)
-    {
-        net_client_add_player_input(&p->input);
-    }
+    // sampled every tick, net keeps the recent history for redundancy
+    net_client_add_player_input(&p->input);
 }
 
 void player_lerp(Player* p, double delta_t)
@@ -78,7 +78,10 @@ void powerups_init()
         powerups_img = gfx_load_image("src/img/powerups.png", false, false, 32, 32);
     }
 
-    powerup_list = list_create((void*)powerups, MAX_POWERUPS, sizeof(Powerup));
+    if(powerup_list == NULL)
+        powerup_list = list_create((void*)powerups, MAX_POWERUPS, sizeof(Powerup));
+    else
+        list_clear(powerup_list);
 
     powerup_spawn_time = 0.0;
     powerup_spawn_time_target = get_next_powerups_spawn_time();
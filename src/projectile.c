@@ -260,7 +260,7 @@ void projectile_handle_collisions(float delta_t)
             {
                 if(role != ROLE_SERVER)
                 {
-                    particles_spawn_effect(p->pos.x, p->pos.y, 1, &particle_effects[EFFECT_EXPLOSION], 0.2, false, false);
+                    particles_spawn_effect(p->pos.x, p->pos.y, 1, effect_handles[EFFECT_EXPLOSION], NULL, 0.2, false, false);
                     text_list_add(text_lst, 1.0, "%s hit %s", player[p->player_id].settings.name, player[j].settings.name);
                 }
 